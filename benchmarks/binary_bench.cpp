@@ -0,0 +1,60 @@
+// binary_bench.cpp : Benchmarks the bit-packed inference of `BinaryLayer` against the float
+// `PlainLinearLayer` of the same shape
+// Reports mean milliseconds per forward call and the speedup. Configure with `-DNEURAL_NATIVE=ON`
+// to enable the AVX-512 VPOPCNTDQ or AVX2 kernel on CPUs supporting them
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <Eigen/Core>
+#include "../include/layers.h"
+#include "../include/binary.h"
+
+using Dense = Neural::PlainLinearLayer<MatrixX_RowMajor<float>>;
+using Binary = Neural::BinaryLayer<MatrixX_RowMajor<float>>;
+
+template<typename Function>
+double timeMs(const Function& func, int reps) {
+    func(); // Warm-up
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++) {
+        func();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / reps;
+}
+
+int main()
+{
+    constexpr int reps = 20;
+
+    struct Case {
+        Eigen::Index batch;
+        Eigen::Index in_dim;
+        Eigen::Index out_dim;
+    };
+    std::vector<Case> cases = { { 1, 1024, 1024 }, { 1, 4096, 4096 }, { 64, 1024, 1024 },
+                                { 64, 4096, 4096 }, { 256, 2048, 512 } };
+
+#ifdef __AVX512VPOPCNTDQ__
+    std::cout << "popcount kernel: AVX-512 VPOPCNTDQ\n";
+#elif defined(__AVX2__)
+    std::cout << "popcount kernel: AVX2\n";
+#else
+    std::cout << "popcount kernel: scalar\n";
+#endif
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "ms per forward call (float / binary, speedup)\n";
+    for (auto& c : cases) {
+        MatrixX_RowMajor<float> inputs = MatrixX_RowMajor<float>::Random(c.batch, c.in_dim);
+        Dense dense(c.in_dim, c.out_dim, Neural::Init::XavierUniform, 0);
+        Binary binary(c.in_dim, c.out_dim, 1);
+
+        double dense_ms = timeMs([&]() { dense.feedForward(inputs); }, reps);
+        double binary_ms = timeMs([&]() { binary.feedForwardInference(inputs); }, reps);
+
+        std::cout << c.batch << " x " << c.in_dim << " -> " << c.out_dim << ": " << dense_ms << " / "
+                  << binary_ms << ", " << dense_ms / binary_ms << "x\n";
+    }
+}
@@ -0,0 +1,144 @@
+// conv_bench.cpp : Benchmarks the im2col and direct kernels of `PlainConvLayer` and pooling
+// Reports mean milliseconds per call of forward, backward and weight update for a few shapes,
+// after checking that both kernels agree on padded, strided shapes and that max pooling handles
+// NaN and -inf windows (exits with 1 if not)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+#include "../include/conv.h"
+
+using Layer = Neural::PlainConvLayer<MatrixX_RowMajor<float>>;
+using Pool = Neural::PoolLayer<MatrixX_RowMajor<float>>;
+
+template<typename Function>
+double timeMs(const Function& func, int reps) {
+    func(); // Warm-up
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++) {
+        func();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / reps;
+}
+
+// Largest absolute difference between the im2col and direct kernels (same weights) over
+// forward outputs, input gradients and updated weights
+float maxKernelDifference(const Neural::ConvShape& shape, Eigen::Index out_channels) {
+    constexpr Eigen::Index batch = 3;
+    Layer im2col(shape, out_channels, 0, Neural::Init::HeNormal, 42, Neural::ConvAlgo::Im2col);
+    Layer direct(shape, out_channels, 0, Neural::Init::HeNormal, 42, Neural::ConvAlgo::Direct);
+    direct.parameters()[0] = im2col.parameters()[0];
+
+    MatrixX_RowMajor<float> inputs = MatrixX_RowMajor<float>::Random(batch, shape.inSize());
+    MatrixX_RowMajor<float> tgradient = MatrixX_RowMajor<float>::Random(batch, im2col.outSize());
+    MatrixX_RowMajor<float> signals = im2col.feedForward(inputs).first;
+    float diff = (signals - direct.feedForward(inputs).first).cwiseAbs().maxCoeff();
+    MatrixX_RowMajor<float> backward = im2col.backPropagate(signals.array(), tgradient.array()).second;
+    diff = std::max(diff, (backward - direct.backPropagate(signals.array(), tgradient.array()).second).cwiseAbs().maxCoeff());
+    im2col.updateWeights(inputs, tgradient, 0.1f);
+    direct.updateWeights(inputs, tgradient, 0.1f);
+    return std::max(diff, (im2col.parameters()[0] - direct.parameters()[0]).cwiseAbs().maxCoeff());
+}
+
+// Max pooling over windows holding only NaN, only -inf, or NaN among numbers: NaN must propagate,
+// and every output must route its gradient to an element of its window
+bool poolHandlesNaN() {
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float inf = std::numeric_limits<float>::infinity();
+    Neural::ConvShape shape{ 4, 2, 2, 2, 2, 2, 0 };
+    MatrixX_RowMajor<float> inputs(1, shape.inSize());
+    // Pixels (h, w) of 2 channels, two 2x2 windows stacked vertically
+    inputs << nan, -inf, nan, -inf,
+              nan, -inf, nan, -inf,
+              1.0f, 1.0f, nan, 5.0f,
+              3.0f, 3.0f, 2.0f, 2.0f;
+
+    Pool pool(shape, Neural::Pool::Max);
+    MatrixX_RowMajor<float> outputs = pool.feedForward(inputs).first;
+    bool forward_ok = std::isnan(outputs(0, 0)) && outputs(0, 1) == -inf &&
+                      std::isnan(outputs(0, 2)) && outputs(0, 3) == 5.0f;
+
+    MatrixX_RowMajor<float> tgradient = MatrixX_RowMajor<float>::Ones(1, outputs.cols());
+    MatrixX_RowMajor<float> backward = pool.backPropagate(outputs.array(), tgradient.array()).second;
+    return forward_ok && backward.sum() == 4.0f && backward(0, 11) == 1.0f;
+}
+
+int main()
+{
+    constexpr Eigen::Index batch = 32;
+    constexpr int reps = 5;
+
+    // Padding wider than the window's overlap with the input, strides not dividing the input
+    std::vector<Neural::ConvShape> check_shapes = {
+        { 2, 2, 1, 5, 5, 2, 2 },
+        { 5, 7, 3, 3, 5, 2, 2 },
+        { 6, 6, 2, 4, 4, 3, 3 },
+        { 7, 4, 4, 3, 3, 3, 1 },
+        { 9, 9, 2, 2, 3, 1, 0 },
+    };
+    for (const auto& shape : check_shapes) {
+        float diff = maxKernelDifference(shape, 4);
+        if (!(diff < 1e-4f)) {
+            std::cerr << "im2col and direct kernels differ by " << diff << " on " << shape.height << "x"
+                      << shape.width << "x" << shape.channels << " k" << shape.kernel_h << "x" << shape.kernel_w
+                      << " s" << shape.stride << " p" << shape.padding << "\n";
+            return 1;
+        }
+    }
+
+    if (!poolHandlesNaN()) {
+        std::cerr << "max pooling mishandles NaN or -inf windows\n";
+        return 1;
+    }
+
+    struct Case {
+        std::string name;
+        Neural::ConvShape shape;
+        Eigen::Index out_channels;
+    };
+    std::vector<Case> cases = {
+        { "28x28x1 k3 -> 16 ", { 28, 28, 1, 3, 3, 1, 1 }, 16 },
+        { "28x28x16 k3 -> 32", { 28, 28, 16, 3, 3, 1, 1 }, 32 },
+        { "32x32x3 k5 s2 -> 32", { 32, 32, 3, 5, 5, 2, 2 }, 32 },
+        { "16x16x64 k3 -> 64", { 16, 16, 64, 3, 3, 1, 1 }, 64 },
+        { "64x40x1 k3 -> 32 (spectrogram)", { 64, 40, 1, 3, 3, 1, 1 }, 32 },
+    };
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "batch " << batch << ", ms per call (forward / backward / update)\n";
+    for (auto& c : cases) {
+        MatrixX_RowMajor<float> inputs = MatrixX_RowMajor<float>::Random(batch, c.shape.inSize());
+
+        std::cout << c.name << "\n";
+        for (auto algo : { Neural::ConvAlgo::Im2col, Neural::ConvAlgo::Direct }) {
+            Layer layer(c.shape, c.out_channels, 0, Neural::Init::HeNormal, 42, algo);
+            MatrixX_RowMajor<float> signals = layer.feedForward(inputs).first;
+            MatrixX_RowMajor<float> tgradient = MatrixX_RowMajor<float>::Random(batch, layer.outSize());
+
+            double fwd = timeMs([&]() { layer.feedForward(inputs); }, reps);
+            double bwd = timeMs([&]() { layer.backPropagate(signals.array(), tgradient.array()); }, reps);
+            double upd = timeMs([&]() { layer.updateWeights(inputs, tgradient, 0.0); }, reps);
+
+            std::cout << "  " << (algo == Neural::ConvAlgo::Im2col ? "im2col" : "direct")
+                      << ": " << fwd << " / " << bwd << " / " << upd << "\n";
+        }
+    }
+
+    Neural::ConvShape pool_shape{ 28, 28, 32, 2, 2, 2, 0 };
+    MatrixX_RowMajor<float> pool_inputs = MatrixX_RowMajor<float>::Random(batch, pool_shape.inSize());
+    for (auto mode : { Neural::Pool::Max, Neural::Pool::Avg }) {
+        Pool pool(pool_shape, mode);
+        MatrixX_RowMajor<float> outputs = pool.feedForward(pool_inputs).first;
+        double fwd = timeMs([&]() { pool.feedForward(pool_inputs); }, reps);
+        double bwd = timeMs([&]() { pool.backPropagate(outputs.array(), outputs.array()); }, reps);
+        std::cout << (mode == Neural::Pool::Max ? "max" : "avg") << " pool 28x28x32 k2 s2: "
+                  << fwd << " / " << bwd << "\n";
+    }
+}
@@ -0,0 +1,61 @@
+// projection_bench.cpp : Benchmarks `RandomProjectionLayer` followed by a dense layer against a
+// dense first layer on very wide inputs
+// Reports mean milliseconds per forward call and the number of stored floats of each variant
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+#include "../include/layers.h"
+#include "../include/projection.h"
+
+using Dense = Neural::PlainLinearLayer<MatrixX_RowMajor<float>>;
+using Projection = Neural::RandomProjectionLayer<MatrixX_RowMajor<float>>;
+
+template<typename Function>
+double timeMs(const Function& func, int reps) {
+    func(); // Warm-up
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++) {
+        func();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / reps;
+}
+
+int main()
+{
+    constexpr Eigen::Index batch = 64;
+    constexpr Eigen::Index hidden = 256;
+    constexpr int reps = 3;
+
+    struct Case {
+        Eigen::Index in_dim;
+        Eigen::Index projected_dim;
+    };
+    std::vector<Case> cases = { { 16384, 1024 }, { 100000, 1024 }, { 100000, 4096 }, { 250000, 2048 } };
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "batch " << batch << ", " << hidden << " hidden units, ms per forward call (floats stored)\n";
+    for (auto& c : cases) {
+        MatrixX_RowMajor<float> inputs = MatrixX_RowMajor<float>::Random(batch, c.in_dim);
+
+        Dense dense(c.in_dim, hidden, Neural::Init::XavierUniform, 0);
+        double dense_ms = timeMs([&]() { dense.feedForward(inputs); }, reps);
+
+        Projection projection(c.in_dim, c.projected_dim, 1);
+        Dense projected_dense(c.projected_dim, hidden, Neural::Init::XavierUniform, 2);
+        MatrixX_RowMajor<float> projected = projection.feedForward(inputs).first;
+        double projection_ms = timeMs([&]() { projection.feedForward(inputs); }, reps);
+        double projected_dense_ms = timeMs([&]() { projected_dense.feedForward(projected); }, reps);
+
+        std::cout << c.in_dim << " -> " << hidden << ": dense " << dense_ms << " ("
+                  << (c.in_dim + 1) * hidden << ")\n"
+                  << c.in_dim << " -> " << c.projected_dim << " -> " << hidden << ": projection "
+                  << projection_ms << " + dense " << projected_dense_ms << " = "
+                  << projection_ms + projected_dense_ms << " ("
+                  << c.in_dim + c.projected_dim + (c.projected_dim + 1) * hidden << ")\n";
+    }
+}
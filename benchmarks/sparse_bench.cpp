@@ -0,0 +1,94 @@
+// sparse_bench.cpp : Benchmarks the sparse-dense kernels of utilities/sparse.h against dense GEMMs
+// for the forward and two backward products of `LinearLayer`, over a sweep of densities
+// Reports mean milliseconds per product and, per shape, the crossover density below which the
+// sparse kernel wins; `SparseKernels::forward_density_threshold` and
+// `SparseKernels::density_threshold` are set from these crossovers
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/random.h"
+#include "../utilities/sparse.h"
+
+template<typename Function>
+double timeMs(const Function& func, int reps) {
+    func(); // Warm-up
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++) {
+        func();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / reps;
+}
+
+// ReLU-like matrix: entries drawn normal, then zeroed with probability `1 - density`
+MatrixX_RowMajor<float> sparseMatrix(Eigen::Index rows, Eigen::Index cols, float density, int seed) {
+    MatrixX_RowMajor<float> mat(rows, cols), keep(rows, cols);
+    Philox(seed, 0).fillNormal(mat);
+    Philox(seed, 1).fillUniform(keep);
+    return (keep.array() < density).select(mat, 0.0f);
+}
+
+int main()
+{
+    constexpr int reps = 10;
+
+    struct Case {
+        Eigen::Index batch;
+        Eigen::Index in_dim;
+        Eigen::Index out_dim;
+    };
+    std::vector<Case> cases = { { 64, 512, 512 }, { 256, 1024, 1024 }, { 256, 2048, 512 } };
+    std::vector<float> densities = { 0.02f, 0.05f, 0.1f, 0.15f, 0.2f, 0.25f, 0.3f, 0.4f, 0.5f, 0.7f };
+
+    std::cout << std::fixed << std::setprecision(3);
+    for (auto& c : cases) {
+        std::cout << c.batch << " x " << c.in_dim << " -> " << c.out_dim << "\n";
+        std::cout << "density | forward dense / sparse (ms) | weight grad. dense / sparse (ms) | "
+                     "input grad. dense / sparse (ms)\n";
+        MatrixX_RowMajor<float> dense_gradient = sparseMatrix(c.batch, c.out_dim, 1.0f, 3);
+        MatrixX_RowMajor<float> weights = sparseMatrix(c.in_dim, c.out_dim, 1.0f, 4);
+        MatrixX_RowMajor<float> step(c.in_dim, c.out_dim), new_tgradient(c.batch, c.in_dim), signals(c.batch, c.out_dim);
+        float forward_crossover = 0, weight_crossover = 0, input_crossover = 0;
+
+        for (float density : densities) {
+            MatrixX_RowMajor<float> inputs = sparseMatrix(c.batch, c.in_dim, density, 1);
+
+            // Forward product `inputs * weights`, with sparse inputs (indicator features stored dense),
+            // including the density estimate and compression paid by `LinearLayer` on every batch
+            double forward_dense = timeMs([&]() { signals.noalias() = inputs * weights; }, reps);
+            double forward_sparse = timeMs([&]() {
+                if (SparseKernels::sparseEnough(inputs, 1.0f)) {
+                    SparseKernels::product(SparseKernels::compress(inputs), weights, signals);
+                }
+            }, reps);
+
+            // Weight gradient `inputs^T * gradient`, with sparse inputs (activations of a ReLU layer)
+            double weight_dense = timeMs([&]() { step.noalias() = inputs.transpose() * dense_gradient; }, reps);
+            double weight_sparse = timeMs([&]() {
+                SparseKernels::transposedProduct(SparseKernels::compress(inputs), dense_gradient, step);
+            }, reps);
+
+            // Input gradient `gradient * weights^T`, with a sparse gradient (masked by the ReLU derivative).
+            // The transposed weights are cached by `LinearLayer` between weight updates, so their
+            // transposition is paid outside of the timed product
+            MatrixX_RowMajor<float> gradient = sparseMatrix(c.batch, c.out_dim, density, 2);
+            MatrixX_RowMajor<float> weights_t = weights.transpose();
+            double input_dense = timeMs([&]() { new_tgradient.noalias() = gradient * weights.transpose(); }, reps);
+            double input_sparse = timeMs([&]() {
+                SparseKernels::product(SparseKernels::compress(gradient), weights_t, new_tgradient);
+            }, reps);
+
+            forward_crossover = forward_sparse < forward_dense ? density : forward_crossover;
+            weight_crossover = weight_sparse < weight_dense ? density : weight_crossover;
+            input_crossover = input_sparse < input_dense ? density : input_crossover;
+            std::cout << density << " | " << forward_dense << " / " << forward_sparse << " | "
+                      << weight_dense << " / " << weight_sparse << " | " << input_dense << " / " << input_sparse << "\n";
+        }
+        std::cout << "crossover density: forward " << forward_crossover << ", weight grad. "
+                  << weight_crossover << ", input grad. " << input_crossover << "\n\n";
+    }
+}
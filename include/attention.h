@@ -0,0 +1,277 @@
+// attention.h: Contains facilities for attention-based pooling over sets of feature vectors
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/traits_concepts.h"
+#include "../utilities/paral.h"
+#include "../utilities/random.h"
+#include "../utilities/softmax.h"
+
+namespace Neural {
+    /*
+    * @brief: Encapsulates multi-head attention pooling over unordered sets (pooling by
+    *         multi-head attention, as in Set Transformers)
+    *
+    * Every input row holds a set of up to @max_set_size elements of @elem_dim features,
+    * concatenated; all-zero elements are padding and ignored, so sets may vary in size. Each head
+    * `h` projects the elements to keys `K_h = X Wk_h` and values `V_h = X Wv_h` and attends from a
+    * learned seed query `q_h`; the output row concatenates `softmax(K_h q_h / sqrt(head_dim))^T V_h`
+    * over heads, and is invariant to the order of the elements. Seeds start at zero, i.e. as mean
+    * pooling.
+    *
+    * Elements are processed in blocks of `elem_block`, in parallel over (row, block) pairs: each
+    * block projects its elements and reduces its scores with `OnlineSoftmax`, then block states
+    * are merged per row, so scores are never materialized. The backward pass recomputes block
+    * probabilities from the cached log-normalizers and applies `softMaxBackward` in the same
+    * blocks.
+    *
+    * @tparam EigenType: Must be `Eigen::T<float, Eigen::Dynamic, Eigen::Dynamic>`
+    * where `T` is `Array` or `Matrix`
+    */
+    template <typename EigenType>
+    class SetAttentionPool {
+    public:
+        SetAttentionPool(Eigen::Index elem_dim, Eigen::Index max_set_size, Eigen::Index num_heads,
+                         Eigen::Index head_dim, std::uint64_t stream, int seed = 42) :
+            elem_dim(elem_dim), max_set_size(max_set_size), num_heads(num_heads), head_dim(head_dim),
+            num_blocks((max_set_size + elem_block - 1) / elem_block), scale(1.0f / std::sqrt((float)head_dim))
+        {
+            if (elem_dim <= 0 || max_set_size <= 0 || num_heads <= 0 || head_dim <= 0) {
+                throw std::invalid_argument("received non-positive dimensions");
+            }
+            float bound = std::sqrt(6.0f / (float)(elem_dim + num_heads * head_dim));
+            key_weights.resize(elem_dim, num_heads * head_dim);
+            value_weights.resize(elem_dim, num_heads * head_dim);
+            Philox(seed, Philox::substream(stream, 0)).fillUniform(key_weights, -bound, bound);
+            Philox(seed, Philox::substream(stream, 1)).fillUniform(value_weights, -bound, bound);
+            seeds = MatrixX_RowMajor<float>::Zero(num_heads, head_dim);
+        }
+
+        auto feedForward(const MatrixX_RowMajor_Ref<float>& inputs) {
+            if (inputs.cols() != max_set_size * elem_dim) {
+                throw std::invalid_argument("number of columns of @inputs does not match layer");
+            }
+            const Eigen::Index num_rows = inputs.rows(), width = num_heads * head_dim;
+            keys.resize(num_rows * max_set_size, width);
+            values.resize(num_rows * max_set_size, width);
+            valid.resize(num_rows * max_set_size);
+            std::vector<OnlineSoftmax> states(num_rows * num_blocks * num_heads);
+            MatrixX_RowMajor<float> block_outputs(num_rows * num_blocks, width);
+
+            forEachBlock(num_rows, [&](Eigen::Index r, Eigen::Index first, Eigen::Index size, Eigen::Index task) {
+                Eigen::Index e = r * max_set_size + first;
+                auto elements = elementsOf(inputs, r, first, size);
+                keys.middleRows(e, size).noalias() = elements * key_weights;
+                values.middleRows(e, size).noalias() = elements * value_weights;
+                for (Eigen::Index i = 0; i < size; i++) {
+                    valid[e + i] = (elements.row(i).array() != 0.0f).any();
+                }
+
+                ArrRowX<float> scores(size);
+                for (Eigen::Index h = 0; h < num_heads; h++) {
+                    Eigen::Index count = blockScores(e, size, h, scores);
+                    auto block_scores = scores.head(count);
+                    states[task * num_heads + h].update(block_scores);
+
+                    auto output = block_outputs.row(task).segment(h * head_dim, head_dim);
+                    output.setZero();
+                    for (Eigen::Index i = 0, k = 0; i < size; i++) {
+                        if (valid[e + i]) {
+                            output += scores(k++) * values.row(e + i).segment(h * head_dim, head_dim);
+                        }
+                    }
+                }
+            });
+
+            // Merge block states of every row
+            outputs.resize(num_rows, width);
+            log_normalizers.resize(num_rows, num_heads);
+            rangeParExec(
+                num_rows,
+                [&](int& r) {
+                    for (Eigen::Index h = 0; h < num_heads; h++) {
+                        OnlineSoftmax state;
+                        auto output = outputs.row(r).segment(h * head_dim, head_dim);
+                        output.setZero();
+                        for (Eigen::Index b = 0; b < num_blocks; b++) {
+                            Eigen::Index task = r * num_blocks + b;
+                            auto rescale = state.merge(states[task * num_heads + h]);
+                            output = rescale.first * output
+                                     + rescale.second * block_outputs.row(task).segment(h * head_dim, head_dim);
+                        }
+                        // Sets made of padding only pool to zero
+                        if (state.sum > 0) {
+                            output /= state.sum;
+                        }
+                        log_normalizers(r, h) = state.sum > 0 ? state.logSumExp() : 0.0f;
+                    }
+                }
+            );
+
+            auto outputs_eval = MatOrArray<EigenType>::eval(outputs);
+            return std::make_pair(outputs_eval, outputs_eval);
+        }
+
+        // To be used if instance is a hidden layer. Returns @tgradient and the gradient wrt the inputs
+        auto backPropagate(const ArrayX_RowMajor_Ref<float>& signals,
+                           const ArrayX_RowMajor_Ref<float>& tgradient) {
+            const Eigen::Index num_rows = tgradient.rows(), width = num_heads * head_dim;
+            if (num_rows != outputs.rows() || tgradient.cols() != width) {
+                throw std::invalid_argument("shape of @tgradient does not match last forward pass");
+            }
+            key_gradient.resize(num_rows * max_set_size, width);
+            value_gradient.resize(num_rows * max_set_size, width);
+            seed_gradient_parts.setZero(num_rows * num_blocks, width);
+            MatrixX_RowMajor<float> new_tgradient(num_rows, max_set_size * elem_dim);
+
+            // `<p, dP>` over a whole set equals `<dO, O>`, which is known before any block
+            ArrayX_RowMajor<float> dots(num_rows, num_heads);
+            for (Eigen::Index r = 0; r < num_rows; r++) {
+                for (Eigen::Index h = 0; h < num_heads; h++) {
+                    dots(r, h) = tgradient.row(r).segment(h * head_dim, head_dim).matrix()
+                                 .dot(outputs.row(r).segment(h * head_dim, head_dim));
+                }
+            }
+
+            forEachBlock(num_rows, [&](Eigen::Index r, Eigen::Index first, Eigen::Index size, Eigen::Index task) {
+                Eigen::Index e = r * max_set_size + first;
+                key_gradient.middleRows(e, size).setZero();
+                value_gradient.middleRows(e, size).setZero();
+
+                ArrRowX<float> scores(size), prob_gradient(size);
+                for (Eigen::Index h = 0; h < num_heads; h++) {
+                    Eigen::Index count = blockScores(e, size, h, scores);
+                    auto output_gradient = tgradient.row(r).segment(h * head_dim, head_dim).matrix();
+                    for (Eigen::Index i = 0, k = 0; i < size; i++) {
+                        if (valid[e + i]) {
+                            prob_gradient(k++) = output_gradient.dot(values.row(e + i).segment(h * head_dim, head_dim));
+                        }
+                    }
+                    ArrRowX<float> probs = (scores.head(count) - log_normalizers(r, h)).unaryExpr(std::ref(myExp));
+                    ArrRowX<float> score_gradient = scale * softMaxBackward(probs, prob_gradient.head(count), dots(r, h));
+
+                    auto seed_gradient = seed_gradient_parts.row(task).segment(h * head_dim, head_dim);
+                    for (Eigen::Index i = 0, k = 0; i < size; i++) {
+                        if (valid[e + i]) {
+                            value_gradient.row(e + i).segment(h * head_dim, head_dim) = probs(k) * output_gradient;
+                            key_gradient.row(e + i).segment(h * head_dim, head_dim) = score_gradient(k) * seeds.row(h);
+                            seed_gradient += score_gradient(k) * keys.row(e + i).segment(h * head_dim, head_dim);
+                            k++;
+                        }
+                    }
+                }
+
+                Eigen::Map<MatrixX_RowMajor<float>> element_gradient(new_tgradient.row(r).data() + first * elem_dim, size, elem_dim);
+                element_gradient.noalias() = key_gradient.middleRows(e, size) * key_weights.transpose();
+                element_gradient.noalias() += value_gradient.middleRows(e, size) * value_weights.transpose();
+            });
+
+            return std::make_pair(MatOrArray<EigenType>::eval(tgradient.matrix()),
+                                  MatOrArray<EigenType>::eval(new_tgradient));
+        }
+
+        // Updates projections and seeds using gradient descent. @inputs must be those of the last
+        // forward pass; @gradient is unused (gradients cached by `backPropagate` are applied)
+        void updateWeights(const MatrixX_RowMajor_Ref<float>& inputs, const MatrixX_RowMajor_Ref<float>&, float lr) {
+            const Eigen::Index num_rows = inputs.rows(), width = num_heads * head_dim;
+            if (num_rows * max_set_size != key_gradient.rows()) {
+                throw std::invalid_argument("shape of @inputs does not match last backward pass");
+            }
+
+            // Per-task partial products over strided rows, then a sequential reduction
+            Eigen::Index num_tasks = std::min<Eigen::Index>(num_rows, std::max(1u, std::thread::hardware_concurrency()));
+            std::vector<MatrixX_RowMajor<float>> key_parts(num_tasks), value_parts(num_tasks);
+            rangeParExec(
+                num_tasks,
+                [&](int& task) {
+                    key_parts[task] = MatrixX_RowMajor<float>::Zero(elem_dim, width);
+                    value_parts[task] = MatrixX_RowMajor<float>::Zero(elem_dim, width);
+                    for (Eigen::Index r = task; r < num_rows; r += num_tasks) {
+                        auto elements = elementsOf(inputs, r, 0, max_set_size);
+                        key_parts[task].noalias() += elements.transpose() * key_gradient.middleRows(r * max_set_size, max_set_size);
+                        value_parts[task].noalias() += elements.transpose() * value_gradient.middleRows(r * max_set_size, max_set_size);
+                    }
+                }
+            );
+            for (Eigen::Index task = 0; task < num_tasks; task++) {
+                key_weights -= lr * key_parts[task];
+                value_weights -= lr * value_parts[task];
+            }
+            MatRowX<float> seed_gradient = seed_gradient_parts.colwise().sum();
+            seeds -= lr * Eigen::Map<MatrixX_RowMajor<float>>(seed_gradient.data(), num_heads, head_dim);
+
+            return;
+        }
+
+        Eigen::Index outputDim() const {
+            return num_heads * head_dim;
+        }
+
+    private:
+        // Set elements per parallel task
+        constexpr static Eigen::Index elem_block = 64;
+
+        // Calls @func(row, first element, number of elements, task) for every block of every row,
+        // in parallel; `task = row * num_blocks + block`
+        template <typename BlockFunction>
+        void forEachBlock(Eigen::Index num_rows, const BlockFunction& func) const {
+            rangeParExec(
+                num_rows * num_blocks,
+                [&](int& task) {
+                    Eigen::Index r = task / num_blocks, first = (task % num_blocks) * elem_block;
+                    func(r, first, std::min(elem_block, max_set_size - first), (Eigen::Index)task);
+                }
+            );
+        }
+
+        // Elements `first, ..., first + size - 1` of the set in row @r of @inputs
+        auto elementsOf(const MatrixX_RowMajor_Ref<float>& inputs, Eigen::Index r, Eigen::Index first,
+                        Eigen::Index size) const {
+            return Eigen::Map<const MatrixX_RowMajor<float>>(inputs.data() + r * inputs.outerStride() + first * elem_dim,
+                                                             size, elem_dim);
+        }
+
+        // Writes the scaled scores of head @h for the valid elements among `e, ..., e + size - 1`
+        // to the front of @scores; returns their number
+        Eigen::Index blockScores(Eigen::Index e, Eigen::Index size, Eigen::Index h, ArrRowX<float>& scores) const {
+            Eigen::Index count = 0;
+            for (Eigen::Index i = 0; i < size; i++) {
+                if (valid[e + i]) {
+                    scores(count++) = scale * keys.row(e + i).segment(h * head_dim, head_dim).dot(seeds.row(h));
+                }
+            }
+            return count;
+        }
+
+        Eigen::Index elem_dim;
+        Eigen::Index max_set_size;
+        Eigen::Index num_heads;
+        Eigen::Index head_dim;
+        Eigen::Index num_blocks;
+        float scale;
+
+        MatrixX_RowMajor<float> key_weights;
+        MatrixX_RowMajor<float> value_weights;
+        MatrixX_RowMajor<float> seeds;
+
+        // Cached by last forward pass for backward pass
+        MatrixX_RowMajor<float> keys;
+        MatrixX_RowMajor<float> values;
+        std::vector<char> valid;
+        MatrixX_RowMajor<float> outputs;
+        ArrayX_RowMajor<float> log_normalizers;
+
+        // Cached by last backward pass for update
+        MatrixX_RowMajor<float> key_gradient;
+        MatrixX_RowMajor<float> value_gradient;
+        MatrixX_RowMajor<float> seed_gradient_parts;
+    };
+}
@@ -0,0 +1,210 @@
+// batching.h: Contains facilities for training with mini-batches growing in size
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/random.h"
+
+namespace Neural {
+    /*
+    * @brief: Rules deciding when `GrowingBatchTrainer` grows its batch. `Schedule` grows it every
+    *         `steps_per_stage` steps; `NoiseScale` grows it once the measured gradient noise scale
+    *         exceeds it, i.e. once a larger batch would still reduce the gradient noise efficiently
+    */
+    enum class BatchGrowth {Schedule, NoiseScale};
+
+    /*
+    * @brief: Settings of `GrowingBatchTrainer`
+    *
+    * `growth_factor`: factor applied to the batch size at each growth (clamped to `max_batch`)
+    * `steps_per_stage`: steps between growths (`Schedule`), or minimal steps at a given batch
+    *                    size before growing (`NoiseScale`)
+    * `measure_every`: steps between two measurements of the noise scale (`NoiseScale`)
+    * `noise_smoothing`: decay of the moving averages behind the noise scale estimate
+    */
+    struct BatchGrowthOptions {
+        Eigen::Index initial_batch = 32;
+        Eigen::Index max_batch = 4096;
+        float growth_factor = 2.0f;
+        int steps_per_stage = 100;
+        int measure_every = 10;
+        float noise_smoothing = 0.9f;
+    };
+
+    /*
+    * @brief: Trains a network on mini-batches drawn without replacement from a dataset, starting
+    *         small and growing the batch instead of decaying the learning rate (Smith et al., "Don't
+    *         decay the learning rate, increase the batch size")
+    *
+    * The noise scale `B_simple = tr(Sigma) / |G|^2` (McCandlish et al., "An empirical model of
+    * large-batch training") is estimated from the gradients of both halves of a batch, via
+    * `FeedFwdNN::lossAndGradient`, which costs one extra forward and backward pass per
+    * measurement. Being a deterministic evaluation, a measurement leaves the running statistics
+    * of batch normalization untouched. Batch workspaces are reused from step to step and only
+    * resized on growth.
+    *
+    * @tparam NetType: Network type (e.g. `MultiClassNN`), trained through `train(lr, inputs, labels)`.
+    *                 The network and dataset are referenced, not copied, and must outlive the trainer
+    */
+    template <typename NetType, typename EigenType_1, typename EigenType_2>
+    class GrowingBatchTrainer {
+    public:
+        GrowingBatchTrainer(NetType& nn, const EigenType_1& inputs, const EigenType_2& one_hot_labels,
+                            BatchGrowth rule, std::uint64_t stream, BatchGrowthOptions options = {},
+                            int seed = 42) :
+            nn(nn), inputs(inputs), one_hot_labels(one_hot_labels), rule(rule), options(options),
+            seed(seed), stream(stream)
+        {
+            if (inputs.rows() != one_hot_labels.rows() || inputs.rows() == 0) {
+                throw std::invalid_argument("received empty or mismatched @inputs and @one_hot_labels");
+            }
+            if (options.initial_batch < 2 || options.max_batch < options.initial_batch || options.growth_factor <= 1
+                || options.steps_per_stage < 1 || options.measure_every < 1
+                || options.noise_smoothing < 0 || options.noise_smoothing >= 1) {
+                throw std::invalid_argument("received invalid batch growth settings");
+            }
+            batch_size = std::min(options.initial_batch, inputs.rows());
+            resizeWorkspaces();
+        }
+
+        // Trains on the next mini-batch with learning rate @lr, then grows the batch if due. Returns the loss
+        auto step(float lr) {
+            gatherBatch();
+            if (rule == BatchGrowth::NoiseScale && num_steps % options.measure_every == 0) {
+                measureNoise();
+            }
+            auto loss = nn.train(lr, batch_inputs, batch_labels);
+
+            num_steps++;
+            stage_steps++;
+            if (growthDue()) {
+                grow();
+            }
+            return loss;
+        }
+
+        Eigen::Index batchSize() const {
+            return batch_size;
+        }
+
+        int steps() const {
+            return num_steps;
+        }
+
+        // Number of growths so far
+        int stage() const {
+            return num_stages;
+        }
+
+        // Current estimate of `B_simple`; zero until measured (`NoiseScale` only)
+        float noiseScale() const {
+            return gradient_sq > 0 ? (float)std::max(0.0, trace / gradient_sq) : 0.0f;
+        }
+
+    private:
+        bool growthDue() const {
+            if (batch_size >= std::min(options.max_batch, inputs.rows()) || stage_steps < options.steps_per_stage) {
+                return false;
+            }
+            return rule == BatchGrowth::Schedule || noiseScale() > (float)batch_size;
+        }
+
+        void grow() {
+            Eigen::Index limit = std::min(options.max_batch, inputs.rows());
+            batch_size = std::min(limit, (Eigen::Index)std::ceil(batch_size * options.growth_factor));
+            resizeWorkspaces();
+            stage_steps = 0;
+            num_stages++;
+            // Estimates at the previous size are not comparable: start afresh
+            trace = 0;
+            gradient_sq = 0;
+            num_measures = 0;
+        }
+
+        void resizeWorkspaces() {
+            batch_inputs.resize(batch_size, inputs.cols());
+            batch_labels.resize(batch_size, one_hot_labels.cols());
+            half_inputs.resize(batch_size / 2, inputs.cols());
+            half_labels.resize(batch_size / 2, one_hot_labels.cols());
+        }
+
+        // Copies the next rows of the current epoch's permutation into the batch workspaces; an epoch
+        // ends when fewer rows than a batch remain. Each epoch draws from its own sub-stream of
+        // `stream`, so that shuffles of distinct seeds or epochs never coincide
+        void gatherBatch() {
+            if (permutation.size() == 0 || cursor + batch_size > permutation.size()) {
+                permutation = Philox(seed, Philox::substream(stream, (std::uint64_t)num_epochs)).permutation(inputs.rows());
+                num_epochs++;
+                cursor = 0;
+            }
+            for (Eigen::Index r = 0; r < batch_size; r++) {
+                batch_inputs.row(r) = inputs.row(permutation(cursor + r));
+                batch_labels.row(r) = one_hot_labels.row(permutation(cursor + r));
+            }
+            cursor += batch_size;
+        }
+
+        /*
+        * @brief: Updates the estimates of `|G|^2` and `tr(Sigma)` from the mean gradients `g_1`, `g_2`
+        *         of both halves of the batch (size `b` each) and their mean `G_B` (size `B = 2b`):
+        *         `|G|^2 ~ (B |G_B|^2 - b |g|^2) / (B - b)` and
+        *         `tr(Sigma) ~ (|g|^2 - |G_B|^2) / (1 / b - 1 / B)`, with `|g|^2` the mean of `|g_i|^2`
+        */
+        void measureNoise() {
+            Eigen::Index half = batch_size / 2;
+            MatColX<float> first_gradient, second_gradient;
+            half_inputs = batch_inputs.topRows(half);
+            half_labels = batch_labels.topRows(half);
+            nn.lossAndGradient(half_inputs, half_labels, first_gradient);
+            half_inputs = batch_inputs.middleRows(half, half);
+            half_labels = batch_labels.middleRows(half, half);
+            nn.lossAndGradient(half_inputs, half_labels, second_gradient);
+            if (first_gradient.size() == 0) {
+                throw std::logic_error("noise scale requires layers implementing `parameters()`");
+            }
+
+            double small = (double)half, big = 2.0 * (double)half;
+            double small_sq = 0.5 * ((double)first_gradient.squaredNorm() + (double)second_gradient.squaredNorm());
+            double big_sq = 0.25 * (double)(first_gradient + second_gradient).squaredNorm();
+            double new_gradient_sq = (big * big_sq - small * small_sq) / (big - small);
+            double new_trace = (small_sq - big_sq) / (1.0 / small - 1.0 / big);
+
+            // Both are averaged separately, as their ratio is biased for noisy single estimates
+            double decay = num_measures == 0 ? 0.0 : options.noise_smoothing;
+            gradient_sq = decay * gradient_sq + (1.0 - decay) * new_gradient_sq;
+            trace = decay * trace + (1.0 - decay) * new_trace;
+            num_measures++;
+        }
+
+        NetType& nn;
+        const EigenType_1& inputs;
+        const EigenType_2& one_hot_labels;
+        BatchGrowth rule;
+        BatchGrowthOptions options;
+        int seed;
+        std::uint64_t stream;
+
+        Eigen::Index batch_size;
+        int num_steps = 0;
+        int stage_steps = 0;
+        int num_stages = 0;
+
+        MatColX<int> permutation;
+        Eigen::Index cursor = 0;
+        int num_epochs = 0;
+
+        // Workspaces, resized on growth only
+        EigenType_1 batch_inputs;
+        EigenType_2 batch_labels;
+        EigenType_1 half_inputs;
+        EigenType_2 half_labels;
+
+        double gradient_sq = 0;
+        double trace = 0;
+        int num_measures = 0;
+    };
+}
@@ -0,0 +1,226 @@
+// batchnorm.h: Contains facilities implementing batch normalization layers
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/traits_concepts.h"
+#include "../utilities/paral.h"
+
+namespace Neural {
+    /*
+    * @brief: Encapsulates batch normalization as a hidden layer
+    *
+    * Training normalizes every feature column with the statistics of the batch, then applies the
+    * learned affine transform `gamma * x + beta`. Statistics (Welford), normalization and affine
+    * transform are fused: each parallel task owns a block of columns and makes two sweeps over its
+    * rows. Running statistics are tracked with momentum @momentum for use at inference.
+    *
+    * If constructed from the preceding layer (expected to implement `outputDim`,
+    * `setInferenceFold` and `invalidateInference`, like `LinearLayer`), the layer is folded into
+    * the weights and bias row of the latter at inference and bypassed by `FeedFwdNN::test`. The
+    * fold is only exact when the preceding layer has no activation (e.g. `PlainLinearLayer`), which
+    * is checked at compile time; after an activated layer, use the standalone constructor.
+    *
+    * @tparam EigenType: Must be `Eigen::T<float, Eigen::Dynamic, Eigen::Dynamic>`
+    * where `T` is `Array` or `Matrix`
+    */
+    template <typename EigenType>
+    class BatchNormLayer {
+    public:
+        // Standalone layer; applies running statistics itself at inference
+        BatchNormLayer(Eigen::Index dim, float momentum = 0.1, float epsilon = 1e-5) :
+            dim(dim), momentum(momentum), epsilon(epsilon)
+        {
+            if (momentum <= 0 || momentum > 1) {
+                throw std::invalid_argument("received @momentum outside of (0, 1]");
+            }
+            gamma = ArrRowX<float>::Ones(dim);
+            beta = ArrRowX<float>::Zero(dim);
+            running_mean = ArrRowX<float>::Zero(dim);
+            running_var = ArrRowX<float>::Ones(dim);
+        }
+
+        // Layer folded into @preceding at inference. Neither obj may be moved afterwards
+        template <typename LayerType>
+        BatchNormLayer(LayerType& preceding, float momentum = 0.1, float epsilon = 1e-5) :
+            BatchNormLayer(preceding.outputDim(), momentum, epsilon)
+        {
+            static_assert(!LayerType::has_activation,
+                          "cannot fold batch normalization across an activation: construct it from its dimension");
+            preceding.setInferenceFold([this](const MatrixX_RowMajor<float>& weights,
+                                              MatrixX_RowMajor<float>& folded_weights)
+                                       { fold(weights, folded_weights); });
+            invalidate_preceding = [&preceding]() { preceding.invalidateInference(); };
+        }
+
+        auto feedForward(const MatrixX_RowMajor_Ref<float>& inputs) {
+            if (inputs.cols() != dim) {
+                throw std::invalid_argument("number of columns of @inputs does not match layer");
+            }
+            Eigen::Index num_rows = inputs.rows();
+            normalized.resize(num_rows, dim);
+            inv_std.resize(dim);
+            MatrixX_RowMajor<float> outputs(num_rows, dim);
+
+            ArrRowX<float> mean(dim), var(dim);
+            forEachBlock([&](Eigen::Index first, Eigen::Index size) {
+                // Sweep 1: Welford's running mean and sum of squared deviations
+                ArrRowX<float> block_mean = ArrRowX<float>::Zero(size);
+                ArrRowX<float> block_m2 = ArrRowX<float>::Zero(size);
+                for (Eigen::Index r = 0; r < num_rows; r++) {
+                    auto x = inputs.row(r).segment(first, size).array();
+                    ArrRowX<float> delta = x - block_mean;
+                    block_mean += delta / (float)(r + 1);
+                    block_m2 += delta * (x - block_mean);
+                }
+                mean.segment(first, size) = block_mean;
+                var.segment(first, size) = block_m2 / (float)num_rows;
+                inv_std.segment(first, size) = (var.segment(first, size) + epsilon).rsqrt();
+
+                // Sweep 2: normalization and affine transform
+                for (Eigen::Index r = 0; r < num_rows; r++) {
+                    auto x_hat = normalized.row(r).segment(first, size);
+                    x_hat = (inputs.row(r).segment(first, size).array() - block_mean) * inv_std.segment(first, size);
+                    outputs.row(r).segment(first, size).array() = gamma.segment(first, size) * x_hat
+                                                                  + beta.segment(first, size);
+                }
+            });
+
+            if (!deterministic) {
+                float unbiased = num_rows > 1 ? (float)num_rows / (float)(num_rows - 1) : 1.0f;
+                running_mean = (1 - momentum) * running_mean + momentum * mean;
+                running_var = (1 - momentum) * running_var + momentum * unbiased * var;
+                invalidateFold();
+            }
+
+            auto outputs_eval = MatOrArray<EigenType>::eval(outputs);
+            return std::make_pair(outputs_eval, outputs_eval);
+        }
+
+        // Only used when the layer is not folded: normalizes with the running statistics
+        auto feedForwardInference(const MatrixX_RowMajor_Ref<float>& inputs) {
+            ArrRowX<float> scale = gamma * (running_var + epsilon).rsqrt();
+            ArrRowX<float> shift = beta - running_mean * scale;
+
+            MatrixX_RowMajor<float> outputs = ((inputs.array().rowwise() * scale).rowwise() + shift).matrix();
+
+            auto outputs_eval = MatOrArray<EigenType>::eval(outputs);
+            return std::make_pair(outputs_eval, outputs_eval);
+        }
+
+        // Returns @tgradient as the gradient wrt the layer's outputs, and the gradient wrt its inputs.
+        // Gradients of `gamma` and `beta` are kept for `updateWeights`
+        auto backPropagate(const ArrayX_RowMajor_Ref<float>& signals,
+                           const ArrayX_RowMajor_Ref<float>& tgradient) {
+            Eigen::Index num_rows = tgradient.rows();
+            if (num_rows != normalized.rows() || tgradient.cols() != dim) {
+                throw std::invalid_argument("shape of @tgradient does not match last forward pass");
+            }
+            grad_gamma.resize(dim);
+            grad_beta.resize(dim);
+            MatrixX_RowMajor<float> new_tgradient(num_rows, dim);
+
+            forEachBlock([&](Eigen::Index first, Eigen::Index size) {
+                ArrRowX<float> sum_dy = ArrRowX<float>::Zero(size);
+                ArrRowX<float> sum_dy_xhat = ArrRowX<float>::Zero(size);
+                for (Eigen::Index r = 0; r < num_rows; r++) {
+                    auto dy = tgradient.row(r).segment(first, size);
+                    sum_dy += dy;
+                    sum_dy_xhat += dy * normalized.row(r).segment(first, size);
+                }
+                grad_beta.segment(first, size) = sum_dy;
+                grad_gamma.segment(first, size) = sum_dy_xhat;
+
+                ArrRowX<float> coeff = gamma.segment(first, size) * inv_std.segment(first, size) / (float)num_rows;
+                for (Eigen::Index r = 0; r < num_rows; r++) {
+                    new_tgradient.row(r).segment(first, size).array() =
+                        coeff * ((float)num_rows * tgradient.row(r).segment(first, size) - sum_dy
+                                 - normalized.row(r).segment(first, size) * sum_dy_xhat);
+                }
+            });
+
+            return std::make_pair(MatOrArray<EigenType>::eval(tgradient.matrix()),
+                                  MatOrArray<EigenType>::eval(new_tgradient));
+        }
+
+        // Updates `gamma` and `beta` using gradient descent; arguments other than @lr are unused
+        void updateWeights(const MatrixX_RowMajor_Ref<float>&, const MatrixX_RowMajor_Ref<float>&, float lr) {
+            gamma -= lr * grad_gamma;
+            beta -= lr * grad_beta;
+            invalidateFold();
+
+            return;
+        }
+
+        // While @deterministic is set, training passes leave the running statistics unchanged
+        // (see `FeedFwdNN::lossAndGradient`)
+        void setDeterministic(bool deterministic) {
+            this->deterministic = deterministic;
+        }
+
+        bool inferenceIdentity() const {
+            return static_cast<bool>(invalidate_preceding);
+        }
+
+        /*
+        * @brief: Computes @folded_weights, the augmented weights @weights of the preceding layer with
+        *         this layer's inference-time transform `(x - running_mean) * scale + beta` absorbed,
+        *         where `scale = gamma / sqrt(running_var + epsilon)`
+        */
+        void fold(const MatrixX_RowMajor<float>& weights, MatrixX_RowMajor<float>& folded_weights) const {
+            if (weights.cols() != dim) {
+                throw std::invalid_argument("number of columns of @weights does not match layer");
+            }
+            Eigen::Index in_dim = weights.rows() - 1;
+            ArrRowX<float> scale = gamma * (running_var + epsilon).rsqrt();
+
+            folded_weights.resize(weights.rows(), dim);
+            folded_weights.topRows(in_dim).array() = weights.topRows(in_dim).array().rowwise() * scale;
+            folded_weights.row(in_dim).array() = (weights.row(in_dim).array() - running_mean) * scale + beta;
+        }
+
+    private:
+        // Columns per parallel task; a multiple of the SIMD width
+        constexpr static Eigen::Index block_cols = 16;
+
+        template<typename BlockFunction>
+        void forEachBlock(const BlockFunction& func) const {
+            rangeParExec(
+                (dim + block_cols - 1) / block_cols,
+                [&](int& block) {
+                    Eigen::Index first = block * block_cols;
+                    func(first, std::min(block_cols, dim - first));
+                }
+            );
+        }
+
+        void invalidateFold() {
+            if (invalidate_preceding) {
+                invalidate_preceding();
+            }
+        }
+
+        Eigen::Index dim;
+        float momentum;
+        float epsilon;
+
+        ArrRowX<float> gamma;
+        ArrRowX<float> beta;
+        ArrRowX<float> running_mean;
+        ArrRowX<float> running_var;
+        bool deterministic = false;
+
+        // Cached by last forward pass for backward pass
+        ArrayX_RowMajor<float> normalized;
+        ArrRowX<float> inv_std;
+
+        ArrRowX<float> grad_gamma;
+        ArrRowX<float> grad_beta;
+
+        std::function<void()> invalidate_preceding;
+    };
+}
@@ -0,0 +1,321 @@
+// binary.h: Contains facilities for constructing binarized (XNOR-popcount) layers
+
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+#if defined(__AVX512VPOPCNTDQ__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "../utilities/types.h"
+#include "../utilities/traits_concepts.h"
+#include "../utilities/paral.h"
+#include "../utilities/random.h"
+
+namespace Neural {
+    namespace Detail {
+        /*
+        * @brief: Number of differing bits between each of the @Rows packed rows @x and the packed
+        *         row @w, all @num_words long. Uses AVX-512 VPOPCNTDQ when compiled for it, else AVX2
+        *         (per-nibble table lookups, summed per 64-bit lane), else `std::popcount`
+        */
+        template <int Rows>
+        inline void xorPopcount(const std::uint64_t* const* x, const std::uint64_t* w, Eigen::Index num_words,
+                                std::int64_t* counts) {
+            Eigen::Index i = 0;
+#ifdef __AVX512VPOPCNTDQ__
+            __m512i acc[Rows];
+            for (int r = 0; r < Rows; r++) {
+                acc[r] = _mm512_setzero_si512();
+            }
+            for (; i + 8 <= num_words; i += 8) {
+                __m512i weights = _mm512_loadu_si512(w + i);
+                for (int r = 0; r < Rows; r++) {
+                    __m512i diff = _mm512_xor_si512(_mm512_loadu_si512(x[r] + i), weights);
+                    acc[r] = _mm512_add_epi64(acc[r], _mm512_popcnt_epi64(diff));
+                }
+            }
+            if (i < num_words) {
+                __mmask8 mask = (__mmask8)((1u << (num_words - i)) - 1);
+                __m512i weights = _mm512_maskz_loadu_epi64(mask, w + i);
+                for (int r = 0; r < Rows; r++) {
+                    __m512i diff = _mm512_xor_si512(_mm512_maskz_loadu_epi64(mask, x[r] + i), weights);
+                    acc[r] = _mm512_add_epi64(acc[r], _mm512_popcnt_epi64(diff));
+                }
+                i = num_words;
+            }
+            for (int r = 0; r < Rows; r++) {
+                counts[r] = _mm512_reduce_add_epi64(acc[r]);
+            }
+#else
+#ifdef __AVX2__
+            const __m256i nibble_counts = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+            const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+            __m256i acc[Rows];
+            for (int r = 0; r < Rows; r++) {
+                acc[r] = _mm256_setzero_si256();
+            }
+            for (; i + 4 <= num_words; i += 4) {
+                __m256i weights = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + i));
+                for (int r = 0; r < Rows; r++) {
+                    __m256i diff = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(x[r] + i)), weights);
+                    __m256i bytes = _mm256_add_epi8(
+                        _mm256_shuffle_epi8(nibble_counts, _mm256_and_si256(diff, low_nibbles)),
+                        _mm256_shuffle_epi8(nibble_counts, _mm256_and_si256(_mm256_srli_epi16(diff, 4), low_nibbles)));
+                    acc[r] = _mm256_add_epi64(acc[r], _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+                }
+            }
+            for (int r = 0; r < Rows; r++) {
+                alignas(32) std::int64_t lanes[4];
+                _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc[r]);
+                counts[r] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            }
+#else
+            for (int r = 0; r < Rows; r++) {
+                counts[r] = 0;
+            }
+#endif
+            for (; i < num_words; i++) {
+                for (int r = 0; r < Rows; r++) {
+                    counts[r] += std::popcount(x[r][i] ^ w[i]);
+                }
+            }
+#endif
+        }
+    }
+
+    /*
+    * @brief: Encapsulates a binarized linear layer: `y = alpha * (sign(x) . sign(W)) + bias`,
+    *         with `alpha` the mean absolute latent weight of each output (XNOR-Net scaling)
+    *         divided by `sqrt(in_dim)`, which keeps outputs in the range of the straight-through
+    *         estimator of the next layer
+    *
+    * Training keeps latent float weights, clipped to `[-1, 1]`, and differentiates through the
+    * signs with straight-through estimators: the identity for the weights (clipping keeps them
+    * within its range) and `1{|x| <= 1}` for the inputs. At inference (`feedForwardInference`,
+    * used by `FeedFwdNN::test`), signs of weights and inputs are packed into 64-bit words and dot
+    * products computed as `in_dim - 2 * popcount(x XOR w)`. The packed weights are rebuilt lazily
+    * after updates. On the shapes of BinaryBench, this ran 1.5-3.5x faster than `PlainLinearLayer`
+    * in generic x86-64 builds (software popcount), and 3-17x (AVX2) or 5-33x (AVX-512 VPOPCNTDQ)
+    * with `NEURAL_NATIVE`; the gap is largest for single rows and shrinks with the batch size.
+    *
+    * The layer binarizes its own inputs, so stacked binary layers need no activation in between.
+    * The first layer of a network may keep real inputs (@binarize_inputs unset), in which case
+    * inference falls back to a float product with the binarized weights.
+    *
+    * @tparam EigenType: Must be `Eigen::T<float, Eigen::Dynamic, Eigen::Dynamic>`
+    * where `T` is `Array` or `Matrix`
+    */
+    template <typename EigenType>
+    class BinaryLayer {
+    public:
+        BinaryLayer(Eigen::Index in_dim, Eigen::Index out_dim, std::uint64_t stream, bool binarize_inputs = true,
+                    int seed = 42) :
+            in_dim(in_dim), out_dim(out_dim), binarize_inputs(binarize_inputs),
+            words_per_row((in_dim + 63) / 64)
+        {
+            if (in_dim <= 0 || out_dim <= 0) {
+                throw std::invalid_argument("received non-positive dimensions");
+            }
+            latent.resize(in_dim, out_dim);
+            Philox(seed, stream).fillUniform(latent, -1.0, 1.0);
+            bias = MatRowX<float>::Zero(out_dim);
+        }
+
+        auto feedForward(const MatrixX_RowMajor_Ref<float>& inputs) {
+            checkInputs(inputs);
+            if (binarize_inputs) {
+                binary_inputs = sign(inputs);
+                ste_mask = (inputs.array().abs() <= 1.0f).template cast<float>();
+            }
+            else {
+                binary_inputs = inputs;
+            }
+            binary_weights = sign(latent);
+            alpha = latent.array().abs().colwise().mean() / std::sqrt((float)in_dim);
+
+            MatrixX_RowMajor<float> signals = binary_inputs * binary_weights;
+            signals.array().rowwise() *= alpha;
+            signals.rowwise() += bias;
+
+            auto signals_eval = MatOrArray<EigenType>::eval(signals);
+            return std::make_pair(signals_eval, signals_eval);
+        }
+
+        // Bit-packed forward pass; matches `feedForward` up to float rounding
+        auto feedForwardInference(const MatrixX_RowMajor_Ref<float>& inputs) {
+            checkInputs(inputs);
+            if (packed_stale) {
+                packWeights();
+            }
+            Eigen::Index num_rows = inputs.rows();
+            MatrixX_RowMajor<float> signals(num_rows, out_dim);
+
+            if (!binarize_inputs) {
+                signals.noalias() = inputs * sign(latent);
+            }
+            else {
+                std::vector<std::uint64_t> packed_inputs(num_rows * words_per_row);
+                rangeParExec(
+                    num_rows,
+                    [&](int& r) {
+                        pack(inputs.data() + r * inputs.outerStride(), 1, packed_inputs.data() + r * words_per_row);
+                    }
+                );
+
+                // Blocks of `row_block` rows share every load of the packed weights
+                rangeParExec(
+                    (num_rows + row_block - 1) / row_block,
+                    [&](int& block) {
+                        Eigen::Index first = block * row_block, rows = std::min(row_block, num_rows - first);
+                        const std::uint64_t* x[row_block];
+                        for (Eigen::Index r = 0; r < rows; r++) {
+                            x[r] = packed_inputs.data() + (first + r) * words_per_row;
+                        }
+                        std::int64_t counts[row_block];
+                        for (Eigen::Index j = 0; j < out_dim; j++) {
+                            const std::uint64_t* w = packed_weights.data() + j * words_per_row;
+                            if (rows == row_block) {
+                                Detail::xorPopcount<row_block>(x, w, words_per_row, counts);
+                            }
+                            else {
+                                // Last block: one row at a time rather than padding with copies
+                                for (Eigen::Index r = 0; r < rows; r++) {
+                                    Detail::xorPopcount<1>(x + r, w, words_per_row, counts + r);
+                                }
+                            }
+                            for (Eigen::Index r = 0; r < rows; r++) {
+                                signals(first + r, j) = (float)(in_dim - 2 * counts[r]);
+                            }
+                        }
+                    }
+                );
+            }
+            signals.array().rowwise() *= packed_alpha;
+            signals.rowwise() += bias;
+
+            auto signals_eval = MatOrArray<EigenType>::eval(signals);
+            return std::make_pair(signals_eval, signals_eval);
+        }
+
+        // To be used if instance is a hidden layer. Returns @tgradient and the gradient wrt the
+        // inputs, passed through the straight-through estimator of the input signs
+        auto backPropagate(const ArrayX_RowMajor_Ref<float>& signals,
+                           const ArrayX_RowMajor_Ref<float>& tgradient) {
+            return seedBackProp(signals, tgradient);
+        }
+
+        // To be used if instance is output layer (identity activation, @gradient is unchanged)
+        auto seedBackProp(const ArrayX_RowMajor_Ref<float>& signals,
+                          const ArrayX_RowMajor_Ref<float>& gradient) {
+            if (gradient.rows() != binary_inputs.rows() || gradient.cols() != out_dim) {
+                throw std::invalid_argument("shape of @gradient does not match last forward pass");
+            }
+            scaled_gradient = (gradient.rowwise() * alpha).matrix();
+            MatrixX_RowMajor<float> new_tgradient = scaled_gradient * binary_weights.transpose();
+            if (binarize_inputs) {
+                new_tgradient.array() *= ste_mask;
+            }
+
+            return std::make_pair(MatOrArray<EigenType>::eval(gradient.matrix()),
+                                  MatOrArray<EigenType>::eval(new_tgradient));
+        }
+
+        // Updates latent weights (straight-through the weight signs, then clipped) and the bias using
+        // gradient descent. Binarized inputs of the last forward pass are reused
+        void updateWeights(const MatrixX_RowMajor_Ref<float>& inputs, const MatrixX_RowMajor_Ref<float>& gradient, float lr) {
+            if (inputs.rows() != binary_inputs.rows() || gradient.rows() != scaled_gradient.rows()) {
+                throw std::invalid_argument("shapes of @inputs or @gradient do not match last passes");
+            }
+            MatrixX_RowMajor<float> weight_gradient = binary_inputs.transpose() * scaled_gradient;
+            latent = (latent - lr * weight_gradient).cwiseMax(-1.0f).cwiseMin(1.0f);
+            bias -= lr * gradient.colwise().sum();
+            packed_stale = true;
+
+            return;
+        }
+
+        // Restricts the last forward pass to @rows (see `FeedFwdNN::trainSelective`)
+        void selectRows(const MatColX<int>& rows) {
+            binary_inputs = binary_inputs(rows, Eigen::all).eval();
+            if (binarize_inputs) {
+                ste_mask = ste_mask(rows, Eigen::all).eval();
+            }
+        }
+
+        Eigen::Index inputDim() const {
+            return in_dim;
+        }
+
+        Eigen::Index outputDim() const {
+            return out_dim;
+        }
+
+    private:
+        // Rows per block of the packed inference kernel
+        constexpr static Eigen::Index row_block = 4;
+
+        void checkInputs(const MatrixX_RowMajor_Ref<float>& inputs) const {
+            if (inputs.cols() != in_dim) {
+                throw std::invalid_argument("number of columns of @inputs does not match layer");
+            }
+        }
+
+        // `+1` for non-negative entries, `-1` otherwise
+        static MatrixX_RowMajor<float> sign(const MatrixX_RowMajor_Ref<float>& mat) {
+            return mat.unaryExpr([](float f) { return f >= 0.0f ? 1.0f : -1.0f; });
+        }
+
+        // Sets bit `j % 64` of word `j / 64` for non-negative `values[j * stride]`; padding bits stay
+        // zero in inputs and weights alike, so they never count as differing
+        void pack(const float* values, Eigen::Index stride, std::uint64_t* words) const {
+            for (Eigen::Index w = 0; w < words_per_row; w++) {
+                std::uint64_t word = 0;
+                Eigen::Index last = std::min<Eigen::Index>(64, in_dim - w * 64);
+                for (Eigen::Index b = 0; b < last; b++) {
+                    word |= (std::uint64_t)(values[(w * 64 + b) * stride] >= 0.0f) << b;
+                }
+                words[w] = word;
+            }
+        }
+
+        // Packs the signs of each output's latent weights (a column of `latent`) contiguously
+        void packWeights() {
+            packed_weights.resize(out_dim * words_per_row);
+            rangeParExec(
+                out_dim,
+                [&](int& j) {
+                    pack(latent.data() + j, out_dim, packed_weights.data() + j * words_per_row);
+                }
+            );
+            packed_alpha = latent.array().abs().colwise().mean() / std::sqrt((float)in_dim);
+            packed_stale = false;
+        }
+
+        Eigen::Index in_dim;
+        Eigen::Index out_dim;
+        bool binarize_inputs;
+        Eigen::Index words_per_row;
+
+        MatrixX_RowMajor<float> latent;
+        MatRowX<float> bias;
+
+        // Cached by last forward and backward passes for backward pass and update
+        MatrixX_RowMajor<float> binary_inputs;
+        MatrixX_RowMajor<float> binary_weights;
+        ArrayX_RowMajor<float> ste_mask;
+        ArrRowX<float> alpha;
+        MatrixX_RowMajor<float> scaled_gradient;
+
+        // Inference
+        std::vector<std::uint64_t> packed_weights;
+        ArrRowX<float> packed_alpha;
+        bool packed_stale = true;
+    };
+}
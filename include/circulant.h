@@ -0,0 +1,256 @@
+// circulant.h: Contains facilities for constructing circulant (structured-matrix) layers
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/traits_concepts.h"
+#include "../utilities/paral.h"
+#include "../utilities/random.h"
+#include "../utilities/fft.h"
+#include "layers.h"
+
+namespace Neural {
+    /*
+    * @brief: Encapsulates a linear layer (no activation) whose weight matrix is circulant
+    *
+    * The `n x n` weight matrix is defined by its first column `c`: `W_ij = c_((i - j) mod n)`,
+    * with `n` the smallest power of two fitting both dimensions (inputs are zero-padded, outputs
+    * truncated). Products with `W` and `W^T` are circular convolution and correlation, computed
+    * with `FFTPlan` in `O(n log n)` per row instead of `O(n^2)`; the layer stores `n` weights
+    * (plus bias) instead of `n^2`. Two real rows are packed into each complex transform.
+    *
+    * Drop-in replacement for `PlainLinearLayer` as hidden or output layer of `FeedFwdNN`.
+    *
+    * @tparam EigenType: Must be `Eigen::T<float, Eigen::Dynamic, Eigen::Dynamic>`
+    * where `T` is `Array` or `Matrix`
+    */
+    template <typename EigenType>
+    class CirculantLayer {
+    public:
+        // Draws `c` with scheme @init, taking `n` as fan-in and fan-out; the bias is zeroed
+        CirculantLayer(Eigen::Index in_dim, Eigen::Index out_dim, std::uint64_t stream,
+                       Init init = Init::XavierUniform, int seed = 42) :
+            in_dim(in_dim), out_dim(out_dim), plan(paddedSize(in_dim, out_dim))
+        {
+            Eigen::Index n = plan.length();
+            float variance = (init == Init::XavierUniform || init == Init::XavierNormal) ? 1.0f / (float)n
+                                                                                       : 2.0f / (float)n;
+            column.resize(n);
+            Philox rng(seed, stream);
+            if (init == Init::XavierUniform || init == Init::HeUniform) {
+                rng.fillUniform(column, -std::sqrt(3.0f * variance), std::sqrt(3.0f * variance));
+            }
+            else {
+                rng.fillNormal(column, 0.0, std::sqrt(variance));
+            }
+            bias = MatRowX<float>::Zero(out_dim);
+            updateSpectrum();
+        }
+
+        auto feedForward(const MatrixX_RowMajor_Ref<float>& inputs) {
+            if (inputs.cols() != in_dim) {
+                throw std::invalid_argument("number of columns of @inputs does not match layer");
+            }
+            Eigen::Index num_rows = inputs.rows();
+            MatrixX_RowMajor<float> outputs(num_rows, out_dim);
+            input_spectra.resize(num_rows, plan.length());
+
+            forEachPair(num_rows, [&](Eigen::Index a, Eigen::Index b, std::complex<float>* work) {
+                // W x = IFFT(FFT(c) * FFT(x))
+                transformPair(inputs, a, b, work);
+                splitPair(work, input_spectra, a, b);
+                for (Eigen::Index k = 0; k < plan.length(); k++) {
+                    work[k] = FFTPlan::multiply(spectrum(k), input_spectra(a, k));
+                    if (b >= 0) {
+                        work[k] += FFTPlan::multiply(std::complex<float>(0, 1),
+                                                     FFTPlan::multiply(spectrum(k), input_spectra(b, k)));
+                    }
+                }
+                plan.inverse(work);
+                for (Eigen::Index j = 0; j < out_dim; j++) {
+                    outputs(a, j) = work[j].real() + bias(j);
+                    if (b >= 0) {
+                        outputs(b, j) = work[j].imag() + bias(j);
+                    }
+                }
+            });
+
+            auto outputs_eval = MatOrArray<EigenType>::eval(outputs);
+            return std::make_pair(outputs_eval, outputs_eval);
+        }
+
+        // To be used if instance is a hidden layer. Returns @tgradient and the gradient wrt the inputs
+        auto backPropagate(const ArrayX_RowMajor_Ref<float>& signals,
+                           const ArrayX_RowMajor_Ref<float>& tgradient) {
+            return seedBackProp(signals, tgradient);
+        }
+
+        // To be used if instance is output layer (identity activation, @gradient is unchanged)
+        auto seedBackProp(const ArrayX_RowMajor_Ref<float>& signals,
+                          const ArrayX_RowMajor_Ref<float>& gradient) {
+            if (gradient.cols() != out_dim) {
+                throw std::invalid_argument("number of columns of @gradient does not match layer");
+            }
+            Eigen::Index num_rows = gradient.rows();
+            MatrixX_RowMajor<float> new_tgradient(num_rows, in_dim);
+            gradient_spectra.resize(num_rows, plan.length());
+            MatrixX_RowMajor_Ref<float> gradient_matrix = gradient.matrix();
+
+            forEachPair(num_rows, [&](Eigen::Index a, Eigen::Index b, std::complex<float>* work) {
+                // W^T g = IFFT(conj(FFT(c)) * FFT(g))
+                transformPair(gradient_matrix, a, b, work);
+                splitPair(work, gradient_spectra, a, b);
+                for (Eigen::Index k = 0; k < plan.length(); k++) {
+                    std::complex<float> conj_spectrum = std::conj(spectrum(k));
+                    work[k] = FFTPlan::multiply(conj_spectrum, gradient_spectra(a, k));
+                    if (b >= 0) {
+                        work[k] += FFTPlan::multiply(std::complex<float>(0, 1),
+                                                     FFTPlan::multiply(conj_spectrum, gradient_spectra(b, k)));
+                    }
+                }
+                plan.inverse(work);
+                for (Eigen::Index j = 0; j < in_dim; j++) {
+                    new_tgradient(a, j) = work[j].real();
+                    if (b >= 0) {
+                        new_tgradient(b, j) = work[j].imag();
+                    }
+                }
+            });
+
+            return std::make_pair(MatOrArray<EigenType>::eval(gradient.matrix()),
+                                  MatOrArray<EigenType>::eval(new_tgradient));
+        }
+
+        // Updates `c` and the bias using gradient descent. Spectra of @inputs and @gradient cached by
+        // the last passes are reused: the gradient of `c` is `IFFT(sum_rows FFT(g) * conj(FFT(x)))`
+        void updateWeights(const MatrixX_RowMajor_Ref<float>& inputs, const MatrixX_RowMajor_Ref<float>& gradient, float lr) {
+            Eigen::Index num_rows = inputs.rows(), n = plan.length();
+            if (num_rows != input_spectra.rows() || gradient.rows() != gradient_spectra.rows()) {
+                throw std::invalid_argument("shapes of @inputs or @gradient do not match last passes");
+            }
+
+            MatRowX<std::complex<float>> column_gradient(n);
+            rangeParExec(
+                (n + freq_block - 1) / freq_block,
+                [&](int& block) {
+                    Eigen::Index first = block * freq_block, last = std::min(n, first + freq_block);
+                    for (Eigen::Index k = first; k < last; k++) {
+                        column_gradient(k) = 0;
+                    }
+                    for (Eigen::Index r = 0; r < num_rows; r++) {
+                        for (Eigen::Index k = first; k < last; k++) {
+                            column_gradient(k) += FFTPlan::multiply(gradient_spectra(r, k), std::conj(input_spectra(r, k)));
+                        }
+                    }
+                }
+            );
+            plan.inverse(column_gradient.data());
+
+            column -= lr * column_gradient.real();
+            bias -= lr * gradient.colwise().sum();
+            updateSpectrum();
+
+            return;
+        }
+
+        Eigen::Index inputDim() const {
+            return in_dim;
+        }
+
+        Eigen::Index outputDim() const {
+            return out_dim;
+        }
+
+        // Dense equivalent, augmented with the bias row like `LinearLayer` weights (`O(n^2)` memory)
+        MatrixX_RowMajor<float> augmentedWeights() const {
+            Eigen::Index n = plan.length();
+            MatrixX_RowMajor<float> weights(in_dim + 1, out_dim);
+            for (Eigen::Index j = 0; j < in_dim; j++) {
+                for (Eigen::Index i = 0; i < out_dim; i++) {
+                    weights(j, i) = column((i - j + n) % n);
+                }
+            }
+            weights.row(in_dim) = bias;
+            return weights;
+        }
+
+    private:
+        // Frequencies per parallel task of the weight gradient reduction
+        constexpr static Eigen::Index freq_block = 256;
+
+        static Eigen::Index paddedSize(Eigen::Index in_dim, Eigen::Index out_dim) {
+            if (in_dim <= 0 || out_dim <= 0) {
+                throw std::invalid_argument("received non-positive dimensions");
+            }
+            Eigen::Index n = 1;
+            while (n < std::max(in_dim, out_dim)) {
+                n *= 2;
+            }
+            return n;
+        }
+
+        void updateSpectrum() {
+            spectrum = column.template cast<std::complex<float>>();
+            plan.forward(spectrum.data());
+        }
+
+        // Calls @func(a, b, work) for row pairs `(a, b)` in parallel, `b = -1` for an odd last row.
+        // @work points to a row of `workspace` owned by the pair
+        template <typename PairFunction>
+        void forEachPair(Eigen::Index num_rows, const PairFunction& func) {
+            Eigen::Index num_pairs = (num_rows + 1) / 2;
+            workspace.resize(num_pairs, plan.length());
+            rangeParExec(
+                num_pairs,
+                [&](int& pair) {
+                    Eigen::Index a = 2 * pair, b = (2 * pair + 1 < num_rows) ? 2 * pair + 1 : -1;
+                    func(a, b, workspace.row(pair).data());
+                }
+            );
+        }
+
+        // FFT of `rows(a) + i * rows(b)`, zero-padded, into @work
+        void transformPair(const MatrixX_RowMajor_Ref<float>& rows, Eigen::Index a, Eigen::Index b,
+                           std::complex<float>* work) const {
+            Eigen::Index n = plan.length(), cols = rows.cols();
+            for (Eigen::Index j = 0; j < n; j++) {
+                work[j] = std::complex<float>(j < cols ? rows(a, j) : 0.0f,
+                                              (j < cols && b >= 0) ? rows(b, j) : 0.0f);
+            }
+            plan.forward(work);
+        }
+
+        // Recovers the spectra of both real rows from the packed transform @work, using the
+        // Hermitian symmetry of real signals' spectra
+        void splitPair(const std::complex<float>* work, MatrixX_RowMajor<std::complex<float>>& spectra,
+                       Eigen::Index a, Eigen::Index b) const {
+            Eigen::Index n = plan.length();
+            for (Eigen::Index k = 0; k < n; k++) {
+                std::complex<float> z = work[k], z_mirror = std::conj(work[(n - k) % n]);
+                spectra(a, k) = 0.5f * (z + z_mirror);
+                if (b >= 0) {
+                    spectra(b, k) = FFTPlan::multiply(std::complex<float>(0, -0.5f), z - z_mirror);
+                }
+            }
+        }
+
+        Eigen::Index in_dim;
+        Eigen::Index out_dim;
+        FFTPlan plan;
+
+        MatRowX<float> column;
+        MatRowX<float> bias;
+        MatRowX<std::complex<float>> spectrum; // FFT of `column`
+
+        // Cached by last forward and backward passes for update
+        MatrixX_RowMajor<std::complex<float>> input_spectra;
+        MatrixX_RowMajor<std::complex<float>> gradient_spectra;
+        MatrixX_RowMajor<std::complex<float>> workspace;
+    };
+}
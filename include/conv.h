@@ -0,0 +1,598 @@
+// conv.h: Contains facilities for constructing 2D convolution and pooling layers
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/traits_concepts.h"
+#include "../utilities/paral.h"
+#include "../utilities/random.h"
+#include "layers.h"
+
+namespace Neural {
+    // Convolution kernels. `Auto` picks `Direct` when there are enough input channels for the
+    // per-kernel-offset GEMMs to be efficient, `Im2col` otherwise
+    enum class ConvAlgo {Auto, Im2col, Direct};
+
+    /*
+    * @brief: Geometry of a 2D convolution or pooling window over NHWC samples. Every row of a
+    *         layer's inputs holds one sample, flattened as `(h * width + w) * channels + c`
+    */
+    struct ConvShape {
+        Eigen::Index height;
+        Eigen::Index width;
+        Eigen::Index channels;
+        Eigen::Index kernel_h;
+        Eigen::Index kernel_w;
+        Eigen::Index stride = 1;
+        Eigen::Index padding = 0;
+
+        Eigen::Index outHeight() const {
+            return (height + 2 * padding - kernel_h) / stride + 1;
+        }
+
+        Eigen::Index outWidth() const {
+            return (width + 2 * padding - kernel_w) / stride + 1;
+        }
+
+        Eigen::Index inSize() const {
+            return height * width * channels;
+        }
+
+        // Range [first, last] of output columns whose window column offset @kw falls inside the input
+        // (empty if `first > last`). Numerators may be negative, so divisions round toward -infinity
+        std::pair<Eigen::Index, Eigen::Index> validCols(Eigen::Index kw) const {
+            auto floorDiv = [](Eigen::Index num, Eigen::Index den) {
+                return num / den - (num % den != 0 && num < 0);
+            };
+            Eigen::Index first = std::max<Eigen::Index>(0, -floorDiv(kw - padding, stride));
+            Eigen::Index last = std::min<Eigen::Index>(outWidth() - 1, floorDiv(width - 1 + padding - kw, stride));
+            return std::make_pair(first, last);
+        }
+
+        void validate() const {
+            if (height <= 0 || width <= 0 || channels <= 0 || kernel_h <= 0 || kernel_w <= 0 || stride <= 0 || padding < 0) {
+                throw std::invalid_argument("received non-positive dimensions");
+            }
+            if (outHeight() <= 0 || outWidth() <= 0) {
+                throw std::invalid_argument("kernel larger than padded input");
+            }
+        }
+    };
+
+    // Splits `0, ..., num_rows - 1` into at most one contiguous chunk per hardware thread and
+    // runs @func(first, last) on each in parallel. Used for reductions over the batch
+    template<typename ChunkFunction>
+    void chunkParExec(Eigen::Index num_rows, const ChunkFunction& func) {
+        Eigen::Index num_chunks = std::min<Eigen::Index>(num_rows, std::max(1u, std::thread::hardware_concurrency()));
+        rangeParExec(
+            num_chunks,
+            [&](int& chunk) {
+                func(chunk, num_rows * chunk / num_chunks, num_rows * (chunk + 1) / num_chunks);
+            }
+        );
+    }
+
+    /*
+    * @brief: Encapsulates neural net 2D convolution layer (NHWC, stride, zero padding)
+    *
+    * Weights are stored as a `(kernel_h * kernel_w * channels + 1) x out_channels` matrix whose
+    * row `(kh * kernel_w + kw) * channels + c` multiplies input channel `c` at window offset
+    * `(kh, kw)`, the last row being the bias. Two cache-friendly kernels are provided:
+    * - im2col + GEMM, on tiles of output pixels so the patch buffer stays in cache, and
+    * - direct, doing one small GEMM per (output row, kernel offset) over strided views of
+    *   the input, without any patch buffer.
+    * Forward and backward passes run in parallel across the batch.
+    *
+    * Uses CRTP pattern like `LinearLayer`: derived class must implement `float activate(float)`
+    * and `float differentiate(float)`
+    *
+    * @tparam EigenType: Must be `Eigen::T<float, Eigen::Dynamic, Eigen::Dynamic>`
+    * where `T` is `Array` or `Matrix`
+    * @tparam Impl: Derived class implementation (for CRTP)
+    */
+    template <typename EigenType, template <typename> class Impl>
+    class ConvLayer {
+    public:
+        auto feedForward(const MatrixX_RowMajor_Ref<float>& inputs) {
+            checkInputs(inputs);
+            Eigen::Index num_rows = inputs.rows();
+            MatrixX_RowMajor<float> signals(num_rows, outSize());
+
+            rangeParExec(
+                num_rows,
+                [&](int& row_number) {
+                    const float* x = inputs.row(row_number).data();
+                    MapMat y(signals.row(row_number).data(), num_pixels, out_channels);
+                    if (useDirect()) {
+                        forwardDirect(x, y);
+                    }
+                    else {
+                        forwardIm2col(x, y);
+                    }
+                }
+            );
+
+            auto outputs = signals.unaryExpr([this](float f)
+                                             { return this->crtp_handle->activate(f); });
+
+            return std::make_pair(MatOrArray<EigenType>::eval(signals),
+                                  MatOrArray<EigenType>::eval(outputs));
+        }
+
+        // To be used if instance is a hidden layer
+        auto backPropagate(const ArrayX_RowMajor_Ref<float>& signals,
+                           const ArrayX_RowMajor_Ref<float>& tgradient) {
+            auto diff_signals = signals.unaryExpr([this](float f)
+                                                  { return this->crtp_handle->differentiate(f); });
+            MatrixX_RowMajor<float> gradient = (diff_signals * tgradient).matrix();
+
+            return std::make_pair(MatOrArray<EigenType>::eval(gradient), transformGradient(gradient));
+        }
+
+        // To be used if instance is output layer
+        auto seedBackProp(const ArrayX_RowMajor_Ref<float>& signals,
+                          const ArrayX_RowMajor_Ref<float>& gradient) {
+            return backPropagate(signals, gradient);
+        }
+
+        // Updates member `weights` using gradient descent; @gradient is wrt the layer's signals
+        void updateWeights(const MatrixX_RowMajor_Ref<float>& inputs, const MatrixX_RowMajor_Ref<float>& gradient, float lr) {
+            weights -= lr * weightGradient(inputs, gradient);
+
+            return;
+        }
+
+        // Gradients wrt `parameters()`, laid out alike; @inputs and @gradient as in `updateWeights`
+        std::vector<MatColX<float>> parameterGradients(const MatrixX_RowMajor_Ref<float>& inputs,
+                                                       const MatrixX_RowMajor_Ref<float>& gradient) {
+            MatrixX_RowMajor<float> weight_gradient = weightGradient(inputs, gradient);
+            return { Eigen::Map<MatColX<float>>(weight_gradient.data(), weight_gradient.size()) };
+        }
+
+        std::vector<ParamView> parameters() {
+            return { ParamView(weights.data(), weights.size()) };
+        }
+
+        const ConvShape& shape() const {
+            return conv_shape;
+        }
+
+        Eigen::Index outSize() const {
+            return num_pixels * out_channels;
+        }
+
+    protected:
+        /*
+        * @param shape: Input geometry and kernel size, stride and padding
+        * @param out_channels: Number of output channels (filters)
+        * @param stream: Philox stream of the weights, distinguishing layers sharing @seed
+        * @param init: Weight initialization scheme (fan-in is the kernel volume)
+        * @param algo: Kernel selection
+        */
+        ConvLayer(const ConvShape& shape, Eigen::Index out_channels, std::uint64_t stream,
+                  Init init = Init::HeNormal, int seed = 42, ConvAlgo algo = ConvAlgo::Auto) :
+            conv_shape(shape), out_channels(out_channels), algo(algo),
+            crtp_handle(static_cast<Impl<EigenType>*>(this))
+        {
+            conv_shape.validate();
+            num_pixels = conv_shape.outHeight() * conv_shape.outWidth();
+            patch_size = conv_shape.kernel_h * conv_shape.kernel_w * conv_shape.channels;
+
+            float fan_in = (float)patch_size;
+            float fan_out = (float)(conv_shape.kernel_h * conv_shape.kernel_w * out_channels);
+            float variance = (init == Init::XavierUniform || init == Init::XavierNormal) ? 2.0f / (fan_in + fan_out)
+                                                                                       : 2.0f / fan_in;
+            Philox rng(seed, stream);
+            weights.resize(patch_size + 1, out_channels);
+            if (init == Init::XavierUniform || init == Init::HeUniform) {
+                float bound = std::sqrt(3.0f * variance);
+                rng.fillUniform(weights, -bound, bound);
+            }
+            else {
+                rng.fillNormal(weights, 0.0, std::sqrt(variance));
+            }
+            weights.row(patch_size).setZero();
+        }
+
+        using MapMat = Eigen::Map<MatrixX_RowMajor<float>>;
+        using ConstMapMat = Eigen::Map<const MatrixX_RowMajor<float>>;
+        using StridedMap = Eigen::Map<MatrixX_RowMajor<float>, 0, Eigen::OuterStride<>>;
+        using ConstStridedMap = Eigen::Map<const MatrixX_RowMajor<float>, 0, Eigen::OuterStride<>>;
+
+        // Minimum number of input channels for `ConvAlgo::Auto` to pick the direct kernel
+        constexpr static Eigen::Index direct_min_channels = 16;
+        // Patch buffer size targeted by im2col tiles (fits comfortably in L2)
+        constexpr static Eigen::Index im2col_tile_floats = 1 << 15;
+
+        // Gradient wrt member `weights`, summed over the batch; @gradient is wrt the layer's signals
+        MatrixX_RowMajor<float> weightGradient(const MatrixX_RowMajor_Ref<float>& inputs, const MatrixX_RowMajor_Ref<float>& gradient) {
+            checkInputs(inputs);
+
+            // One partial weight gradient per chunk of the batch, summed afterwards
+            std::vector<MatrixX_RowMajor<float>> partials(std::max(1u, std::thread::hardware_concurrency()));
+            chunkParExec(
+                inputs.rows(),
+                [&](int chunk, Eigen::Index first, Eigen::Index last) {
+                    MatrixX_RowMajor<float>& partial = partials[chunk];
+                    partial = MatrixX_RowMajor<float>::Zero(weights.rows(), weights.cols());
+                    for (Eigen::Index r = first; r < last; r++) {
+                        ConstMapMat g(gradient.row(r).data(), num_pixels, out_channels);
+                        if (useDirect()) {
+                            weightGradientDirect(inputs.row(r).data(), g, partial);
+                        }
+                        else {
+                            weightGradientIm2col(inputs.row(r).data(), g, partial);
+                        }
+                    }
+                }
+            );
+
+            MatrixX_RowMajor<float> weight_gradient = MatrixX_RowMajor<float>::Zero(weights.rows(), weights.cols());
+            for (auto& partial : partials) {
+                if (partial.size() != 0) {
+                    weight_gradient += partial;
+                }
+            }
+
+            return weight_gradient;
+        }
+
+        bool useDirect() const {
+            return algo == ConvAlgo::Direct || (algo == ConvAlgo::Auto && conv_shape.channels >= direct_min_channels);
+        }
+
+        Eigen::Index tilePixels() const {
+            return std::clamp<Eigen::Index>(im2col_tile_floats / (patch_size + 1), 1, num_pixels);
+        }
+
+        // Strided view of the input pixels under output columns [first, last] of output row
+        // @oh, at window offset (@kh, @kw). Returns empty range if the window row is padding
+        template<typename Visitor>
+        void forEachWindow(const Visitor& visit) const {
+            const ConvShape& s = conv_shape;
+            for (Eigen::Index oh = 0; oh < s.outHeight(); oh++) {
+                for (Eigen::Index kh = 0; kh < s.kernel_h; kh++) {
+                    Eigen::Index ih = oh * s.stride - s.padding + kh;
+                    if (ih < 0 || ih >= s.height) {
+                        continue;
+                    }
+                    for (Eigen::Index kw = 0; kw < s.kernel_w; kw++) {
+                        auto [first, last] = s.validCols(kw);
+                        if (first > last) {
+                            continue;
+                        }
+                        Eigen::Index iw = first * s.stride - s.padding + kw;
+                        visit(oh * s.outWidth() + first, last - first + 1,
+                              (ih * s.width + iw) * s.channels, (kh * s.kernel_w + kw) * s.channels);
+                    }
+                }
+            }
+        }
+
+        void forwardDirect(const float* x, MapMat& y) const {
+            const Eigen::Index c_in = conv_shape.channels;
+            y.rowwise() = weights.row(patch_size);
+            forEachWindow([&](Eigen::Index out_pixel, Eigen::Index n, Eigen::Index in_offset, Eigen::Index w_row) {
+                ConstStridedMap x_view(x + in_offset, n, c_in, Eigen::OuterStride<>(conv_shape.stride * c_in));
+                y.middleRows(out_pixel, n).noalias() += x_view * weights.middleRows(w_row, c_in);
+            });
+        }
+
+        // Writes rows [@first, @first + @n) of the patch matrix of sample @x to @patches
+        void im2col(const float* x, Eigen::Index first, Eigen::Index n, MatrixX_RowMajor<float>& patches) const {
+            const ConvShape& s = conv_shape;
+            const Eigen::Index c_in = s.channels;
+            patches.resize(n, patch_size + 1);
+            for (Eigen::Index p = 0; p < n; p++) {
+                Eigen::Index oh = (first + p) / s.outWidth(), ow = (first + p) % s.outWidth();
+                float* row = patches.row(p).data();
+                for (Eigen::Index kh = 0; kh < s.kernel_h; kh++) {
+                    Eigen::Index ih = oh * s.stride - s.padding + kh;
+                    for (Eigen::Index kw = 0; kw < s.kernel_w; kw++) {
+                        Eigen::Index iw = ow * s.stride - s.padding + kw;
+                        float* dst = row + (kh * s.kernel_w + kw) * c_in;
+                        if (ih < 0 || ih >= s.height || iw < 0 || iw >= s.width) {
+                            std::fill(dst, dst + c_in, 0.0f);
+                        }
+                        else {
+                            const float* src = x + (ih * s.width + iw) * c_in;
+                            std::copy(src, src + c_in, dst);
+                        }
+                    }
+                }
+                row[patch_size] = 1.0f;
+            }
+        }
+
+        // Adds rows of @patch_grads (gradient wrt a tile of patches, bias column excluded) back
+        // onto the input pixels they were gathered from
+        void col2im(const MatrixX_RowMajor<float>& patch_grads, Eigen::Index first, float* dx) const {
+            const ConvShape& s = conv_shape;
+            const Eigen::Index c_in = s.channels;
+            for (Eigen::Index p = 0; p < patch_grads.rows(); p++) {
+                Eigen::Index oh = (first + p) / s.outWidth(), ow = (first + p) % s.outWidth();
+                const float* row = patch_grads.row(p).data();
+                for (Eigen::Index kh = 0; kh < s.kernel_h; kh++) {
+                    Eigen::Index ih = oh * s.stride - s.padding + kh;
+                    for (Eigen::Index kw = 0; kw < s.kernel_w; kw++) {
+                        Eigen::Index iw = ow * s.stride - s.padding + kw;
+                        if (ih < 0 || ih >= s.height || iw < 0 || iw >= s.width) {
+                            continue;
+                        }
+                        const float* src = row + (kh * s.kernel_w + kw) * c_in;
+                        float* dst = dx + (ih * s.width + iw) * c_in;
+                        for (Eigen::Index c = 0; c < c_in; c++) {
+                            dst[c] += src[c];
+                        }
+                    }
+                }
+            }
+        }
+
+        void forwardIm2col(const float* x, MapMat& y) const {
+            MatrixX_RowMajor<float> patches;
+            Eigen::Index tile = tilePixels();
+            for (Eigen::Index first = 0; first < num_pixels; first += tile) {
+                Eigen::Index n = std::min(tile, num_pixels - first);
+                im2col(x, first, n, patches);
+                y.middleRows(first, n).noalias() = patches * weights;
+            }
+        }
+
+        // Gradient wrt the layer's inputs
+        auto transformGradient(const MatrixX_RowMajor<float>& gradient) {
+            Eigen::Index num_rows = gradient.rows();
+            MatrixX_RowMajor<float> new_tgradient = MatrixX_RowMajor<float>::Zero(num_rows, conv_shape.inSize());
+            auto kernel = weights.topRows(patch_size);
+            const Eigen::Index c_in = conv_shape.channels;
+
+            rangeParExec(
+                num_rows,
+                [&](int& row_number) {
+                    ConstMapMat g(gradient.row(row_number).data(), num_pixels, out_channels);
+                    float* dx = new_tgradient.row(row_number).data();
+                    if (useDirect()) {
+                        forEachWindow([&](Eigen::Index out_pixel, Eigen::Index n, Eigen::Index in_offset, Eigen::Index w_row) {
+                            StridedMap dx_view(dx + in_offset, n, c_in, Eigen::OuterStride<>(conv_shape.stride * c_in));
+                            dx_view.noalias() += g.middleRows(out_pixel, n) * weights.middleRows(w_row, c_in).transpose();
+                        });
+                    }
+                    else {
+                        MatrixX_RowMajor<float> patch_grads;
+                        Eigen::Index tile = tilePixels();
+                        for (Eigen::Index first = 0; first < num_pixels; first += tile) {
+                            Eigen::Index n = std::min(tile, num_pixels - first);
+                            patch_grads.noalias() = g.middleRows(first, n) * kernel.transpose();
+                            col2im(patch_grads, first, dx);
+                        }
+                    }
+                }
+            );
+
+            return MatOrArray<EigenType>::eval(new_tgradient);
+        }
+
+        void weightGradientDirect(const float* x, const ConstMapMat& g, MatrixX_RowMajor<float>& dw) const {
+            const Eigen::Index c_in = conv_shape.channels;
+            dw.row(patch_size) += g.colwise().sum();
+            forEachWindow([&](Eigen::Index out_pixel, Eigen::Index n, Eigen::Index in_offset, Eigen::Index w_row) {
+                ConstStridedMap x_view(x + in_offset, n, c_in, Eigen::OuterStride<>(conv_shape.stride * c_in));
+                dw.middleRows(w_row, c_in).noalias() += x_view.transpose() * g.middleRows(out_pixel, n);
+            });
+        }
+
+        void weightGradientIm2col(const float* x, const ConstMapMat& g, MatrixX_RowMajor<float>& dw) const {
+            MatrixX_RowMajor<float> patches;
+            Eigen::Index tile = tilePixels();
+            for (Eigen::Index first = 0; first < num_pixels; first += tile) {
+                Eigen::Index n = std::min(tile, num_pixels - first);
+                im2col(x, first, n, patches);
+                dw.noalias() += patches.transpose() * g.middleRows(first, n);
+            }
+        }
+
+        void checkInputs(const MatrixX_RowMajor_Ref<float>& inputs) const {
+            if (inputs.cols() != conv_shape.inSize()) {
+                throw std::invalid_argument("number of columns of @inputs does not match `height * width * channels`");
+            }
+        }
+
+        MatrixX_RowMajor<float> weights;
+
+        ConvShape conv_shape;
+        Eigen::Index out_channels;
+        Eigen::Index num_pixels;
+        Eigen::Index patch_size;
+        ConvAlgo algo;
+
+    private:
+        Impl<EigenType>* crtp_handle;
+    };
+
+    // Forward decl.
+    template <typename EigenType>
+    class PlainConvLayer;
+
+    template <typename EigenType>
+    using PlainConvLayerImpl = PlainConvLayer<EigenType>;
+
+    /*
+    * @brief Implements convolution layer without activation. Inherits from class `ConvLayer`,
+    * using CRTP pattern
+    */
+    template <typename EigenType>
+    class PlainConvLayer : public ConvLayer<EigenType, PlainConvLayerImpl> {
+    public:
+        PlainConvLayer(const ConvShape& shape, Eigen::Index out_channels, std::uint64_t stream,
+                       Init init = Init::HeNormal, int seed = 42, ConvAlgo algo = ConvAlgo::Auto) :
+            ConvLayer<EigenType, PlainConvLayerImpl>(shape, out_channels, stream, init, seed, algo) {}
+
+        float activate(float f) {
+            return f;
+        }
+
+        float differentiate(float) {
+            return 1.0;
+        }
+    };
+
+    enum class Pool {Max, Avg};
+
+    /*
+    * @brief: Encapsulates max or average pooling over NHWC samples (no padding) as a hidden layer
+    *
+    * Max pooling records the input position of every maximum during the forward pass and
+    * routes gradients back to it. Runs in parallel across the batch
+    *
+    * @tparam EigenType: Must be `Eigen::T<float, Eigen::Dynamic, Eigen::Dynamic>`
+    * where `T` is `Array` or `Matrix`
+    */
+    template <typename EigenType>
+    class PoolLayer {
+    public:
+        // `padding` of @shape must be zero
+        PoolLayer(const ConvShape& shape, Pool mode = Pool::Max) : pool_shape(shape), mode(mode) {
+            pool_shape.validate();
+            if (pool_shape.padding != 0) {
+                throw std::invalid_argument("pooling does not support padding");
+            }
+        }
+
+        constexpr static bool has_weights = false;
+
+        auto feedForward(const MatrixX_RowMajor_Ref<float>& inputs) {
+            const ConvShape& s = pool_shape;
+            if (inputs.cols() != s.inSize()) {
+                throw std::invalid_argument("number of columns of @inputs does not match `height * width * channels`");
+            }
+            Eigen::Index num_rows = inputs.rows();
+            MatrixX_RowMajor<float> outputs(num_rows, outSize());
+            if (mode == Pool::Max) {
+                argmax.resize(num_rows, outSize());
+            }
+
+            const float inv_window = 1.0f / (float)(s.kernel_h * s.kernel_w);
+            rangeParExec(
+                num_rows,
+                [&](int& row_number) {
+                    const float* x = inputs.row(row_number).data();
+                    float* y = outputs.row(row_number).data();
+                    int* arg = mode == Pool::Max ? argmax.row(row_number).data() : nullptr;
+
+                    for (Eigen::Index oh = 0; oh < s.outHeight(); oh++) {
+                        for (Eigen::Index ow = 0; ow < s.outWidth(); ow++) {
+                            float* y_pixel = y + (oh * s.outWidth() + ow) * s.channels;
+                            int* arg_pixel = arg ? arg + (oh * s.outWidth() + ow) * s.channels : nullptr;
+                            Eigen::Index first = (oh * s.stride * s.width + ow * s.stride) * s.channels;
+                            if (mode == Pool::Max) {
+                                // Seeded with the first element of the window, so every output has an
+                                // argmax even if the window holds only NaN or -inf
+                                for (Eigen::Index c = 0; c < s.channels; c++) {
+                                    y_pixel[c] = x[first + c];
+                                    arg_pixel[c] = (int)(first + c);
+                                }
+                            }
+                            else {
+                                std::fill(y_pixel, y_pixel + s.channels, 0.0f);
+                            }
+
+                            // Channels innermost: contiguous and vectorizable
+                            for (Eigen::Index kh = 0; kh < s.kernel_h; kh++) {
+                                for (Eigen::Index kw = 0; kw < s.kernel_w; kw++) {
+                                    Eigen::Index offset = ((oh * s.stride + kh) * s.width + ow * s.stride + kw) * s.channels;
+                                    if (mode == Pool::Avg) {
+                                        for (Eigen::Index c = 0; c < s.channels; c++) {
+                                            y_pixel[c] += x[offset + c];
+                                        }
+                                        continue;
+                                    }
+                                    // Branchless selects, so the loop vectorizes. A NaN wins over any
+                                    // number and is then kept, so it propagates to the output
+                                    for (Eigen::Index c = 0; c < s.channels; c++) {
+                                        bool greater = !(x[offset + c] <= y_pixel[c]) && y_pixel[c] == y_pixel[c];
+                                        y_pixel[c] = greater ? x[offset + c] : y_pixel[c];
+                                        arg_pixel[c] = greater ? (int)(offset + c) : arg_pixel[c];
+                                    }
+                                }
+                            }
+                            if (mode == Pool::Avg) {
+                                for (Eigen::Index c = 0; c < s.channels; c++) {
+                                    y_pixel[c] *= inv_window;
+                                }
+                            }
+                        }
+                    }
+                }
+            );
+
+            auto outputs_eval = MatOrArray<EigenType>::eval(outputs);
+            return std::make_pair(outputs_eval, outputs_eval);
+        }
+
+        // Gradient wrt the layer's inputs serves as both returned values (the layer has no weights)
+        auto backPropagate(const ArrayX_RowMajor_Ref<float>&,
+                           const ArrayX_RowMajor_Ref<float>& tgradient) {
+            const ConvShape& s = pool_shape;
+            Eigen::Index num_rows = tgradient.rows();
+            MatrixX_RowMajor<float> new_tgradient = MatrixX_RowMajor<float>::Zero(num_rows, s.inSize());
+
+            const float inv_window = 1.0f / (float)(s.kernel_h * s.kernel_w);
+            rangeParExec(
+                num_rows,
+                [&](int& row_number) {
+                    const float* g = tgradient.row(row_number).data();
+                    float* dx = new_tgradient.row(row_number).data();
+
+                    if (mode == Pool::Max) {
+                        const int* arg = argmax.row(row_number).data();
+                        for (Eigen::Index i = 0; i < outSize(); i++) {
+                            dx[arg[i]] += g[i];
+                        }
+                        return;
+                    }
+                    for (Eigen::Index oh = 0; oh < s.outHeight(); oh++) {
+                        for (Eigen::Index ow = 0; ow < s.outWidth(); ow++) {
+                            const float* g_pixel = g + (oh * s.outWidth() + ow) * s.channels;
+                            for (Eigen::Index kh = 0; kh < s.kernel_h; kh++) {
+                                for (Eigen::Index kw = 0; kw < s.kernel_w; kw++) {
+                                    Eigen::Index offset = ((oh * s.stride + kh) * s.width + ow * s.stride + kw) * s.channels;
+                                    for (Eigen::Index c = 0; c < s.channels; c++) {
+                                        dx[offset + c] += inv_window * g_pixel[c];
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            );
+
+            auto new_tgradient_eval = MatOrArray<EigenType>::eval(new_tgradient);
+            return std::make_pair(new_tgradient_eval, new_tgradient_eval);
+        }
+
+        void updateWeights(const MatrixX_RowMajor_Ref<float>&, const MatrixX_RowMajor_Ref<float>&, float) {
+            return;
+        }
+
+        const ConvShape& shape() const {
+            return pool_shape;
+        }
+
+        Eigen::Index outSize() const {
+            return pool_shape.outHeight() * pool_shape.outWidth() * pool_shape.channels;
+        }
+
+    private:
+        ConvShape pool_shape;
+        Pool mode;
+
+        // Input position of every maximum of the last forward pass (max pooling only)
+        MatrixX_RowMajor<int> argmax;
+    };
+}
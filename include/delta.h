@@ -0,0 +1,544 @@
+// delta.h: Contains facilities for synchronizing replicas of a network through weight deltas
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/paral.h"
+#include "layers.h"
+#include "snapshot.h"
+
+namespace Neural {
+    /*
+    * @brief: Settings of `DeltaEncoder`
+    *
+    * `threshold`: entries whose pending change is at most this in absolute value are left out of
+    *              a delta; the change is not lost, it carries over until it exceeds the threshold
+    * `bits`: width of the quantized values, 8 or 16
+    */
+    struct DeltaOptions {
+        float threshold = 1e-4f;
+        int bits = 8;
+    };
+
+    /*
+    * @brief: Changes of the parameters of a network (see `FeedFwdNN::layerParameters`) bringing a
+    *         replica from version `baseVersion()` to `version()`, tensor by tensor: the indices of
+    *         changed entries and their quantized changes (one scale per tensor). A full delta
+    *         holds the values themselves and applies to any version. Records the number of layers
+    *         of the network and whether it folds its inference weights (see
+    *         `FeedFwdNN::foldsInference`), which replicas must match
+    *
+    * Serialized as: magic `NNWD`, format, bits, full flag, folded flag, base version (u64), version
+    * (u64), number of layers (u32), number of tensors (u32), then per tensor: layer (u32), tensor (u32), size (u64), number
+    * of entries (u64), dense flag (u8), scale (f32), gaps between indices as LEB128 varints unless
+    * dense, and the values as signed integers of `bits` bits (floats if 32). Little-endian hosts only
+    */
+    class WeightDelta {
+    public:
+        struct Tensor {
+            std::uint32_t layer = 0;
+            std::uint32_t tensor = 0;           // Index within the layer's `parameters()`
+            std::uint64_t size = 0;             // Number of entries of the tensor
+            std::vector<std::uint32_t> indices; // Increasing; empty if every entry is listed
+            float scale = 1.0f;                 // Quantization step, unused if `bits == 32`
+            std::vector<float> values;          // Dequantized, i.e. `scale * step` computed in float
+        };
+
+        WeightDelta(std::uint64_t base_version, std::uint64_t version, std::uint32_t num_layers, int bits, bool full,
+                    bool folded = false) :
+            base_version(base_version), target_version(version), num_layers(num_layers), value_bits(bits),
+            full_values(full), folded_weights(folded)
+        {
+            if (bits != 8 && bits != 16 && bits != 32) {
+                throw std::invalid_argument("received @bits other than 8, 16 or 32");
+            }
+        }
+
+        std::uint64_t baseVersion() const {
+            return base_version;
+        }
+
+        std::uint64_t version() const {
+            return target_version;
+        }
+
+        // Number of layers of the network, as listed by `FeedFwdNN::layerParameters`
+        std::uint32_t numLayers() const {
+            return num_layers;
+        }
+
+        int bits() const {
+            return value_bits;
+        }
+
+        // Whether values replace the weights instead of being added to them
+        bool full() const {
+            return full_values;
+        }
+
+        // Whether the network folds its inference weights, which then differ from the weights of the delta
+        bool folded() const {
+            return folded_weights;
+        }
+
+        const std::vector<Tensor>& tensors() const {
+            return delta_tensors;
+        }
+
+        void addTensor(Tensor tensor) {
+            delta_tensors.push_back(std::move(tensor));
+        }
+
+        std::uint64_t numEntries() const {
+            std::uint64_t count = 0;
+            for (const auto& tensor : delta_tensors) {
+                count += tensor.values.size();
+            }
+            return count;
+        }
+
+        std::vector<std::uint8_t> serialize() const {
+            // Upper bound: varints take at most 5 bytes
+            std::size_t capacity = 32;
+            for (const auto& tensor : delta_tensors) {
+                capacity += 29 + 5 * tensor.indices.size() + tensor.values.size() * (value_bits / 8);
+            }
+            std::vector<std::uint8_t> bytes;
+            bytes.reserve(capacity);
+            for (std::uint8_t byte : { (std::uint8_t)'N', (std::uint8_t)'N', (std::uint8_t)'W', (std::uint8_t)'D', format,
+                                       (std::uint8_t)value_bits, (std::uint8_t)full_values, (std::uint8_t)folded_weights }) {
+                bytes.push_back(byte);
+            }
+            put(bytes, base_version);
+            put(bytes, target_version);
+            put(bytes, num_layers);
+            put(bytes, (std::uint32_t)delta_tensors.size());
+            for (const auto& tensor : delta_tensors) {
+                put(bytes, tensor.layer);
+                put(bytes, tensor.tensor);
+                put(bytes, tensor.size);
+                put(bytes, (std::uint64_t)tensor.values.size());
+                put(bytes, (std::uint8_t)tensor.indices.empty());
+                put(bytes, tensor.scale);
+
+                std::uint32_t previous = 0;
+                for (std::uint32_t index : tensor.indices) {
+                    for (std::uint32_t gap = index - previous; ; gap >>= 7) {
+                        bytes.push_back((std::uint8_t)((gap & 0x7f) | (gap >= 0x80 ? 0x80 : 0)));
+                        if (gap < 0x80) {
+                            break;
+                        }
+                    }
+                    previous = index;
+                }
+                for (float value : tensor.values) {
+                    if (value_bits == 32) {
+                        put(bytes, value);
+                    }
+                    else if (value_bits == 16) {
+                        put(bytes, (std::int16_t)std::lround(value / tensor.scale));
+                    }
+                    else {
+                        put(bytes, (std::int8_t)std::lround(value / tensor.scale));
+                    }
+                }
+            }
+            return bytes;
+        }
+
+        // Inverse of `serialize`. Throws on truncated or malformed input
+        static WeightDelta deserialize(const std::uint8_t* data, std::size_t size) {
+            std::size_t pos = 0;
+            auto take = [&]<typename T>(T value) {
+                if (size - pos < sizeof(T)) {
+                    throw std::invalid_argument("received truncated weight delta");
+                }
+                std::memcpy(&value, data + pos, sizeof(T));
+                pos += sizeof(T);
+                return value;
+            };
+            if (size < 8 || std::memcmp(data, "NNWD", 4) != 0 || data[4] != format) {
+                throw std::invalid_argument("received data that is not a weight delta of a known format");
+            }
+            int bits = data[5];
+            bool full = data[6] != 0;
+            bool folded = data[7] != 0;
+            pos = 8;
+            std::uint64_t base_version = take(std::uint64_t{});
+            std::uint64_t version = take(std::uint64_t{});
+            std::uint32_t num_layers = take(std::uint32_t{});
+            WeightDelta delta(base_version, version, num_layers, bits, full, folded);
+
+            std::uint32_t num_tensors = take(std::uint32_t{});
+            for (std::uint32_t t = 0; t < num_tensors; t++) {
+                Tensor tensor;
+                tensor.layer = take(std::uint32_t{});
+                tensor.tensor = take(std::uint32_t{});
+                tensor.size = take(std::uint64_t{});
+                std::uint64_t count = take(std::uint64_t{});
+                bool dense = take(std::uint8_t{}) != 0;
+                tensor.scale = take(float{});
+                if (tensor.layer >= num_layers) {
+                    throw std::invalid_argument("received weight delta with a tensor outside of its layers");
+                }
+                if (count > tensor.size || (dense && count != tensor.size) || count > size - pos) {
+                    throw std::invalid_argument("received weight delta with inconsistent tensor sizes");
+                }
+
+                if (!dense) {
+                    tensor.indices.resize(count);
+                    std::uint64_t index = 0;
+                    for (std::uint64_t k = 0; k < count; k++) {
+                        std::uint64_t gap = 0;
+                        for (int shift = 0; ; shift += 7) {
+                            std::uint8_t byte = take(std::uint8_t{});
+                            gap |= (std::uint64_t)(byte & 0x7f) << shift;
+                            if (!(byte & 0x80)) {
+                                break;
+                            }
+                            if (shift == 28) { // Gaps fit in 5 bytes
+                                throw std::invalid_argument("received weight delta with invalid indices");
+                            }
+                        }
+                        index += gap;
+                        // Indices are stored as u32, so larger ones would be truncated
+                        if (index >= tensor.size || index > std::numeric_limits<std::uint32_t>::max() || (k > 0 && gap == 0)) {
+                            throw std::invalid_argument("received weight delta with invalid indices");
+                        }
+                        tensor.indices[k] = (std::uint32_t)index;
+                    }
+                }
+
+                tensor.values.resize(count);
+                for (std::uint64_t k = 0; k < count; k++) {
+                    if (bits == 32) {
+                        tensor.values[k] = take(float{});
+                    }
+                    else if (bits == 16) {
+                        tensor.values[k] = tensor.scale * (float)take(std::int16_t{});
+                    }
+                    else {
+                        tensor.values[k] = tensor.scale * (float)take(std::int8_t{});
+                    }
+                }
+                delta.addTensor(std::move(tensor));
+            }
+            return delta;
+        }
+
+        static WeightDelta deserialize(const std::vector<std::uint8_t>& bytes) {
+            return deserialize(bytes.data(), bytes.size());
+        }
+
+    private:
+        static constexpr std::uint8_t format = 2;
+
+        template<typename T>
+        static void put(std::vector<std::uint8_t>& bytes, T value) {
+            std::size_t offset = bytes.size();
+            bytes.resize(offset + sizeof(T));
+            std::memcpy(bytes.data() + offset, &value, sizeof(T));
+        }
+
+        std::uint64_t base_version;
+        std::uint64_t target_version;
+        std::uint32_t num_layers;
+        int value_bits;
+        bool full_values;
+        bool folded_weights;
+        std::vector<Tensor> delta_tensors;
+    };
+
+    /*
+    * @brief: Produces the weight deltas sent to serving replicas of a training network
+    *
+    * Keeps a copy of the weights the replicas hold, which every delta advances exactly as the
+    * replicas' appliers do. Deltas are thus taken against what the replicas actually hold:
+    * entries below the threshold and quantization errors are not dropped but sent later, once
+    * they add up, and replicas never drift from the network.
+    *
+    * @tparam NetType: Network type (e.g. `MultiClassNN`). Versions are its `parameterVersion()` (as
+    *                  `InferenceSnapshot::version`). The network is referenced and must outlive the encoder
+    */
+    template <typename NetType>
+    class DeltaEncoder {
+    public:
+        // Replicas start from the current weights of @nn, e.g. through `full()` or `publishSnapshot`
+        DeltaEncoder(NetType& nn, DeltaOptions options = {}) : nn(nn), options(options) {
+            if ((options.bits != 8 && options.bits != 16) || options.threshold < 0) {
+                throw std::invalid_argument("received invalid delta settings");
+            }
+            for (auto& views : nn.layerParameters()) {
+                for (const auto& view : views) {
+                    if ((std::uint64_t)view.size() > std::numeric_limits<std::uint32_t>::max()) {
+                        throw std::invalid_argument("received tensor too large for u32 delta indices");
+                    }
+                }
+                replica.emplace_back(views.begin(), views.end());
+            }
+            replica_version = nn.parameterVersion();
+        }
+
+        /*
+        * @brief: Delta from the weights held by the replicas to the current weights of the network,
+        *         which the replicas hold once it is applied. Tensors are encoded in parallel. Empty
+        *         if the weights were not changed since the last delta, so that versions stay distinct
+        */
+        WeightDelta encode() {
+            auto layers = nn.layerParameters();
+            checkShapes(layers);
+            std::uint64_t version = nn.parameterVersion();
+            WeightDelta delta(replica_version, version, (std::uint32_t)replica.size(), options.bits, false, nn.foldsInference());
+            if (version == replica_version) {
+                return delta;
+            }
+
+            std::vector<std::pair<std::size_t, std::size_t>> slots;
+            for (std::size_t l = 0; l < layers.size(); l++) {
+                for (std::size_t t = 0; t < layers[l].size(); t++) {
+                    slots.emplace_back(l, t);
+                }
+            }
+            std::vector<WeightDelta::Tensor> tensors(slots.size());
+            rangeParExec(
+                slots.size(),
+                [&](int& s) {
+                    auto [l, t] = slots[s];
+                    tensors[s] = encodeTensor(layers[l][t], replica[l][t]);
+                    tensors[s].layer = (std::uint32_t)l;
+                    tensors[s].tensor = (std::uint32_t)t;
+                }
+            );
+            for (auto& tensor : tensors) {
+                if (!tensor.values.empty()) {
+                    delta.addTensor(std::move(tensor));
+                }
+            }
+            replica_version = version;
+            return delta;
+        }
+
+        // Lossless copy of the weights held by the replicas, to bring up a new replica
+        WeightDelta full() const {
+            WeightDelta delta(replica_version, replica_version, (std::uint32_t)replica.size(), 32, true, nn.foldsInference());
+            for (std::size_t l = 0; l < replica.size(); l++) {
+                for (std::size_t t = 0; t < replica[l].size(); t++) {
+                    WeightDelta::Tensor tensor;
+                    tensor.layer = (std::uint32_t)l;
+                    tensor.tensor = (std::uint32_t)t;
+                    tensor.size = (std::uint64_t)replica[l][t].size();
+                    tensor.values.assign(replica[l][t].data(), replica[l][t].data() + replica[l][t].size());
+                    delta.addTensor(std::move(tensor));
+                }
+            }
+            return delta;
+        }
+
+        // Version held by the replicas
+        std::uint64_t version() const {
+            return replica_version;
+        }
+
+    private:
+        // Entries of @current differing from @held by more than the threshold, quantized; @held is advanced
+        WeightDelta::Tensor encodeTensor(const ParamView& current, MatColX<float>& held) const {
+            WeightDelta::Tensor tensor;
+            tensor.size = (std::uint64_t)held.size();
+            float max_change = 0;
+            for (Eigen::Index i = 0; i < held.size(); i++) {
+                float change = current(i) - held(i);
+                if (std::abs(change) > options.threshold) {
+                    tensor.indices.push_back((std::uint32_t)i);
+                    max_change = std::max(max_change, std::abs(change));
+                }
+            }
+            if (tensor.indices.empty()) {
+                return tensor;
+            }
+
+            float max_step = (float)((1 << (options.bits - 1)) - 1);
+            tensor.scale = max_change / max_step;
+            std::size_t kept = 0;
+            for (std::uint32_t index : tensor.indices) {
+                long step = std::lround((current(index) - held(index)) / tensor.scale);
+                step = std::clamp(step, -(long)max_step, (long)max_step);
+                if (step == 0) {
+                    continue; // Below one step: left for a later delta
+                }
+                float value = tensor.scale * (float)step;
+                held(index) += value;
+                tensor.indices[kept++] = index;
+                tensor.values.push_back(value);
+            }
+            tensor.indices.resize(kept);
+            return tensor;
+        }
+
+        void checkShapes(const std::vector<std::vector<ParamView>>& layers) const {
+            bool match = layers.size() == replica.size();
+            for (std::size_t l = 0; match && l < layers.size(); l++) {
+                match = layers[l].size() == replica[l].size();
+                for (std::size_t t = 0; match && t < layers[l].size(); t++) {
+                    match = layers[l][t].size() == replica[l][t].size();
+                }
+            }
+            if (!match) {
+                throw std::logic_error("parameters of the network changed shape since the encoder was created");
+            }
+        }
+
+        NetType& nn;
+        DeltaOptions options;
+        std::vector<std::vector<MatColX<float>>> replica;
+        std::uint64_t replica_version;
+    };
+
+    namespace Detail {
+        // Adds (or, for full deltas, writes) the values of @tensor to the entries of @weights they index
+        inline void patchTensor(float* weights, const WeightDelta::Tensor& tensor, bool full) {
+            if (tensor.indices.empty()) {
+                Eigen::Map<MatColX<float>> dense(weights, (Eigen::Index)tensor.size);
+                Eigen::Map<const MatColX<float>> values(tensor.values.data(), (Eigen::Index)tensor.values.size());
+                if (full) {
+                    dense = values;
+                }
+                else {
+                    dense += values;
+                }
+                return;
+            }
+            for (std::size_t k = 0; k < tensor.indices.size(); k++) {
+                weights[tensor.indices[k]] = full ? tensor.values[k] : weights[tensor.indices[k]] + tensor.values[k];
+            }
+        }
+
+        inline void checkBase(std::uint64_t held, const WeightDelta& delta) {
+            if (!delta.full() && delta.baseVersion() != held) {
+                throw std::logic_error("weight delta does not apply to the version held");
+            }
+        }
+    }
+
+    /*
+    * @brief: Patches the weights of a replica network in place with the deltas of a `DeltaEncoder`,
+    *         in O(number of entries) instead of a full reload. Deltas must be applied in order,
+    *         starting with a full one unless the replica starts from the encoder's weights. Not safe
+    *         while other threads use the network; serving threads should read `patchSnapshot` copies
+    */
+    class DeltaApplier {
+    public:
+        explicit DeltaApplier(std::uint64_t version = 0) : held_version(version) {}
+
+        template <typename NetType>
+        void apply(NetType& nn, const WeightDelta& delta) {
+            Detail::checkBase(held_version, delta);
+            auto layers = nn.layerParameters();
+            // Checked up front, so that a mismatched delta leaves the weights untouched
+            if (delta.numLayers() != layers.size() || delta.folded() != nn.foldsInference()) {
+                throw std::invalid_argument("weight delta was taken from a network of other layers or folds than @nn");
+            }
+            for (const auto& tensor : delta.tensors()) {
+                if (tensor.layer >= layers.size() || tensor.tensor >= layers[tensor.layer].size()
+                    || (std::uint64_t)layers[tensor.layer][tensor.tensor].size() != tensor.size) {
+                    throw std::invalid_argument("weight delta does not match the parameters of @nn");
+                }
+            }
+            rangeParExec(
+                delta.tensors().size(),
+                [&](int& k) {
+                    const auto& tensor = delta.tensors()[k];
+                    Detail::patchTensor(layers[tensor.layer][tensor.tensor].data(), tensor, delta.full());
+                }
+            );
+            nn.invalidateInference();
+            held_version = delta.version();
+        }
+
+        std::uint64_t version() const {
+            return held_version;
+        }
+
+    private:
+        std::uint64_t held_version;
+    };
+
+    /*
+    * @brief: Shadow copy of @base with @delta applied, leaving @base untouched for the threads
+    *         reading it; publish the result by swapping a `std::shared_ptr`. Layer `l` of the
+    *         snapshot matches layer `l` of the delta, whose tensor must be the augmented weights
+    *         (as for networks of `LinearLayer`s). Folded snapshots or deltas are rejected: folded
+    *         weights are not the parameters the delta changes
+    */
+    inline std::shared_ptr<const InferenceSnapshot> patchSnapshot(const InferenceSnapshot& base, const WeightDelta& delta) {
+        Detail::checkBase(base.version(), delta);
+        if (base.folded() || delta.folded()) {
+            throw std::invalid_argument("cannot patch folded inference weights with a weight delta");
+        }
+        if (delta.numLayers() != base.numLayers()) {
+            throw std::invalid_argument("weight delta does not match the number of layers of @base");
+        }
+        std::vector<InferenceSnapshot::Layer> layers;
+        for (std::size_t l = 0; l < base.numLayers(); l++) {
+            layers.push_back(base.layer(l));
+        }
+        for (const auto& tensor : delta.tensors()) {
+            if (tensor.layer >= layers.size() || tensor.tensor != 0
+                || (std::uint64_t)layers[tensor.layer].weights.size() != tensor.size) {
+                throw std::invalid_argument("weight delta does not match the layers of @base");
+            }
+        }
+        rangeParExec(
+            delta.tensors().size(),
+            [&](int& k) {
+                const auto& tensor = delta.tensors()[k];
+                Detail::patchTensor(layers[tensor.layer].weights.data(), tensor, delta.full());
+            }
+        );
+        return std::make_shared<const InferenceSnapshot>(std::move(layers), delta.version());
+    }
+
+    /*
+    * @brief: `InferenceSnapshot` of a network of `LinearLayer`s saved as a full delta (see
+    *         `DeltaEncoder::full`), e.g. to serve or score offline without the training code.
+    *         Layer shapes follow from @input_dim, as the weights of layer `l` hold `(in + 1) x out`
+    *         entries; hidden layers apply @hidden_activation, the output layer none. Deltas of
+    *         networks folding their inference weights are rejected, as the folds are not saved
+    */
+    inline std::shared_ptr<const InferenceSnapshot> snapshotFromDelta(const WeightDelta& full, Eigen::Index input_dim,
+                                                                      std::function<void(MatrixX_RowMajor<float>&)> hidden_activation = {}) {
+        if (!full.full() || full.folded()) {
+            throw std::invalid_argument("received a weight delta that is not a full one, or of a folded network");
+        }
+        const auto& tensors = full.tensors();
+        if (tensors.size() != full.numLayers()) {
+            throw std::invalid_argument("weight delta does not hold one tensor per layer");
+        }
+        std::vector<InferenceSnapshot::Layer> layers;
+        Eigen::Index in_dim = input_dim;
+        for (std::size_t l = 0; l < tensors.size(); l++) {
+            const auto& tensor = tensors[l];
+            if (tensor.layer != l || tensor.tensor != 0 || !tensor.indices.empty() || in_dim <= 0
+                || tensor.size % (std::uint64_t)(in_dim + 1) != 0) {
+                throw std::invalid_argument("weight delta does not hold layers of the given input dimension");
+            }
+            Eigen::Index out_dim = (Eigen::Index)(tensor.size / (std::uint64_t)(in_dim + 1));
+            InferenceSnapshot::Layer layer{ Eigen::Map<const MatrixX_RowMajor<float>>(tensor.values.data(), in_dim + 1, out_dim), {} };
+            if (l + 1 < tensors.size()) {
+                layer.activate = hidden_activation;
+            }
+            layers.push_back(std::move(layer));
+            in_dim = out_dim;
+        }
+        return std::make_shared<const InferenceSnapshot>(std::move(layers), full.version());
+    }
+}
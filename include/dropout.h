@@ -0,0 +1,163 @@
+// dropout.h: Contains facilities implementing dropout layers
+
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/traits_concepts.h"
+#include "../utilities/paral.h"
+#include "../utilities/random.h"
+
+namespace Neural {
+    /*
+    * @brief: Encapsulates (inverted) dropout as a hidden layer
+    *
+    * During training, zeroes each activation with probability @rate and scales survivors by
+    * `1 / (1 - rate)`. Masks are drawn from a Philox stream and stored bit-packed (one bit per
+    * activation, each row padded to a multiple of 64 bits) for use in the backward pass.
+    * Reports itself as `inferenceIdentity`, so `FeedFwdNN` drops it from the forward chain when testing.
+    *
+    * @tparam EigenType: Must be `Eigen::T<float, Eigen::Dynamic, Eigen::Dynamic>`
+    * where `T` is `Array` or `Matrix`
+    */
+    template <typename EigenType>
+    class DropoutLayer {
+    public:
+        DropoutLayer(float rate, std::uint64_t stream, int seed = 42) : rate(rate), rng(seed, stream) {
+            if (rate < 0 || rate >= 1) {
+                throw std::invalid_argument("dropout rate @rate must lie in [0, 1)");
+            }
+            scale = 1.0f / (1.0f - rate);
+            // Random word `w` keeps its activation iff `w >= threshold`
+            threshold = (std::uint32_t)std::min(4294967295.0, (double)rate * 4294967296.0);
+        }
+
+        constexpr static bool has_weights = false;
+
+        auto feedForward(const MatrixX_RowMajor_Ref<float>& inputs) {
+            Eigen::Index num_rows = inputs.rows();
+            num_cols = inputs.cols();
+            words_per_row = (num_cols + 63) / 64;
+            masks.resize(num_rows * words_per_row);
+
+            MatrixX_RowMajor<float> outputs(num_rows, num_cols);
+            std::uint64_t first_block = next_block;
+            std::uint64_t num_blocks = (std::uint64_t)num_rows * words_per_row * 16;
+            rangeParExec(
+                num_rows,
+                [&](int& row_number) {
+                    std::uint32_t w[64];
+                    std::uint64_t* row_masks = masks.data() + row_number * words_per_row;
+                    std::uint64_t row_block = first_block + (std::uint64_t)row_number * words_per_row * 16;
+
+                    for (Eigen::Index k = 0; k < words_per_row; k++) {
+                        // 16 Philox blocks yield the 64 words behind one mask word
+                        rng.words(row_block + 16 * k, 16, w);
+                        std::uint64_t bits = 0;
+                        for (int j = 0; j < 64; j++) {
+                            bits |= (std::uint64_t)(w[j] >= threshold) << j;
+                        }
+                        row_masks[k] = bits;
+                    }
+                    applyMask(inputs.row(row_number), outputs.row(row_number), row_masks);
+                }
+            );
+            // Fresh masks on every call, unless deterministic
+            if (deterministic) {
+                frozen_end = std::max(frozen_end, first_block + num_blocks);
+            }
+            else {
+                next_block += num_blocks;
+            }
+
+            auto outputs_eval = MatOrArray<EigenType>::eval(outputs);
+            return std::make_pair(outputs_eval, outputs_eval);
+        }
+
+        // Routes @tgradient through the masks of the last forward pass; gradient wrt the
+        // layer's inputs serves as both returned values (the layer has no weights)
+        auto backPropagate(const ArrayX_RowMajor_Ref<float>& signals,
+                           const ArrayX_RowMajor_Ref<float>& tgradient) {
+            Eigen::Index num_rows = tgradient.rows();
+            if (tgradient.cols() != num_cols || num_rows * words_per_row != (Eigen::Index)masks.size()) {
+                throw std::invalid_argument("shape of @tgradient does not match last forward pass");
+            }
+
+            MatrixX_RowMajor<float> gradient(num_rows, num_cols);
+            rangeParExec(
+                num_rows,
+                [&](int& row_number) {
+                    applyMask(tgradient.row(row_number).matrix(), gradient.row(row_number),
+                              masks.data() + row_number * words_per_row);
+                }
+            );
+
+            auto gradient_eval = MatOrArray<EigenType>::eval(gradient);
+            return std::make_pair(gradient_eval, gradient_eval);
+        }
+
+        void updateWeights(const MatrixX_RowMajor_Ref<float>&, const MatrixX_RowMajor_Ref<float>&, float) {
+            return;
+        }
+
+        // Restricts the masks of the last forward pass to @rows (see `FeedFwdNN::trainSelective`)
+        void selectRows(const MatColX<int>& rows) {
+            std::vector<std::uint64_t> selected(rows.size() * words_per_row);
+            for (Eigen::Index k = 0; k < rows.size(); k++) {
+                std::copy_n(masks.data() + rows(k) * words_per_row, words_per_row, selected.data() + k * words_per_row);
+            }
+            masks.swap(selected);
+        }
+
+        /*
+        * @brief: While @deterministic is set, every forward pass draws its masks from the same Philox
+        *         blocks, so passes over batches of one shape share their masks (see
+        *         `FeedFwdNN::lossAndGradient`). Fresh masks resume once it is cleared
+        */
+        void setDeterministic(bool deterministic) {
+            if (this->deterministic && !deterministic) {
+                next_block = frozen_end;
+            }
+            this->deterministic = deterministic;
+            frozen_end = next_block;
+        }
+
+        bool inferenceIdentity() const {
+            return true;
+        }
+
+        // Bit-packed masks of last forward pass, `words_per_row` words per row
+        const std::vector<std::uint64_t>& bitMasks() const {
+            return masks;
+        }
+
+    private:
+        template<typename Derived_1, typename Derived_2>
+        void applyMask(const Eigen::MatrixBase<Derived_1>& in, Eigen::MatrixBase<Derived_2>&& out,
+                       const std::uint64_t* row_masks) const {
+            for (Eigen::Index k = 0; k < words_per_row; k++) {
+                std::uint64_t bits = row_masks[k];
+                Eigen::Index end = std::min<Eigen::Index>(64, num_cols - 64 * k);
+                for (Eigen::Index j = 0; j < end; j++) {
+                    out(64 * k + j) = ((bits >> j) & 1) ? scale * in(64 * k + j) : 0.0f;
+                }
+            }
+        }
+
+        float rate;
+        float scale;
+        std::uint32_t threshold;
+
+        Philox rng;
+        std::uint64_t next_block = 0;
+        bool deterministic = false;
+        std::uint64_t frozen_end = 0; // End of the blocks drawn while deterministic
+
+        Eigen::Index num_cols = 0;
+        Eigen::Index words_per_row = 0;
+        std::vector<std::uint64_t> masks;
+    };
+}
@@ -0,0 +1,197 @@
+// embedding.h: Contains facilities for constructing embedding layers over categorical IDs
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/traits_concepts.h"
+#include "../utilities/paral.h"
+#include "../utilities/random.h"
+
+namespace Neural {
+    // Update rules of `EmbeddingLayer`. `Adagrad` and `Adam` keep per-row state that is only read
+    // and written for the rows touched by a batch (lazy updates)
+    enum class EmbeddingOptim {SGD, Adagrad, Adam};
+
+    /*
+    * @brief: Encapsulates an embedding table, mapping integer IDs to dense rows
+    *
+    * Every input row holds @num_fields IDs in `[0, vocab_size)`; the output row is the
+    * concatenation of their embeddings. The forward pass gathers table rows; the update
+    * accumulates gradients per unique ID of the batch and only touches those rows, so a step
+    * costs `O(unique IDs * embed_dim)` regardless of `vocab_size`. Same goes for optimizer
+    * state under `EmbeddingOptim::Adagrad` and `EmbeddingOptim::Adam`.
+    *
+    * IDs may be passed as int matrices (`feedForwardIndices`, matching the indices labels of
+    * `Labels`) or, within `FeedFwdNN`, as floats holding integral values (exact below 2^24).
+    * The layer should come first in the network: it has no gradient wrt its inputs.
+    *
+    * @tparam EigenType: Must be `Eigen::T<float, Eigen::Dynamic, Eigen::Dynamic>`
+    * where `T` is `Array` or `Matrix`
+    */
+    template <typename EigenType>
+    class EmbeddingLayer {
+    public:
+        EmbeddingLayer(Eigen::Index vocab_size, Eigen::Index embed_dim, std::uint64_t stream,
+                       Eigen::Index num_fields = 1, EmbeddingOptim optim = EmbeddingOptim::SGD, int seed = 42) :
+            vocab_size(vocab_size), embed_dim(embed_dim), num_fields(num_fields), optim(optim)
+        {
+            if (vocab_size <= 0 || embed_dim <= 0 || num_fields <= 0) {
+                throw std::invalid_argument("received non-positive dimensions");
+            }
+            table.resize(vocab_size, embed_dim);
+            Philox(seed, stream).fillNormal(table, 0.0, 1.0f / std::sqrt((float)embed_dim));
+
+            if (optim != EmbeddingOptim::SGD) {
+                second_moments = MatrixX_RowMajor<float>::Zero(vocab_size, embed_dim);
+            }
+            if (optim == EmbeddingOptim::Adam) {
+                first_moments = MatrixX_RowMajor<float>::Zero(vocab_size, embed_dim);
+            }
+        }
+
+        auto feedForward(const MatrixX_RowMajor_Ref<float>& inputs) {
+            return feedForwardIndices(toIndices(inputs));
+        }
+
+        auto feedForwardIndices(const Eigen::Ref<const MatrixX_RowMajor<int>>& ids) {
+            checkIndices(ids);
+            Eigen::Index num_rows = ids.rows();
+            MatrixX_RowMajor<float> outputs(num_rows, num_fields * embed_dim);
+
+            rangeParExec(
+                num_rows,
+                [&](int& row_number) {
+                    for (Eigen::Index f = 0; f < num_fields; f++) {
+                        outputs.row(row_number).segment(f * embed_dim, embed_dim) = table.row(ids(row_number, f));
+                    }
+                }
+            );
+
+            auto outputs_eval = MatOrArray<EigenType>::eval(outputs);
+            return std::make_pair(outputs_eval, outputs_eval);
+        }
+
+        // IDs have no gradient; returns @tgradient and zeros shaped like the inputs
+        auto backPropagate(const ArrayX_RowMajor_Ref<float>& signals,
+                           const ArrayX_RowMajor_Ref<float>& tgradient) {
+            MatrixX_RowMajor<float> new_tgradient = MatrixX_RowMajor<float>::Zero(tgradient.rows(), num_fields);
+            return std::make_pair(MatOrArray<EigenType>::eval(tgradient.matrix()),
+                                  MatOrArray<EigenType>::eval(new_tgradient));
+        }
+
+        void updateWeights(const MatrixX_RowMajor_Ref<float>& inputs, const MatrixX_RowMajor_Ref<float>& gradient, float lr) {
+            updateIndices(toIndices(inputs), gradient, lr);
+        }
+
+        /*
+        * @brief: Sparse update of the rows referenced by @ids
+        *
+        * @param ids: IDs of the batch, `rows x num_fields`
+        * @param gradient: Gradient wrt the layer's outputs, `rows x (num_fields * embed_dim)`
+        * @param lr: Learning rate
+        */
+        void updateIndices(const Eigen::Ref<const MatrixX_RowMajor<int>>& ids,
+                           const MatrixX_RowMajor_Ref<float>& gradient, float lr) {
+            checkIndices(ids);
+            if (gradient.rows() != ids.rows() || gradient.cols() != num_fields * embed_dim) {
+                throw std::invalid_argument("shape of @gradient does not match @ids");
+            }
+            step++;
+
+            // Group occurrences by ID: (id, position of embedding in @gradient)
+            std::vector<std::pair<int, Eigen::Index>> occurrences(ids.size());
+            for (Eigen::Index i = 0; i < ids.size(); i++) {
+                occurrences[i] = std::make_pair(ids(i / num_fields, i % num_fields), i);
+            }
+            std::sort(occurrences.begin(), occurrences.end());
+
+            std::vector<Eigen::Index> group_starts;
+            for (Eigen::Index i = 0; i < (Eigen::Index)occurrences.size(); i++) {
+                if (i == 0 || occurrences[i].first != occurrences[i - 1].first) {
+                    group_starts.push_back(i);
+                }
+            }
+            group_starts.push_back(occurrences.size());
+
+            last_unique = (Eigen::Index)group_starts.size() - 1;
+
+            // Unique IDs own disjoint table rows, so groups update in parallel
+            rangeParExec(
+                last_unique,
+                [&](int& group) {
+                    MatRowX<float> row_grad = MatRowX<float>::Zero(embed_dim);
+                    for (Eigen::Index i = group_starts[group]; i < group_starts[group + 1]; i++) {
+                        Eigen::Index position = occurrences[i].second;
+                        row_grad += gradient.row(position / num_fields).segment((position % num_fields) * embed_dim, embed_dim);
+                    }
+                    applyRow(occurrences[group_starts[group]].first, row_grad, lr);
+                }
+            );
+
+            return;
+        }
+
+        // Number of distinct IDs of the last update (its cost)
+        Eigen::Index lastUniqueIds() const {
+            return last_unique;
+        }
+
+        const MatrixX_RowMajor<float>& embeddings() const {
+            return table;
+        }
+
+    private:
+        void applyRow(int id, const MatRowX<float>& row_grad, float lr) {
+            constexpr float beta_1 = 0.9f, beta_2 = 0.999f, epsilon = 1e-8f;
+            auto row = table.row(id).array();
+
+            if (optim == EmbeddingOptim::SGD) {
+                row -= lr * row_grad.array();
+            }
+            else if (optim == EmbeddingOptim::Adagrad) {
+                auto acc = second_moments.row(id).array();
+                acc += row_grad.array().square();
+                row -= lr * row_grad.array() / (acc.sqrt() + epsilon);
+            }
+            else {
+                // Lazy Adam: moments of untouched rows are not decayed
+                auto m = first_moments.row(id).array();
+                auto v = second_moments.row(id).array();
+                m = beta_1 * m + (1 - beta_1) * row_grad.array();
+                v = beta_2 * v + (1 - beta_2) * row_grad.array().square();
+                float correction = std::sqrt(1 - std::pow(beta_2, (float)step)) / (1 - std::pow(beta_1, (float)step));
+                row -= lr * correction * m / (v.sqrt() + epsilon);
+            }
+        }
+
+        MatrixX_RowMajor<int> toIndices(const MatrixX_RowMajor_Ref<float>& inputs) const {
+            return inputs.array().round().template cast<int>().matrix();
+        }
+
+        void checkIndices(const Eigen::Ref<const MatrixX_RowMajor<int>>& ids) const {
+            if (ids.cols() != num_fields) {
+                throw std::invalid_argument("number of columns of IDs does not match `num_fields`");
+            }
+            if (ids.size() > 0 && (ids.minCoeff() < 0 || ids.maxCoeff() >= vocab_size)) {
+                throw std::invalid_argument("received IDs outside of [0, vocab_size)");
+            }
+        }
+
+        Eigen::Index vocab_size;
+        Eigen::Index embed_dim;
+        Eigen::Index num_fields;
+        EmbeddingOptim optim;
+
+        MatrixX_RowMajor<float> table;
+        MatrixX_RowMajor<float> first_moments;
+        MatrixX_RowMajor<float> second_moments;
+        std::uint64_t step = 0;
+        Eigen::Index last_unique = 0;
+    };
+}
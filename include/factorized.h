@@ -0,0 +1,272 @@
+// factorized.h: Contains facilities for low-rank factorized linear layers and SVD compression
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/SVD>
+#include "../utilities/types.h"
+#include "../utilities/traits_concepts.h"
+#include "../utilities/random.h"
+#include "layers.h"
+
+namespace Neural {
+    /*
+    * @brief: Encapsulates a linear layer (no activation) whose weights are factorized as
+    *         `W = U * V`, with `U` of shape `in_dim x rank` and `V` of shape `rank x out_dim`
+    *
+    * The forward pass costs `rank * (in_dim + out_dim)` multiply-adds per row instead of
+    * `in_dim * out_dim`. The bias is kept as a separate row. Can be used as hidden or output
+    * layer of `FeedFwdNN`, and be constructed from a trained `LinearLayer` with `compressToRank`
+    * or `compressToEnergy`.
+    *
+    * @tparam EigenType: Must be `Eigen::T<float, Eigen::Dynamic, Eigen::Dynamic>`
+    * where `T` is `Array` or `Matrix`
+    */
+    template <typename EigenType>
+    class FactorizedLinearLayer {
+    public:
+        // Draws both factors with scheme @init (bounds computed per factor); the bias is zeroed
+        FactorizedLinearLayer(Eigen::Index in_dim, Eigen::Index out_dim, Eigen::Index rank, std::uint64_t stream,
+                              Init init = Init::XavierUniform, int seed = 42) :
+            FactorizedLinearLayer(PlainLinearLayer<MatrixX_RowMajor<float>>(in_dim, rank, init, Philox::substream(stream, 0), seed)
+                                      .augmentedWeights().topRows(in_dim),
+                                  PlainLinearLayer<MatrixX_RowMajor<float>>(rank, out_dim, init, Philox::substream(stream, 1), seed)
+                                      .augmentedWeights().topRows(rank),
+                                  MatRowX<float>::Zero(out_dim)) {}
+
+        FactorizedLinearLayer(const MatrixX_RowMajor<float>& left, const MatrixX_RowMajor<float>& right,
+                              const MatRowX<float>& bias) : left(left), right(right), bias(bias)
+        {
+            if (left.cols() != right.rows() || right.cols() != bias.cols() || left.cols() == 0) {
+                throw std::invalid_argument("received factors of incompatible shapes");
+            }
+        }
+
+        auto feedForward(const MatrixX_RowMajor_Ref<float>& inputs) {
+            if (inputs.cols() != left.rows()) {
+                throw std::invalid_argument("number of columns of @inputs does not match layer");
+            }
+            projected.noalias() = inputs * left;
+            MatrixX_RowMajor<float> signals = projected * right;
+            signals.rowwise() += bias;
+
+            auto signals_eval = MatOrArray<EigenType>::eval(signals);
+            return std::make_pair(signals_eval, signals_eval);
+        }
+
+        // To be used if instance is a hidden layer. Returns @tgradient and the gradient wrt the inputs
+        auto backPropagate(const ArrayX_RowMajor_Ref<float>& signals,
+                           const ArrayX_RowMajor_Ref<float>& tgradient) {
+            return seedBackProp(signals, tgradient);
+        }
+
+        // To be used if instance is output layer (identity activation, @gradient is unchanged)
+        auto seedBackProp(const ArrayX_RowMajor_Ref<float>&,
+                          const ArrayX_RowMajor_Ref<float>& gradient) {
+            projected_gradient.noalias() = gradient.matrix() * right.transpose();
+            MatrixX_RowMajor<float> new_tgradient = projected_gradient * left.transpose();
+
+            return std::make_pair(MatOrArray<EigenType>::eval(gradient.matrix()),
+                                  MatOrArray<EigenType>::eval(new_tgradient));
+        }
+
+        // Updates both factors and the bias using gradient descent. @inputs must be those of the
+        // last forward pass, whose projection is reused
+        void updateWeights(const MatrixX_RowMajor_Ref<float>& inputs, const MatrixX_RowMajor_Ref<float>& gradient, float lr) {
+            if (inputs.rows() != projected.rows() || gradient.rows() != projected_gradient.rows()) {
+                throw std::invalid_argument("shapes of @inputs or @gradient do not match last passes");
+            }
+            right.noalias() -= lr * (projected.transpose() * gradient);
+            left.noalias() -= lr * (inputs.transpose() * projected_gradient);
+            bias -= lr * gradient.colwise().sum();
+
+            return;
+        }
+
+        // Gradients wrt `parameters()`, laid out alike; @inputs and @gradient as in `updateWeights`
+        std::vector<MatColX<float>> parameterGradients(const MatrixX_RowMajor_Ref<float>& inputs,
+                                                       const MatrixX_RowMajor_Ref<float>& gradient) {
+            if (inputs.rows() != projected.rows() || gradient.rows() != projected_gradient.rows()) {
+                throw std::invalid_argument("shapes of @inputs or @gradient do not match last passes");
+            }
+            MatrixX_RowMajor<float> left_gradient = inputs.transpose() * projected_gradient;
+            MatrixX_RowMajor<float> right_gradient = projected.transpose() * gradient;
+            return { Eigen::Map<MatColX<float>>(left_gradient.data(), left_gradient.size()),
+                     Eigen::Map<MatColX<float>>(right_gradient.data(), right_gradient.size()),
+                     gradient.colwise().sum().transpose() };
+        }
+
+        // Restricts the last forward pass to @rows (see `FeedFwdNN::trainSelective`)
+        void selectRows(const MatColX<int>& rows) {
+            projected = projected(rows, Eigen::all).eval();
+        }
+
+        std::vector<ParamView> parameters() {
+            return { ParamView(left.data(), left.size()), ParamView(right.data(), right.size()),
+                     ParamView(bias.data(), bias.size()) };
+        }
+
+        Eigen::Index inputDim() const {
+            return left.rows();
+        }
+
+        Eigen::Index outputDim() const {
+            return right.cols();
+        }
+
+        Eigen::Index rank() const {
+            return left.cols();
+        }
+
+        // Dense equivalent, augmented with the bias row like `LinearLayer` weights
+        MatrixX_RowMajor<float> augmentedWeights() const {
+            MatrixX_RowMajor<float> weights(left.rows() + 1, right.cols());
+            weights.topRows(left.rows()).noalias() = left * right;
+            weights.row(left.rows()) = bias;
+            return weights;
+        }
+
+    private:
+        MatrixX_RowMajor<float> left;
+        MatrixX_RowMajor<float> right;
+        MatRowX<float> bias;
+
+        // Cached by last forward and backward passes for update
+        MatrixX_RowMajor<float> projected;
+        MatrixX_RowMajor<float> projected_gradient;
+    };
+
+    /*
+    * @brief: Report of an SVD compression. Output metrics are measured on the sample inputs
+    *         passed to `compressionReport` (zero otherwise)
+    *
+    * `energy_kept`: fraction of the squared Frobenius norm of the weights kept by the retained
+    *                singular values
+    * `weight_error`: relative Frobenius error of the weights (bias row excluded)
+    * `output_error`: relative Frobenius error of the layer's outputs
+    * `argmax_agreement`: fraction of rows whose largest output keeps its column (the change of
+    *                     accuracy when compressing the output layer of a classifier)
+    */
+    struct CompressionReport {
+        Eigen::Index rank = 0;
+        Eigen::Index dense_flops = 0;      // Multiply-adds per row before compression
+        Eigen::Index factorized_flops = 0; // Multiply-adds per row after compression
+        float energy_kept = 0;
+        float weight_error = 0;
+        float output_error = 0;
+        float argmax_agreement = 0;
+    };
+
+    namespace Detail {
+        inline Eigen::BDCSVD<MatrixX_ColMajor<float>> weightsSVD(const MatrixX_RowMajor<float>& weights) {
+            MatrixX_ColMajor<float> dense = weights.topRows(weights.rows() - 1);
+            return Eigen::BDCSVD<MatrixX_ColMajor<float>>(dense, Eigen::ComputeThinU | Eigen::ComputeThinV);
+        }
+
+        // Splits each singular value evenly between both factors, which keeps them balanced for
+        // further training. Throws unless @rank lowers the multiply-adds per row
+        template <typename EigenType>
+        FactorizedLinearLayer<EigenType> truncate(const MatrixX_RowMajor<float>& weights,
+                                                  const Eigen::BDCSVD<MatrixX_ColMajor<float>>& svd,
+                                                  Eigen::Index rank) {
+            Eigen::Index in_dim = weights.rows() - 1, out_dim = weights.cols();
+            if (rank * (in_dim + out_dim) >= in_dim * out_dim) {
+                throw std::invalid_argument("rank does not compress the layer: needs rank * (in_dim + out_dim) < in_dim * out_dim");
+            }
+            ArrRowX<float> root = svd.singularValues().head(rank).array().sqrt().transpose();
+            MatrixX_RowMajor<float> left = (svd.matrixU().leftCols(rank).array().rowwise() * root).matrix();
+            MatrixX_RowMajor<float> right = (svd.matrixV().leftCols(rank).array().rowwise() * root).matrix().transpose();
+
+            return FactorizedLinearLayer<EigenType>(left, right, weights.row(weights.rows() - 1));
+        }
+    }
+
+    /*
+    * @brief: Compresses a trained layer (e.g. `PlainLinearLayer`) via truncated SVD of its weights
+    *
+    * @param layer: Layer implementing `augmentedWeights()`, without activation (checked at compile
+    *               time), as the factorized layer has none
+    * @param rank: Number of singular values kept, clamped to `[1, min(in_dim, out_dim)]`. Ranks
+    *              with `rank * (in_dim + out_dim) >= in_dim * out_dim` save nothing and are rejected
+    */
+    template <typename EigenType, typename LayerType>
+    FactorizedLinearLayer<EigenType> compressToRank(const LayerType& layer, Eigen::Index rank) {
+        static_assert(!LayerType::has_activation, "cannot compress an activated layer: the factorized layer has no activation");
+        const MatrixX_RowMajor<float>& weights = layer.augmentedWeights();
+        auto svd = Detail::weightsSVD(weights);
+        rank = std::clamp<Eigen::Index>(rank, 1, svd.singularValues().size());
+        return Detail::truncate<EigenType>(weights, svd, rank);
+    }
+
+    /*
+    * @brief: Like `compressToRank`, using the smallest rank that keeps at least fraction @energy
+    *         of the squared Frobenius norm of the weights. Throws if that rank saves nothing
+    */
+    template <typename EigenType, typename LayerType>
+    FactorizedLinearLayer<EigenType> compressToEnergy(const LayerType& layer, float energy) {
+        static_assert(!LayerType::has_activation, "cannot compress an activated layer: the factorized layer has no activation");
+        if (energy <= 0 || energy > 1) {
+            throw std::invalid_argument("received @energy outside of (0, 1]");
+        }
+        const MatrixX_RowMajor<float>& weights = layer.augmentedWeights();
+        auto svd = Detail::weightsSVD(weights);
+
+        ArrColX<float> squares = svd.singularValues().array().square();
+        float total = squares.sum(), kept = 0;
+        Eigen::Index rank = 0;
+        while (rank < squares.size() && kept < energy * total) {
+            kept += squares(rank++);
+        }
+        return Detail::truncate<EigenType>(weights, svd, std::max<Eigen::Index>(rank, 1));
+    }
+
+    /*
+    * @brief: Measures the impact of replacing @original by @compressed
+    *
+    * @param sample_inputs: Representative inputs of the layer (e.g. a validation batch). May be
+    *                       empty, in which case output metrics are left at zero
+    */
+    template <typename LayerType, typename EigenType>
+    CompressionReport compressionReport(const LayerType& original, FactorizedLinearLayer<EigenType>& compressed,
+                                        const MatrixX_RowMajor_Ref<float>& sample_inputs) {
+        const MatrixX_RowMajor<float>& weights = original.augmentedWeights();
+        Eigen::Index in_dim = weights.rows() - 1, out_dim = weights.cols();
+
+        CompressionReport report;
+        report.rank = compressed.rank();
+        report.dense_flops = in_dim * out_dim;
+        report.factorized_flops = report.rank * (in_dim + out_dim);
+
+        MatrixX_RowMajor<float> approx = compressed.augmentedWeights();
+        float norm_sq = weights.topRows(in_dim).squaredNorm();
+        float error_sq = (weights.topRows(in_dim) - approx.topRows(in_dim)).squaredNorm();
+        report.weight_error = norm_sq > 0 ? std::sqrt(error_sq / norm_sq) : 0.0f;
+        // Truncated SVD is an orthogonal projection: kept and discarded energy sum to the total
+        report.energy_kept = norm_sq > 0 ? 1.0f - error_sq / norm_sq : 1.0f;
+
+        if (sample_inputs.rows() > 0) {
+            MatrixX_RowMajor<float> reference = sample_inputs * weights.topRows(in_dim);
+            reference.rowwise() += weights.row(in_dim);
+            MatrixX_RowMajor<float> outputs = MatOrArray<MatrixX_RowMajor<float>>::eval(compressed.feedForward(sample_inputs).first);
+
+            float reference_sq = reference.squaredNorm();
+            report.output_error = reference_sq > 0 ? std::sqrt((reference - outputs).squaredNorm() / reference_sq) : 0.0f;
+
+            Eigen::Index agreements = 0;
+            for (Eigen::Index r = 0; r < sample_inputs.rows(); r++) {
+                Eigen::Index expected, actual;
+                reference.row(r).maxCoeff(&expected);
+                outputs.row(r).maxCoeff(&actual);
+                agreements += (expected == actual);
+            }
+            report.argmax_agreement = (float)agreements / (float)sample_inputs.rows();
+        }
+
+        return report;
+    }
+}
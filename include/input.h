@@ -1,7 +1,11 @@
 // input.h : Contains facilities for reading in input stream
 
 #pragma once
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <istream>
 #include <Eigen/Dense>
 #include "../utilities/types.h"
@@ -65,4 +69,69 @@ namespace Input {
 
         return data;
     }
+
+    /**
+    * @brief: Parses @text, newline-delimited lines of numbers separated by spaces, tabs or commas,
+    *         into an `Eigen::Array` (one row per non-empty line). Unlike `readData`, uses
+    *         `std::from_chars` (no locale, no stream state), so that threads can parse chunks of
+    *         the same file concurrently and fast. Throws if a line is malformed or if its number
+    *         of items differs from the first line's
+    *
+    * @param text: chunk of whole lines (the last may lack its newline)
+    * @return: `Eigen::Array` obj containing data
+    */
+    inline ArrayX_RowMajor<float> parseRows(std::string_view text) {
+        auto isDelimiter = [](char c) { return c == ' ' || c == '\t' || c == ',' || c == '\r'; };
+        const char* pos = text.data();
+        const char* end = text.data() + text.size();
+
+        // Parses the line starting at @pos, writing its first @capacity items to @out, and moves
+        // @pos past it. Returns its number of items
+        auto parseLine = [&](float* out, Eigen::Index capacity) {
+            Eigen::Index num_items = 0;
+            while (true) {
+                while (pos < end && isDelimiter(*pos)) {
+                    pos++;
+                }
+                if (pos == end || *pos == '\n') {
+                    pos += (pos < end);
+                    return num_items;
+                }
+                float val;
+                auto [next, error] = std::from_chars(pos, end, val);
+                if (error != std::errc() || (next < end && !isDelimiter(*next) && *next != '\n')) {
+                    throw std::invalid_argument("received malformed number in line");
+                }
+                if (num_items < capacity) {
+                    out[num_items] = val;
+                }
+                num_items++;
+                pos = next;
+            }
+        };
+
+        Eigen::Index num_lines = std::count(text.begin(), text.end(), '\n') + 1;
+        Eigen::Index num_cols = 0;
+        while (pos < end && num_cols == 0) {
+            num_cols = parseLine(nullptr, 0);
+        }
+        pos = text.data();
+
+        ArrayX_RowMajor<float> data(num_lines, num_cols);
+        Eigen::Index row_counter{ 0 };
+        while (pos < end) {
+            Eigen::Index num_items = parseLine(data.row(row_counter).data(), num_cols);
+            if (num_items == 0) {
+                continue;
+            }
+            if (num_items != num_cols) {
+                throw std::invalid_argument("received lines with differing numbers of items");
+            }
+            row_counter++;
+        }
+
+        data.conservativeResize(row_counter, num_cols);
+
+        return data;
+    }
 }
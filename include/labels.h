@@ -23,7 +23,7 @@ namespace Labels {
 
         Eigen::Index num_classes = one_hot_labels.cols();
         MatColX<int> indices(num_classes);
-        indices.setLinSpaced(0, (int)num_classes);
+        indices.setLinSpaced(0, (int)num_classes - 1);
 
         auto indices_labels = (one_hot_labels_int * indices).eval();
 
@@ -1,19 +1,67 @@
 // layers.h: Contains facilities for constructing individual layers of neural networks 
 
 #pragma once
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 #include <Eigen/Core>
 #include "../utilities/types.h"
 #include "../utilities/traits_concepts.h"
 #include "../utilities/softmax.h"
+#include "../utilities/random.h"
+#include "../utilities/sparse.h"
 
 namespace Neural {
+    /*
+    * @brief: Weight initialization schemes. Xavier (Glorot) schemes suit linear/tanh-like
+    *         activations, He schemes suit ReLU-like activations. Both zero the bias row
+    */
+    enum class Init {XavierUniform, XavierNormal, HeUniform, HeNormal};
+
+    /*
+    * @brief: View onto a contiguous block of trainable parameters of a layer. Layers may expose
+    *         theirs through `std::vector<ParamView> parameters()`, which lets optimizers working on
+    *         flattened parameters (e.g. `LBFGS`) drive them; see `FeedFwdNN::getParameters`
+    */
+    using ParamView = Eigen::Map<MatColX<float>>;
+
+    /*
+    * @brief: Weight averaging schemes tracked by `LinearLayer::setAveraging`. `EMA` keeps an
+    *         exponential moving average of the weights; `SWA` (stochastic weight averaging) keeps
+    *         their arithmetic mean over snapshots taken every `period` updates after `start` updates
+    */
+    enum class Averaging {None, EMA, SWA};
+
+    namespace Detail {
+        /*
+        * @brief: Gradient descent step `weights -= lr * step` followed by the averaging step
+        *         `averaged += beta * (weights - averaged)`, in one sweep: both are applied chunk by
+        *         chunk, so the second reads the new weights while they are still in cache
+        */
+        inline void averagedStep(float* weights, float* averaged, const float* step, Eigen::Index size,
+                                 float lr, float beta) {
+            constexpr Eigen::Index chunk = 1024;
+            for (Eigen::Index i = 0; i < size; i += chunk) {
+                Eigen::Index n = std::min(chunk, size - i);
+                Eigen::Map<ArrColX<float>> w(weights + i, n), avg(averaged + i, n);
+                Eigen::Map<const ArrColX<float>> s(step + i, n);
+                w -= lr * s;
+                avg += beta * (w - avg);
+            }
+        }
+    }
+
     /*
     * @brief: Encapsulates neural net linear layer as a self-contained unit
     * 
-    * Uses CRTP pattern for further specialization. Derived class must implement member
+    * Uses CRTP pattern for further specialization. Derived class must implement static member
     * functions `float activate(float)` and `float differentiate(float)`. The latter should
-    * be the derivative of the former
+    * be the derivative of the former. It must also define `constexpr static bool has_activation`,
+    * false iff `activate` is the identity (checked by `BatchNormLayer` before folding)
     * 
     * @tparam EigenType: Must be `Eigen::T<float, Eigen::Dynamic, Eigen::Dynamic>`
     * where `T` is `Array` or `Matrix`
@@ -23,14 +71,58 @@ namespace Neural {
     class LinearLayer {
     public:
         auto feedForward(const MatrixX_RowMajor_Ref<float>& inputs) {
-            auto aug_inputs = augmentOne(inputs);
+            return forward(inputs, weights);
+        }
 
-            auto signals = aug_inputs * weights;
-            auto outputs = signals.unaryExpr([this](float f) 
-                                             { return this->crtp_handle->activate(f); });
+        // Forward pass used by `FeedFwdNN::test`. Identical to `feedForward` unless an inference
+        // fold is registered, in which case the folded weights are used
+        auto feedForwardInference(const MatrixX_RowMajor_Ref<float>& inputs) {
+            return forward(inputs, inferenceWeights());
+        }
 
-            return std::make_pair(MatOrArray<EigenType>::eval(signals),
-                                  MatOrArray<EigenType>::eval(outputs));
+        // Weights used by `feedForwardInference`: member `weights`, or their fold if one is registered
+        const MatrixX_RowMajor<float>& inferenceWeights() {
+            if (!inference_fold) {
+                return weights;
+            }
+            if (inference_stale) {
+                inference_fold(weights, inference_weights);
+                inference_stale = false;
+            }
+            return inference_weights;
+        }
+
+        /*
+        * @brief: Registers @fold, computing the weights used at inference from member `weights`
+        *         (e.g. to absorb a following batch normalization). Folded weights are recomputed
+        *         lazily, on the first inference pass after `invalidateInference` or a weight update
+        */
+        void setInferenceFold(std::function<void(const MatrixX_RowMajor<float>&, MatrixX_RowMajor<float>&)> fold) {
+            inference_fold = std::move(fold);
+            inference_stale = true;
+        }
+
+        // Whether a fold is registered, i.e. `inferenceWeights` differ from member `weights`
+        bool inferenceFolded() const {
+            return (bool)inference_fold;
+        }
+
+        void invalidateInference() {
+            inference_stale = true;
+            transposed_stale = true;
+        }
+
+        Eigen::Index inputDim() const {
+            return in_dim;
+        }
+
+        Eigen::Index outputDim() const {
+            return out_dim;
+        }
+
+        // Weights augmented with the bias row (last row), `(in_dim + 1) x out_dim`
+        const MatrixX_RowMajor<float>& augmentedWeights() const {
+            return weights;
         }
 
         // To be used if instance is a hidden layer
@@ -39,8 +131,8 @@ namespace Neural {
                 auto diff_signals = signals.unaryExpr([this](float f)
                                                       { return this->crtp_handle->differentiate(f); });
 
-                auto gradient = diff_signals * tgradient; // Element-wise product
-                auto new_tgradient = transformGradient(diff_signals);
+                auto gradient = (diff_signals * tgradient).eval(); // Element-wise product
+                auto new_tgradient = transformGradient(gradient.matrix());
 
                 return std::make_pair(MatOrArray<EigenType>::eval(gradient), new_tgradient);
             }
@@ -58,28 +150,237 @@ namespace Neural {
                                   MatOrArray<EigenType>::eval(tgradient));
         }
         
-        // Updates member `weights` using gradient descent
+        // Updates member `weights` using gradient descent, and their average if tracked (see `setAveraging`)
         void updateWeights(const MatrixX_RowMajor_Ref<float>& inputs, const MatrixX_RowMajor_Ref<float>& gradient, float lr) {
-            auto aug_inputs = augmentOne(inputs);
-            auto step = lr * (aug_inputs.transpose() * gradient);
+            if (averaged_swapped) {
+                throw std::logic_error("cannot update while averaged weights are swapped in");
+            }
+            MatrixX_RowMajor<float> step = weightGradient(inputs, gradient);
 
-            weights -= step;
+            float beta = averagingRate();
+            if (beta > 0) {
+                Detail::averagedStep(weights.data(), averaged_weights.data(), step.data(), weights.size(), lr, beta);
+            }
+            else {
+                weights -= lr * step;
+            }
+            inference_stale = true;
+            transposed_stale = true;
 
             return;
         }
 
+        /*
+        * @brief: Tracks an average of the weights, updated by `updateWeights` in the same sweep as
+        *         the weights themselves. The average starts from the current weights
+        *
+        * @param decay: Decay rate of `Averaging::EMA`, in `[0, 1)`
+        * @param start, period: Snapshots of `Averaging::SWA` are taken every @period updates,
+        *                       once @start updates have passed
+        */
+        void setAveraging(Averaging mode, float decay = 0.999f, int start = 0, int period = 1) {
+            if (averaged_swapped) {
+                throw std::logic_error("cannot change averaging while averaged weights are swapped in");
+            }
+            if (decay < 0 || decay >= 1 || start < 0 || period < 1) {
+                throw std::invalid_argument("received invalid averaging parameters");
+            }
+            averaging = mode;
+            ema_decay = decay;
+            swa_start = start;
+            swa_period = period;
+            num_updates = 0;
+            num_snapshots = 0;
+            if (mode == Averaging::None) {
+                averaged_weights.resize(0, 0);
+            }
+            else {
+                averaged_weights = weights;
+            }
+        }
+
+        /*
+        * @brief: Exchanges the weights and their average (e.g. to evaluate the averaged model), by
+        *         swapping buffers rather than copying. Call again to swap the trained weights back
+        *         before the next update
+        */
+        void swapAveragedWeights() {
+            if (averaging == Averaging::None) {
+                throw std::logic_error("no averaged weights to swap in; see `setAveraging`");
+            }
+            weights.swap(averaged_weights);
+            averaged_swapped = !averaged_swapped;
+            inference_stale = true;
+            transposed_stale = true;
+        }
+
+        Averaging averagingMode() const {
+            return averaging;
+        }
+
+        bool averagedWeightsSwapped() const {
+            return averaged_swapped;
+        }
+
+        std::vector<ParamView> parameters() {
+            return { ParamView(weights.data(), weights.size()) };
+        }
+
+        /*
+        * @brief: Single-row forward pass used by `FeedFwdNN::partialFit`. Writes into @signals and
+        *         @outputs (of length `out_dim`) and allocates nothing
+        */
+        void forwardRow(const Eigen::Ref<const MatRowX<float>>& input, Eigen::Ref<MatRowX<float>> signals,
+                        Eigen::Ref<MatRowX<float>> outputs) {
+            signals.noalias() = input * weights.topRows(in_dim);
+            signals += weights.row(in_dim);
+            outputs = signals.unaryExpr([this](float f) { return this->crtp_handle->activate(f); });
+        }
+
+        // Single-row counterpart of `backPropagate`; @new_tgradient has length `in_dim`
+        void backwardRow(const Eigen::Ref<const MatRowX<float>>& signals, const Eigen::Ref<const MatRowX<float>>& tgradient,
+                         Eigen::Ref<MatRowX<float>> gradient, Eigen::Ref<MatRowX<float>> new_tgradient) {
+            gradient = signals.unaryExpr([this](float f) { return this->crtp_handle->differentiate(f); }).cwiseProduct(tgradient);
+            new_tgradient.noalias() = gradient * weights.topRows(in_dim).transpose();
+        }
+
+        /*
+        * @brief: Single-row counterpart of `updateWeights`: a rank-1 (GER) update applied row by row
+        *         of the weights, fused with the averaging step if tracked. Allocates nothing
+        */
+        void updateRow(const Eigen::Ref<const MatRowX<float>>& input, const Eigen::Ref<const MatRowX<float>>& gradient, float lr) {
+            if (averaged_swapped) {
+                throw std::logic_error("cannot update while averaged weights are swapped in");
+            }
+            float beta = averagingRate();
+            for (Eigen::Index i = 0; i <= in_dim; i++) {
+                float scale = lr * (i < in_dim ? input(i) : 1.0f);
+                weights.row(i) -= scale * gradient;
+                if (beta > 0) {
+                    averaged_weights.row(i) += beta * (weights.row(i) - averaged_weights.row(i));
+                }
+            }
+            inference_stale = true;
+            transposed_stale = true;
+        }
+
+        // Restricts the last forward pass to @rows (see `FeedFwdNN::trainSelective`). No per-row state
+        // is kept between passes, so there is nothing to compact
+        void selectRows(const MatColX<int>&) {}
+
+        // Gradients wrt `parameters()`, laid out alike; @inputs and @gradient as in `updateWeights`
+        std::vector<MatColX<float>> parameterGradients(const MatrixX_RowMajor_Ref<float>& inputs,
+                                                       const MatrixX_RowMajor_Ref<float>& gradient) {
+            MatrixX_RowMajor<float> weight_gradient = weightGradient(inputs, gradient);
+            return { Eigen::Map<MatColX<float>>(weight_gradient.data(), weight_gradient.size()) };
+        }
+
     protected:
+        // Draws weights (bias row included) uniformly from [-@max_weight, @max_weight). Weights are a
+        // function of (@seed, @stream) only: give layers sharing a seed distinct streams (e.g. their
+        // position in the network) for them to get distinct weights
         LinearLayer(Eigen::Index in_dim, Eigen::Index out_dim, float max_weight,
-                    int seed = 42) : in_dim(in_dim), out_dim(out_dim), max_weight(max_weight),
-                                     crtp_handle(static_cast<Impl<EigenType>*>(this))
+                    std::uint64_t stream, int seed = 42) : in_dim(in_dim), out_dim(out_dim), max_weight(max_weight),
+                                                           crtp_handle(static_cast<Impl<EigenType>*>(this))
+        {
+            weights.resize(in_dim + 1, out_dim);
+            Philox(seed, stream).fillUniform(weights, -max_weight, max_weight);
+        }
+
+        // Initializes weights according to scheme @init; member `max_weight` is set to the
+        // resulting bound (uniform schemes) or standard deviation (normal schemes)
+        LinearLayer(Eigen::Index in_dim, Eigen::Index out_dim, Init init,
+                    std::uint64_t stream, int seed = 42) : in_dim(in_dim), out_dim(out_dim),
+                                                           crtp_handle(static_cast<Impl<EigenType>*>(this))
         {
-            std::srand(seed);
-            weights = (max_weight * MatrixX_RowMajor<float>::Random(in_dim + 1, out_dim)).eval();
+            float fan_avg = 0.5f * (float)(in_dim + out_dim);
+            float variance = (init == Init::XavierUniform || init == Init::XavierNormal) ? 1.0f / fan_avg
+                                                                                       : 2.0f / (float)in_dim;
+            Philox rng(seed, stream);
+            weights.resize(in_dim + 1, out_dim);
+
+            if (init == Init::XavierUniform || init == Init::HeUniform) {
+                max_weight = std::sqrt(3.0f * variance);
+                rng.fillUniform(weights, -max_weight, max_weight);
+            }
+            else {
+                max_weight = std::sqrt(variance);
+                rng.fillNormal(weights, 0.0, max_weight);
+            }
+            weights.row(in_dim).setZero();
         }
         
-        // Used in backpropagation step
+        // Sparse @inputs (e.g. indicator features stored dense) are compressed and multiplied with a
+        // sparse-dense kernel, see `SparseKernels::forward_density_threshold`
+        auto forward(const MatrixX_RowMajor_Ref<float>& inputs, const MatrixX_RowMajor<float>& layer_weights) {
+            MatrixX_RowMajor<float> signals(inputs.rows(), out_dim);
+            if (SparseKernels::sparseEnough(inputs, SparseKernels::forward_density_threshold)) {
+                SparseKernels::product(SparseKernels::compress(inputs), layer_weights.topRows(in_dim), signals);
+                signals.rowwise() += layer_weights.row(in_dim);
+            }
+            else {
+                signals.noalias() = augmentOne(inputs) * layer_weights;
+            }
+
+            auto outputs = signals.unaryExpr([this](float f) 
+                                             { return this->crtp_handle->activate(f); });
+
+            return std::make_pair(MatOrArray<EigenType>::eval(signals),
+                                  MatOrArray<EigenType>::eval(outputs));
+        }
+
+        // Used in backpropagation step. A sparse @gradient (e.g. masked by a ReLU derivative) is
+        // multiplied with a sparse-dense kernel, see `SparseKernels::density_threshold`
         auto transformGradient(const MatrixX_RowMajor_Ref<float>& gradient) {
-            return MatOrArray<EigenType>::eval(gradient * weights(Eigen::seq(0, Eigen::last-1), Eigen::all).transpose());
+            MatrixX_RowMajor<float> new_tgradient(gradient.rows(), in_dim);
+            if (SparseKernels::sparseEnough(gradient, SparseKernels::density_threshold)) {
+                SparseKernels::product(SparseKernels::compress(gradient), transposedWeights(), new_tgradient);
+            }
+            else {
+                new_tgradient.noalias() = gradient * weights(Eigen::seq(0, Eigen::last-1), Eigen::all).transpose();
+            }
+            return MatOrArray<EigenType>::eval(new_tgradient);
+        }
+
+        /*
+        * @brief: `weights.topRows(in_dim)^T`, the row-major operand of the sparse kernel of
+        *         `transformGradient`. Kept between backward passes and rebuilt on the first one after
+        *         a weight update or `invalidateInference`, so that passes sharing weights (e.g. the
+        *         two half-batch gradients of `GrowingBatchTrainer`) transpose them once
+        */
+        const MatrixX_RowMajor<float>& transposedWeights() {
+            if (transposed_stale) {
+                transposed_weights = weights.topRows(in_dim).transpose();
+                transposed_stale = false;
+            }
+            return transposed_weights;
+        }
+
+        // Gradient wrt member `weights`, `aug_inputs^T * gradient`. Sparse @inputs (e.g. outputs of a
+        // ReLU layer) skip their zeros, see `SparseKernels::density_threshold`
+        MatrixX_RowMajor<float> weightGradient(const MatrixX_RowMajor_Ref<float>& inputs, const MatrixX_RowMajor_Ref<float>& gradient) {
+            if (SparseKernels::sparseEnough(inputs, SparseKernels::density_threshold)) {
+                MatrixX_RowMajor<float> weight_gradient(in_dim + 1, out_dim);
+                SparseKernels::transposedProduct(SparseKernels::compress(inputs), gradient, weight_gradient);
+                weight_gradient.row(in_dim) = gradient.colwise().sum();
+                return weight_gradient;
+            }
+            return augmentOne(inputs).transpose() * gradient;
+        }
+
+        // Rate of the averaging step of the current update, zero if none is due. Counts the update
+        float averagingRate() {
+            if (averaging == Averaging::None) {
+                return 0.0f;
+            }
+            int update = num_updates++;
+            if (averaging == Averaging::EMA) {
+                return 1.0f - ema_decay;
+            }
+            if (update + 1 < swa_start || (update + 1 - swa_start) % swa_period != 0) {
+                return 0.0f;
+            }
+            return 1.0f / (float)(++num_snapshots);
         }
 
         // Adds column of ones (bias column)
@@ -103,6 +404,21 @@ namespace Neural {
 
         float max_weight;
 
+        std::function<void(const MatrixX_RowMajor<float>&, MatrixX_RowMajor<float>&)> inference_fold;
+        MatrixX_RowMajor<float> inference_weights;
+        bool inference_stale = true;
+
+        MatrixX_RowMajor<float> transposed_weights;
+        bool transposed_stale = true;
+
+        Averaging averaging = Averaging::None;
+        MatrixX_RowMajor<float> averaged_weights;
+        bool averaged_swapped = false;
+        float ema_decay = 0.999f;
+        int swa_start = 0;
+        int swa_period = 1;
+        int num_updates = 0;
+        int num_snapshots = 0;
 
     private:
         Impl<EigenType>* crtp_handle;
@@ -123,14 +439,55 @@ namespace Neural {
     class PlainLinearLayer : public LinearLayer<EigenType, PlainLinearLayerImpl> {
     public:
         PlainLinearLayer(Eigen::Index in_dim, Eigen::Index out_dim, float max_weight,
-                         int seed = 42) : LinearLayer<EigenType, PlainLinearLayerImpl>(in_dim, out_dim,
-                                                                                       max_weight, seed) {}
-        float activate(float f) {
+                         std::uint64_t stream, int seed = 42) :
+            LinearLayer<EigenType, PlainLinearLayerImpl>(in_dim, out_dim, max_weight, stream, seed) {}
+
+        PlainLinearLayer(Eigen::Index in_dim, Eigen::Index out_dim, Init init,
+                         std::uint64_t stream, int seed = 42) :
+            LinearLayer<EigenType, PlainLinearLayerImpl>(in_dim, out_dim, init, stream, seed) {}
+
+        constexpr static bool has_activation = false;
+
+        static float activate(float f) {
             return f;
         }
 
-        float differentiate(float f) {
+        static float differentiate(float f) {
             return 1.0;
         }
     };
+
+    // Forward decl.
+    template <typename EigenType>
+    class ReLULinearLayer;
+
+    template <typename EigenType>
+    using ReLULinearLayerImpl = ReLULinearLayer<EigenType>;
+
+    /*
+    * @brief Implements linear layer with ReLU activation. Inherits from class `LinearLayer`, using
+    * CRTP pattern. Its outputs and gradients are mostly zeros, which the backward pass of this and
+    * the next layer exploit (see `SparseKernels::density_threshold`). Best initialized with He schemes
+    */
+    template <typename EigenType>
+    class ReLULinearLayer : public LinearLayer<EigenType, ReLULinearLayerImpl> {
+    public:
+        ReLULinearLayer(Eigen::Index in_dim, Eigen::Index out_dim, float max_weight,
+                        std::uint64_t stream, int seed = 42) :
+            LinearLayer<EigenType, ReLULinearLayerImpl>(in_dim, out_dim, max_weight, stream, seed) {}
+
+        ReLULinearLayer(Eigen::Index in_dim, Eigen::Index out_dim, Init init,
+                        std::uint64_t stream, int seed = 42) :
+            LinearLayer<EigenType, ReLULinearLayerImpl>(in_dim, out_dim, init, stream, seed) {}
+
+        constexpr static bool has_activation = true;
+
+        static float activate(float f) {
+            return f > 0.0f ? f : 0.0f;
+        }
+
+        static float differentiate(float f) {
+            return f > 0.0f ? 1.0f : 0.0f;
+        }
+    };
 }
@@ -0,0 +1,209 @@
+// lbfgs.h: Contains facilities implementing the L-BFGS quasi-Newton optimizer
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+
+namespace Neural {
+    /*
+    * @brief: Settings of `LBFGS`
+    *
+    * `history`: number of curvature pairs kept to approximate the inverse Hessian
+    * `gradient_tolerance`: stops once the largest gradient entry falls below it
+    * `loss_tolerance`: stops once an iteration decreases the loss by less than this fraction
+    * `wolfe_c1`, `wolfe_c2`: sufficient decrease and curvature constants of the strong Wolfe
+    *                         conditions (`0 < c1 < c2 < 1`)
+    */
+    struct LBFGSOptions {
+        int history = 10;
+        int max_iterations = 100;
+        float gradient_tolerance = 1e-5f;
+        float loss_tolerance = 1e-7f;
+        float wolfe_c1 = 1e-4f;
+        float wolfe_c2 = 0.9f;
+        int max_line_search_evaluations = 25;
+    };
+
+    struct LBFGSReport {
+        int iterations = 0;
+        int evaluations = 0; // Loss and gradient evaluations, line searches included
+        float initial_loss = 0;
+        float loss = 0;
+        float gradient_norm = 0; // Largest absolute gradient entry at the solution
+        bool converged = false;  // False if stopped by `max_iterations` or a failed line search
+    };
+
+    /*
+    * @brief: Limited-memory BFGS over a flat parameter vector, with a line search enforcing the
+    *         strong Wolfe conditions (Nocedal & Wright, algorithms 7.4, 3.5 and 3.6). Suited to
+    *         deterministic (full-batch) objectives
+    */
+    class LBFGS {
+    public:
+        // Returns the loss at its first argument and writes the gradient there to its second
+        using Objective = std::function<float(const MatColX<float>&, MatColX<float>&)>;
+
+        explicit LBFGS(LBFGSOptions options = {}) : options(options) {}
+
+        // Minimizes @objective starting from @x, which holds the solution on return
+        LBFGSReport minimize(const Objective& objective, MatColX<float>& x) const {
+            LBFGSReport report;
+            MatColX<float> gradient(x.size());
+            float loss = objective(x, gradient);
+            report.evaluations = 1;
+            report.initial_loss = loss;
+
+            std::deque<MatColX<float>> s_history, y_history;
+            std::deque<double> rho_history;
+            MatColX<float> x_next(x.size()), gradient_next(x.size());
+
+            while (report.iterations < options.max_iterations) {
+                if (gradient.size() == 0 || gradient.cwiseAbs().maxCoeff() <= options.gradient_tolerance) {
+                    report.converged = true;
+                    break;
+                }
+
+                MatColX<float> direction = -twoLoop(gradient, s_history, y_history, rho_history);
+                double slope = direction.dot(gradient);
+                if (slope >= 0) {
+                    // Not a descent direction (numerical noise): restart from steepest descent
+                    s_history.clear(); y_history.clear(); rho_history.clear();
+                    direction = -gradient;
+                    slope = direction.dot(gradient);
+                }
+
+                // The first step has no curvature information for its scale
+                double initial_step = s_history.empty() ? std::min(1.0, 1.0 / (double)gradient.norm()) : 1.0;
+                float loss_next;
+                if (!lineSearch(objective, x, loss, slope, direction, initial_step, x_next, loss_next,
+                                gradient_next, report.evaluations)) {
+                    break;
+                }
+                report.iterations++;
+
+                MatColX<float> s = x_next - x, y = gradient_next - gradient;
+                double sy = s.dot(y);
+                if (sy > 1e-10 * (double)s.norm() * (double)y.norm()) {
+                    if ((int)s_history.size() == options.history) {
+                        s_history.pop_front(); y_history.pop_front(); rho_history.pop_front();
+                    }
+                    s_history.push_back(s);
+                    y_history.push_back(y);
+                    rho_history.push_back(1.0 / sy);
+                }
+
+                float decrease = loss - loss_next;
+                x.swap(x_next);
+                gradient.swap(gradient_next);
+                loss = loss_next;
+                if (decrease <= options.loss_tolerance * std::max(1.0f, std::abs(loss))) {
+                    report.converged = true;
+                    break;
+                }
+            }
+
+            report.loss = loss;
+            report.gradient_norm = gradient.size() > 0 ? gradient.cwiseAbs().maxCoeff() : 0.0f;
+            return report;
+        }
+
+    private:
+        // Product of the inverse Hessian approximation with @gradient
+        static MatColX<float> twoLoop(const MatColX<float>& gradient, const std::deque<MatColX<float>>& s_history,
+                                      const std::deque<MatColX<float>>& y_history, const std::deque<double>& rho_history) {
+            MatColX<float> q = gradient;
+            std::vector<double> alpha(s_history.size());
+            for (int i = (int)s_history.size() - 1; i >= 0; i--) {
+                alpha[i] = rho_history[i] * s_history[i].dot(q);
+                q -= (float)alpha[i] * y_history[i];
+            }
+            if (!s_history.empty()) {
+                const MatColX<float>& y = y_history.back();
+                q *= (float)(1.0 / (rho_history.back() * (double)y.squaredNorm()));
+            }
+            for (int i = 0; i < (int)s_history.size(); i++) {
+                double beta = rho_history[i] * y_history[i].dot(q);
+                q += (float)(alpha[i] - beta) * s_history[i];
+            }
+            return q;
+        }
+
+        /*
+        * @brief: Finds a step along @direction satisfying the strong Wolfe conditions. On success,
+        *         writes the new point, its loss and gradient to @x_next, @loss_next, @gradient_next
+        */
+        bool lineSearch(const Objective& objective, const MatColX<float>& x, float loss, double slope,
+                        const MatColX<float>& direction, double step, MatColX<float>& x_next, float& loss_next,
+                        MatColX<float>& gradient_next, int& evaluations) const {
+            const double c1 = options.wolfe_c1, c2 = options.wolfe_c2;
+            double step_prev = 0, loss_prev = loss, slope_prev = slope;
+
+            auto evaluate = [&](double a, double& slope_a) {
+                x_next = x + (float)a * direction;
+                loss_next = objective(x_next, gradient_next);
+                evaluations++;
+                slope_a = direction.dot(gradient_next);
+                return (double)loss_next;
+            };
+
+            // Shrinks the bracket [lo, hi] until a step satisfies both conditions
+            auto zoom = [&](double lo, double loss_lo, double slope_lo, double hi, double loss_hi, int budget) {
+                for (; budget > 0; budget--) {
+                    // Minimizer of the quadratic interpolating loss_lo, slope_lo and loss_hi, kept
+                    // away from the bracket ends; bisection otherwise
+                    double width = hi - lo;
+                    double denom = 2.0 * (loss_hi - loss_lo - slope_lo * width);
+                    double a = denom > 0 ? lo - slope_lo * width * width / denom : lo + 0.5 * width;
+                    double margin = 0.1 * std::abs(width);
+                    a = std::clamp(a, std::min(lo, hi) + margin, std::max(lo, hi) - margin);
+
+                    double slope_a, loss_a = evaluate(a, slope_a);
+                    if (loss_a > loss + c1 * a * slope || loss_a >= loss_lo) {
+                        hi = a;
+                        loss_hi = loss_a;
+                    }
+                    else {
+                        if (std::abs(slope_a) <= -c2 * slope) {
+                            return true;
+                        }
+                        if (slope_a * (hi - lo) >= 0) {
+                            hi = lo;
+                            loss_hi = loss_lo;
+                        }
+                        lo = a;
+                        loss_lo = loss_a;
+                        slope_lo = slope_a;
+                    }
+                }
+                return false;
+            };
+
+            for (int i = 0; i < options.max_line_search_evaluations; i++) {
+                double slope_a, loss_a = evaluate(step, slope_a);
+                int budget = options.max_line_search_evaluations - i - 1;
+                if (!std::isfinite(loss_a) || loss_a > loss + c1 * step * slope || (i > 0 && loss_a >= loss_prev)) {
+                    return zoom(step_prev, loss_prev, slope_prev, step, std::isfinite(loss_a) ? loss_a : std::numeric_limits<double>::max(), budget);
+                }
+                if (std::abs(slope_a) <= -c2 * slope) {
+                    return true;
+                }
+                if (slope_a >= 0) {
+                    return zoom(step, loss_a, slope_a, step_prev, loss_prev, budget);
+                }
+                step_prev = step;
+                loss_prev = loss_a;
+                slope_prev = slope_a;
+                step *= 2;
+            }
+            return false;
+        }
+
+        LBFGSOptions options;
+    };
+}
@@ -1,6 +1,7 @@
 // loss.h: Contains facilities implementing loss functions for use in neural networks
 
 #pragma once
+#include <stdexcept>
 #include <Eigen/Core>
 #include "../utilities/types.h"
 #include "../utilities/paral.h"
@@ -18,20 +19,31 @@ namespace Neural {
     *
     * @param outputs: Outputs of output layer of network
     * @param one_hot_labels: One-hot-shot encoded labels
+    * @param row_weights: If given, weights of the rows in the cross-entropy and its gradient (e.g.
+    *                     importance weights); the misclassification stays unweighted
+    * @param sample_losses: If given, receives the (unweighted) cross-entropy of every row
     * @return: `std::pair<std::pair<float, float>, MatrixX_RowMajor<float>>` where
     *          floats are cross-entropy and misclassification resp. and 
                `MatrixX_RowMajor<float>` is the gradient of the categorical cross-entropy
                loss wrt the incoming signals (assuming no activation function)
     */
     static auto _softMaxLoss(const Eigen::Ref<const MatrixX_RowMajor<float>>& outputs,
-                             const Eigen::Ref<const MatrixX_RowMajor<bool>>& one_hot_labels) {
+                             const Eigen::Ref<const MatrixX_RowMajor<bool>>& one_hot_labels,
+                             const ArrColX<float>* row_weights = nullptr,
+                             ArrColX<float>* sample_losses = nullptr) {
         auto num_rows = one_hot_labels.rows();
+        if (row_weights && row_weights->size() != num_rows) {
+            throw std::invalid_argument("size of @row_weights does not match number of rows");
+        }
         auto& labels_float = one_hot_labels.template cast<float>();
         auto softmaxed = softMax(outputs, Ax::One);
         
         auto probs = (softmaxed.array() * labels_float.array()).rowwise().sum();
-        auto logits = probs.unaryExpr(std::ref(myLog));
-        float cross_entropy = (-1.0 / (float)num_rows) * logits.sum();
+        ArrColX<float> logits = probs.unaryExpr(std::ref(myLog));
+        float cross_entropy = (-1.0 / (float)num_rows) * (row_weights ? (logits * *row_weights).sum() : logits.sum());
+        if (sample_losses) {
+            *sample_losses = -logits;
+        }
         
         ArrayX_RowMajor<int> max_col = ArrayX_RowMajor<int>(num_rows, 1);
         rangeParExec(
@@ -46,9 +58,12 @@ namespace Neural {
         auto indices_labels = Labels::toIndicesLabels(one_hot_labels);
         float misclas = (1.0 / (float)num_rows)*((max_col != indices_labels.array()).template cast<float>().sum());
 
-        auto gradient = (1.0 / num_rows) * (softmaxed - labels_float);
+        MatrixX_RowMajor<float> gradient = (1.0 / num_rows) * (softmaxed - labels_float);
+        if (row_weights) {
+            gradient.array().colwise() *= *row_weights;
+        }
 
-        return std::make_pair(std::make_pair(cross_entropy, misclas),  gradient.eval());
+        return std::make_pair(std::make_pair(cross_entropy, misclas),  gradient);
     }
 
     // Versions surfaced to client; honor `Eigen::Array` or `Eigen::Matrix` depending
@@ -56,14 +71,16 @@ namespace Neural {
 
     template<typename Derived_1, typename Derived_2>
     auto softMaxLoss(const Eigen::MatrixBase<Derived_1>& outputs, 
-                     const Eigen::MatrixBase<Derived_2>& one_hot_labels) {
-        return _softMaxLoss(outputs, one_hot_labels);
+                     const Eigen::MatrixBase<Derived_2>& one_hot_labels,
+                     const ArrColX<float>* row_weights = nullptr, ArrColX<float>* sample_losses = nullptr) {
+        return _softMaxLoss(outputs, one_hot_labels, row_weights, sample_losses);
     }
 
     template<typename Derived_1, typename Derived_2>
     auto softMaxLoss(const Eigen::ArrayBase<Derived_1>& outputs,
-                     const Eigen::ArrayBase<Derived_2>& one_hot_labels) {
-        auto pair = _softMaxLoss(outputs, one_hot_labels);
+                     const Eigen::ArrayBase<Derived_2>& one_hot_labels,
+                     const ArrColX<float>* row_weights = nullptr, ArrColX<float>* sample_losses = nullptr) {
+        auto pair = _softMaxLoss(outputs, one_hot_labels, row_weights, sample_losses);
         return std::make_pair(pair.first, pair.second.array().eval());
     }
 }
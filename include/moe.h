@@ -0,0 +1,297 @@
+// moe.h: Contains facilities for constructing mixture-of-experts layers
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/traits_concepts.h"
+#include "../utilities/paral.h"
+#include "../utilities/random.h"
+#include "layers.h"
+
+namespace Neural {
+    /*
+    * @brief: Load-balancing statistics of the last forward pass of a `MoELayer`
+    *
+    * `counts[e]`: rows routed to expert `e` (each row counts once per selected expert)
+    * `importance[e]`: mean gate probability of expert `e` over the batch (full softmax)
+    * `balance_loss`: Switch-Transformer auxiliary loss `E * sum_e fraction_e * importance_e`,
+    *                 equal to 1 under perfectly uniform routing
+    * `count_cv`: coefficient of variation of `counts`
+    */
+    struct MoEStats {
+        std::vector<Eigen::Index> counts;
+        std::vector<float> importance;
+        float balance_loss = 0;
+        float count_cv = 0;
+    };
+
+    /*
+    * @brief: Encapsulates a mixture-of-experts layer with top-k sparse routing
+    *
+    * A gating `PlainLinearLayer` scores all experts per row; each row is sent to its @top_k best
+    * experts, weighted by the softmax of their scores. Rows are then bucketed per expert into
+    * dense sub-batches, every active expert runs a single GEMM on its bucket in parallel, and
+    * results are scattered back and combined. The backward pass and the update only touch
+    * experts that received rows. Experts are affine maps (bias row last, like `LinearLayer`).
+    *
+    * Optionally adds @balance_coef times the auxiliary load-balancing loss (see `MoEStats`) to
+    * the gating gradient.
+    *
+    * @tparam EigenType: Must be `Eigen::T<float, Eigen::Dynamic, Eigen::Dynamic>`
+    * where `T` is `Array` or `Matrix`
+    */
+    template <typename EigenType>
+    class MoELayer {
+    public:
+        MoELayer(Eigen::Index in_dim, Eigen::Index out_dim, Eigen::Index num_experts, std::uint64_t stream,
+                 Eigen::Index top_k = 2, float balance_coef = 0.0, int seed = 42) :
+            in_dim(in_dim), out_dim(out_dim), num_experts(num_experts), top_k(top_k), balance_coef(balance_coef),
+            gate(in_dim, num_experts, Init::XavierUniform, Philox::substream(stream, num_experts), seed)
+        {
+            if (in_dim <= 0 || out_dim <= 0 || num_experts <= 0 || top_k <= 0 || top_k > num_experts) {
+                throw std::invalid_argument("received invalid dimensions or @top_k");
+            }
+            float bound = std::sqrt(6.0f / (float)(in_dim + out_dim));
+            experts.resize(num_experts);
+            for (Eigen::Index e = 0; e < num_experts; e++) {
+                auto& expert = experts[e];
+                expert.resize(in_dim + 1, out_dim);
+                Philox(seed, Philox::substream(stream, e)).fillUniform(expert, -bound, bound);
+                expert.row(in_dim).setZero();
+            }
+        }
+
+        auto feedForward(const MatrixX_RowMajor_Ref<float>& inputs) {
+            if (inputs.cols() != in_dim) {
+                throw std::invalid_argument("number of columns of @inputs does not match layer");
+            }
+            const Eigen::Index num_rows = inputs.rows();
+            gate_signals = gate.feedForward(inputs).first;
+            route(num_rows);
+
+            // Dense sub-batch GEMM per active expert
+            expert_outputs.assign(num_experts, MatrixX_RowMajor<float>());
+            rangeParExec(
+                num_experts,
+                [&](int& e) {
+                    if (!buckets[e].empty()) {
+                        expert_outputs[e] = affine(gather(inputs, buckets[e]), experts[e]);
+                    }
+                }
+            );
+
+            // Combine per row; rows are independent
+            MatrixX_RowMajor<float> outputs = MatrixX_RowMajor<float>::Zero(num_rows, out_dim);
+            rangeParExec(
+                num_rows,
+                [&](int& r) {
+                    for (Eigen::Index s = 0; s < top_k; s++) {
+                        const Slot& slot = slots[r * top_k + s];
+                        outputs.row(r) += slot.weight * expert_outputs[slot.expert].row(slot.position);
+                    }
+                }
+            );
+
+            auto outputs_eval = MatOrArray<EigenType>::eval(outputs);
+            return std::make_pair(outputs_eval, outputs_eval);
+        }
+
+        // Returns @tgradient (gradient wrt the layer's outputs) and the gradient wrt its inputs
+        auto backPropagate(const ArrayX_RowMajor_Ref<float>& signals,
+                           const ArrayX_RowMajor_Ref<float>& tgradient) {
+            const Eigen::Index num_rows = tgradient.rows();
+            if (num_rows * top_k != (Eigen::Index)slots.size() || tgradient.cols() != out_dim) {
+                throw std::invalid_argument("shape of @tgradient does not match last forward pass");
+            }
+
+            // Gradient wrt each active expert's outputs: gate weight times row gradient
+            expert_gradients.assign(num_experts, MatrixX_RowMajor<float>());
+            std::vector<MatrixX_RowMajor<float>> expert_tgradients(num_experts);
+            rangeParExec(
+                num_experts,
+                [&](int& e) {
+                    if (buckets[e].empty()) {
+                        return;
+                    }
+                    MatrixX_RowMajor<float>& grad = expert_gradients[e];
+                    grad.resize(buckets[e].size(), out_dim);
+                    for (Eigen::Index j = 0; j < (Eigen::Index)buckets[e].size(); j++) {
+                        const Slot& slot = slots[bucket_slots[e][j]];
+                        grad.row(j) = slot.weight * tgradient.row(buckets[e][j]).matrix();
+                    }
+                    expert_tgradients[e].noalias() = grad * experts[e].topRows(in_dim).transpose();
+                }
+            );
+
+            // Gating: gradient wrt the selected logits through the top-k softmax
+            MatrixX_RowMajor<float> logit_gradient = MatrixX_RowMajor<float>::Zero(num_rows, num_experts);
+            MatrixX_RowMajor<float> new_tgradient = MatrixX_RowMajor<float>::Zero(num_rows, in_dim);
+            rangeParExec(
+                num_rows,
+                [&](int& r) {
+                    float weighted_sum = 0;
+                    std::vector<float> weight_grads(top_k);
+                    for (Eigen::Index s = 0; s < top_k; s++) {
+                        const Slot& slot = slots[r * top_k + s];
+                        weight_grads[s] = tgradient.row(r).matrix().dot(expert_outputs[slot.expert].row(slot.position));
+                        weighted_sum += slot.weight * weight_grads[s];
+                        new_tgradient.row(r) += expert_tgradients[slot.expert].row(slot.position);
+                    }
+                    for (Eigen::Index s = 0; s < top_k; s++) {
+                        const Slot& slot = slots[r * top_k + s];
+                        logit_gradient(r, slot.expert) = slot.weight * (weight_grads[s] - weighted_sum);
+                    }
+                }
+            );
+
+            if (balance_coef > 0) {
+                addBalanceGradient(logit_gradient);
+            }
+
+            auto gate_pair = gate.backPropagate(gate_signals.array(), logit_gradient.array());
+            gate_gradient = gate_pair.first;
+            new_tgradient += gate_pair.second;
+
+            return std::make_pair(MatOrArray<EigenType>::eval(tgradient.matrix()),
+                                  MatOrArray<EigenType>::eval(new_tgradient));
+        }
+
+        // Applies the gradients of the last `backPropagate` to the gate and the active experts.
+        // @inputs must be the inputs of the last forward pass; @gradient is unused
+        void updateWeights(const MatrixX_RowMajor_Ref<float>& inputs, const MatrixX_RowMajor_Ref<float>&, float lr) {
+            gate.updateWeights(inputs, gate_gradient, lr);
+            rangeParExec(
+                num_experts,
+                [&](int& e) {
+                    if (buckets[e].empty()) {
+                        return;
+                    }
+                    MatrixX_RowMajor<float> bucket_inputs = gather(inputs, buckets[e]);
+                    experts[e].topRows(in_dim).noalias() -= lr * (bucket_inputs.transpose() * expert_gradients[e]);
+                    experts[e].row(in_dim) -= lr * expert_gradients[e].colwise().sum();
+                }
+            );
+
+            return;
+        }
+
+        const MoEStats& loadStats() const {
+            return stats;
+        }
+
+    private:
+        struct Slot {
+            Eigen::Index expert;
+            Eigen::Index position; // Row within the expert's bucket
+            float weight;
+        };
+
+        // Picks the top-k experts of every row and fills `slots`, `buckets` and `stats`
+        void route(Eigen::Index num_rows) {
+            slots.resize(num_rows * top_k);
+            probabilities.resize(num_rows, num_experts);
+
+            rangeParExec(
+                num_rows,
+                [&](int& r) {
+                    auto logits = gate_signals.row(r);
+                    float max_logit = logits.maxCoeff();
+                    probabilities.row(r) = (logits.array() - max_logit).exp().matrix();
+                    probabilities.row(r) /= probabilities.row(r).sum();
+
+                    std::vector<Eigen::Index> order(num_experts);
+                    std::iota(order.begin(), order.end(), 0);
+                    std::partial_sort(order.begin(), order.begin() + top_k, order.end(),
+                                      [&](Eigen::Index a, Eigen::Index b) { return logits(a) > logits(b); });
+
+                    // Softmax restricted to the selected experts
+                    float total = 0;
+                    for (Eigen::Index s = 0; s < top_k; s++) {
+                        total += probabilities(r, order[s]);
+                    }
+                    for (Eigen::Index s = 0; s < top_k; s++) {
+                        slots[r * top_k + s] = Slot{ order[s], 0, probabilities(r, order[s]) / total };
+                    }
+                }
+            );
+
+            buckets.assign(num_experts, std::vector<Eigen::Index>());
+            bucket_slots.assign(num_experts, std::vector<Eigen::Index>());
+            for (Eigen::Index i = 0; i < (Eigen::Index)slots.size(); i++) {
+                Slot& slot = slots[i];
+                slot.position = buckets[slot.expert].size();
+                buckets[slot.expert].push_back(i / top_k);
+                bucket_slots[slot.expert].push_back(i);
+            }
+
+            stats.counts.resize(num_experts);
+            stats.importance.resize(num_experts);
+            MatRowX<float> importance = probabilities.colwise().mean();
+            float mean_count = (float)(num_rows * top_k) / (float)num_experts, var_count = 0;
+            stats.balance_loss = 0;
+            for (Eigen::Index e = 0; e < num_experts; e++) {
+                stats.counts[e] = buckets[e].size();
+                stats.importance[e] = importance(e);
+                stats.balance_loss += (float)buckets[e].size() / (float)(num_rows * top_k) * importance(e);
+                var_count += ((float)buckets[e].size() - mean_count) * ((float)buckets[e].size() - mean_count);
+            }
+            stats.balance_loss *= (float)num_experts;
+            stats.count_cv = mean_count > 0 ? std::sqrt(var_count / (float)num_experts) / mean_count : 0.0f;
+        }
+
+        // Gradient of `balance_coef * balance_loss` wrt the logits, through the full softmax
+        // (routing fractions are treated as constants)
+        void addBalanceGradient(MatrixX_RowMajor<float>& logit_gradient) const {
+            const Eigen::Index num_rows = probabilities.rows();
+            MatRowX<float> coeffs(num_experts);
+            for (Eigen::Index e = 0; e < num_experts; e++) {
+                coeffs(e) = balance_coef * (float)num_experts * (float)stats.counts[e]
+                            / (float)(num_rows * top_k) / (float)num_rows;
+            }
+            ArrColX<float> mixed = probabilities * coeffs.transpose();
+            logit_gradient.array() += probabilities.array() * (coeffs.array().replicate(num_rows, 1).colwise() - mixed);
+        }
+
+        static MatrixX_RowMajor<float> gather(const MatrixX_RowMajor_Ref<float>& inputs, const std::vector<Eigen::Index>& rows) {
+            MatrixX_RowMajor<float> gathered(rows.size(), inputs.cols());
+            for (Eigen::Index j = 0; j < (Eigen::Index)rows.size(); j++) {
+                gathered.row(j) = inputs.row(rows[j]);
+            }
+            return gathered;
+        }
+
+        MatrixX_RowMajor<float> affine(const MatrixX_RowMajor<float>& x, const MatrixX_RowMajor<float>& weights) const {
+            MatrixX_RowMajor<float> y = x * weights.topRows(in_dim);
+            y.rowwise() += weights.row(in_dim);
+            return y;
+        }
+
+        Eigen::Index in_dim;
+        Eigen::Index out_dim;
+        Eigen::Index num_experts;
+        Eigen::Index top_k;
+        float balance_coef;
+
+        PlainLinearLayer<MatrixX_RowMajor<float>> gate;
+        std::vector<MatrixX_RowMajor<float>> experts;
+
+        // Routing of last forward pass
+        MatrixX_RowMajor<float> gate_signals;
+        MatrixX_RowMajor<float> probabilities;
+        std::vector<Slot> slots;                              // `top_k` per row
+        std::vector<std::vector<Eigen::Index>> buckets;       // Input rows per expert
+        std::vector<std::vector<Eigen::Index>> bucket_slots;  // Matching indices into `slots`
+        std::vector<MatrixX_RowMajor<float>> expert_outputs;
+        MoEStats stats;
+
+        // Gradients of last backward pass
+        std::vector<MatrixX_RowMajor<float>> expert_gradients;
+        MatrixX_RowMajor<float> gate_gradient;
+    };
+}
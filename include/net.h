@@ -1,12 +1,24 @@
 // net.h: Contains facilities for the construction of feedforward neural networks
 
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
 #include <tuple>
 #include <functional>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 #include <Eigen/Core>
 #include "../utilities/types.h"
 #include "layers.h"
 #include "loss.h"
+#include "lbfgs.h"
+#include "optim.h"
+#include "snapshot.h"
+#include "telemetry.h"
 
 namespace Neural {
     /*
@@ -38,6 +50,8 @@ namespace Neural {
         * @return: The loss as defined by the derived class implementation
         */
         auto train(float lr, const EigenType_1& curr_inputs, const EigenType_2& curr_one_hot_labels) {
+            auto start = Telemetry::Clock::now();
+
             auto tup = fwdPass(curr_inputs, curr_one_hot_labels, true);
             auto gradient_vec = bwdPass(std::get<0>(tup), std::get<1>(tup), std::get<2>(tup));
             
@@ -46,7 +60,13 @@ namespace Neural {
                 outputs_vec.push_back(pair.second);
             }
 
-            updateNetwork(outputs_vec, gradient_vec, lr);
+            updateNetwork(curr_inputs, outputs_vec, gradient_vec, lr);
+
+            Telemetry::storeLoss(telemetry.train_loss, telemetry.train_misclas, crtp_handle->loss);
+            telemetry.train_rows.fetch_add(curr_inputs.rows(), std::memory_order_relaxed);
+            telemetry.train_ns.fetch_add(Telemetry::elapsedNs(start), std::memory_order_relaxed);
+            telemetry.train_steps.fetch_add(1, std::memory_order_relaxed);
+            parameter_version.fetch_add(1, std::memory_order_relaxed);
             
             return crtp_handle->loss;
         }
@@ -56,6 +76,225 @@ namespace Neural {
             return train(lr, inputs, one_hot_labels);
         }
 
+        /*
+        * @brief: Trains neural network on the hardest rows of a batch only (selective backprop)
+        *
+        * The forward pass runs on the whole batch. Only the fraction @keep_fraction of rows with the
+        * largest losses is then kept: their activations and pre-gradient are compacted into a smaller
+        * dense batch, on which the backward pass and the update run. Rows are ranked by per-sample
+        * losses if the derived class tracks them (see `MultiClassNN::trackSampleLosses`), by the norms
+        * of their pre-gradient rows otherwise. The pre-gradient keeps the scale of the whole batch, so
+        * dropped rows just contribute nothing. Every layer must implement
+        * `void selectRows(const MatColX<int>&)`, compacting any per-row state of its forward pass
+        *
+        * @param keep_fraction: Fraction of rows kept, in `(0, 1]`
+        * @return: The loss of the whole batch as defined by the derived class implementation
+        */
+        auto trainSelective(float lr, float keep_fraction, const EigenType_1& curr_inputs,
+                            const EigenType_2& curr_one_hot_labels) {
+            if (keep_fraction <= 0 || keep_fraction > 1) {
+                throw std::invalid_argument("received @keep_fraction outside of (0, 1]");
+            }
+            if (!output_select || std::any_of(select_funcs.begin(), select_funcs.end(), [](const auto& f) { return !f; })) {
+                throw std::logic_error("every layer must implement `selectRows` for selective training");
+            }
+            auto start = Telemetry::Clock::now();
+
+            auto tup = fwdPass(curr_inputs, curr_one_hot_labels, true);
+            auto& signals_outputs_vec = std::get<0>(tup);
+            EigenType_1 final_signals = std::get<1>(tup);
+            EigenType_1 pre_gradient = std::get<2>(tup);
+
+            MatColX<int> rows = hardRows(pre_gradient, keep_fraction);
+            bool compact = rows.size() < curr_inputs.rows();
+            if (compact) {
+                for (std::size_t i = 0; i < signals_outputs_vec.size(); i++) {
+                    auto& pair = signals_outputs_vec[i];
+                    pair.first = pair.first(rows, Eigen::all).eval();
+                    pair.second = pair.second(rows, Eigen::all).eval();
+                    select_funcs[i](rows);
+                }
+                output_select(rows);
+                final_signals = final_signals(rows, Eigen::all).eval();
+                pre_gradient = pre_gradient(rows, Eigen::all).eval();
+            }
+
+            auto gradient_vec = bwdPass(signals_outputs_vec, final_signals, pre_gradient);
+
+            std::vector<EigenType_1> outputs_vec;
+            for (auto& pair : signals_outputs_vec) {
+                outputs_vec.push_back(pair.second);
+            }
+            updateNetwork(compact ? EigenType_1(curr_inputs(rows, Eigen::all)) : curr_inputs, outputs_vec, gradient_vec, lr);
+
+            Telemetry::storeLoss(telemetry.train_loss, telemetry.train_misclas, crtp_handle->loss);
+            telemetry.train_rows.fetch_add(curr_inputs.rows(), std::memory_order_relaxed);
+            telemetry.train_ns.fetch_add(Telemetry::elapsedNs(start), std::memory_order_relaxed);
+            telemetry.train_steps.fetch_add(1, std::memory_order_relaxed);
+            parameter_version.fetch_add(1, std::memory_order_relaxed);
+
+            return crtp_handle->loss;
+        }
+
+        // Overloaded version, uses members `inputs` and `one_hot_labels` as default
+        auto trainSelective(float lr, float keep_fraction) {
+            return trainSelective(lr, keep_fraction, inputs, one_hot_labels);
+        }
+
+        /*
+        * @brief: Trains neural network with a layer-wise adaptive optimizer (LARS, LAMB) instead of the
+        *         gradient descent of `updateWeights`. Layers implementing `parameters()` are stepped
+        *         together by @optimizer; others (e.g. batch normalization) are updated through
+        *         `updateWeights` at the optimizer's current learning rate. Weight averages tracked by
+        *         `LinearLayer::setAveraging` are not updated on this path
+        *
+        * @return: The loss as defined by the derived class implementation
+        */
+        auto train(LayerwiseOptimizer& optimizer, const EigenType_1& curr_inputs, const EigenType_2& curr_one_hot_labels) {
+            auto start = Telemetry::Clock::now();
+
+            auto tup = fwdPass(curr_inputs, curr_one_hot_labels, true);
+            auto gradient_vec = bwdPass(std::get<0>(tup), std::get<1>(tup), std::get<2>(tup));
+            auto inputs_vec = layerInputs(curr_inputs, std::get<0>(tup));
+
+            std::vector<ParamHooks*> stepped_hooks;
+            std::vector<std::vector<ParamView>> params;
+            std::vector<std::vector<MatColX<float>>> gradients;
+            for (std::size_t i = 0; i < inputs_vec.size(); i++) {
+                ParamHooks& hooks = i < param_hooks.size() ? param_hooks[i] : output_param_hooks;
+                const auto& update = i < update_funcs.size() ? update_funcs[i] : output_update;
+                const EigenType_1& layer_gradient = gradient_vec[gradient_vec.size() - 1 - i];
+                if (!hooks.parameters) {
+                    update(inputs_vec[i], layer_gradient, optimizer.learningRate());
+                    continue;
+                }
+                gradients.push_back(layerGradients(hooks, inputs_vec[i], layer_gradient));
+                params.push_back(hooks.parameters());
+                stepped_hooks.push_back(&hooks);
+            }
+
+            auto update_start = Telemetry::Clock::now();
+            optimizer.step(params, gradients);
+            Telemetry::addLayerTime(&Telemetry::LayerCounters::update_ns, telemetry, feedforward_funcs.size(), update_start);
+            for (ParamHooks* hooks : stepped_hooks) {
+                if (hooks->invalidate) {
+                    hooks->invalidate();
+                }
+            }
+
+            Telemetry::storeLoss(telemetry.train_loss, telemetry.train_misclas, crtp_handle->loss);
+            telemetry.train_rows.fetch_add(curr_inputs.rows(), std::memory_order_relaxed);
+            telemetry.train_ns.fetch_add(Telemetry::elapsedNs(start), std::memory_order_relaxed);
+            telemetry.train_steps.fetch_add(1, std::memory_order_relaxed);
+            parameter_version.fetch_add(1, std::memory_order_relaxed);
+
+            return crtp_handle->loss;
+        }
+
+        // Overloaded version, uses members `inputs` and `one_hot_labels` as default
+        auto train(LayerwiseOptimizer& optimizer) {
+            return train(optimizer, inputs, one_hot_labels);
+        }
+
+        /*
+        * @brief: Weights the rows of the next training batch in its loss and gradient (e.g. the
+        *         importance weights of `ImportanceSampler::draw`). Consumed by the next `train` call;
+        *         requires a derived class whose `evaluate` accepts row weights (e.g. `MultiClassNN`)
+        */
+        void weightNextBatch(ArrColX<float> weights) {
+            row_weights = std::move(weights);
+        }
+
+        /*
+        * @brief: Online update from a single event: forward pass, backward pass and rank-1 weight
+        *         updates on one row, layer by layer. Uses scratch rows kept across calls, so after
+        *         the first call (or a change of layers) nothing is allocated. Every layer must
+        *         implement `forwardRow`, `backwardRow` and `updateRow` (e.g. `LinearLayer`), and the
+        *         derived class `evaluateRow` (e.g. `MultiClassNN`)
+        *
+        * @param row: Inputs of the event
+        * @param label: Index of the event's class
+        * @return: The loss of the event, before the update
+        */
+        float partialFit(const Eigen::Ref<const MatRowX<float>>& row, Eigen::Index label, float lr) {
+            if (lr < 0) {
+                throw std::invalid_argument("received negative value for learning rate @lr");
+            }
+            auto start = Telemetry::Clock::now();
+            prepareStreaming(row.size());
+
+            Eigen::Index num_layers = stream_hooks.size() + 1;
+            auto hooksAt = [&](Eigen::Index i) -> StreamHooks& { return i + 1 < num_layers ? stream_hooks[i] : output_stream_hooks; };
+            auto inputsAt = [&](Eigen::Index i) -> const Eigen::Ref<const MatRowX<float>> {
+                return i == 0 ? row : Eigen::Ref<const MatRowX<float>>(stream_scratch[i - 1].outputs);
+            };
+
+            for (Eigen::Index i = 0; i < num_layers; i++) {
+                hooksAt(i).forward(inputsAt(i), stream_scratch[i].signals, stream_scratch[i].outputs);
+            }
+            StreamScratch& last = stream_scratch.back();
+            float loss = crtp_handle->evaluateRow(last.outputs, label, last.tgradient);
+
+            // Each layer passes its gradient down before being updated, so that the backward pass
+            // sees the weights of the forward pass
+            for (Eigen::Index i = num_layers - 1; i >= 0; i--) {
+                StreamScratch& scratch = stream_scratch[i];
+                MatRowX<float>& next_tgradient = i > 0 ? stream_scratch[i - 1].tgradient : stream_input_tgradient;
+                hooksAt(i).backward(scratch.signals, scratch.tgradient, scratch.gradient, next_tgradient);
+                hooksAt(i).update(inputsAt(i), scratch.gradient, lr);
+            }
+
+            telemetry.train_rows.fetch_add(1, std::memory_order_relaxed);
+            telemetry.train_ns.fetch_add(Telemetry::elapsedNs(start), std::memory_order_relaxed);
+            telemetry.train_steps.fetch_add(1, std::memory_order_relaxed);
+            parameter_version.fetch_add(1, std::memory_order_relaxed);
+            return loss;
+        }
+
+        /*
+        * @brief: Tiny-batch variant of `partialFit`: applies the rows of @rows one after the other,
+        *         each as its own online update
+        *
+        * @return: The mean loss of the rows, each before its own update
+        */
+        float partialFit(const EigenType_1& rows, const MatColX<int>& labels, float lr) {
+            if (rows.rows() != labels.size()) {
+                throw std::invalid_argument("numbers of rows of @rows and @labels differ");
+            }
+            float total = 0;
+            for (Eigen::Index r = 0; r < rows.rows(); r++) {
+                total += partialFit(rows.row(r).matrix(), labels(r), lr);
+            }
+            return rows.rows() > 0 ? total / (float)rows.rows() : 0.0f;
+        }
+
+        /*
+        * @brief: Copies the current weights of every layer into a new `InferenceSnapshot` and makes it
+        *         the one returned by `snapshot`. Layers must implement `augmentedWeights()`, or
+        *         `inferenceWeights()` when inference uses other weights (e.g. folding a batch
+        *         normalization); activations, if any, must be static `activate(float)` functions, so
+        *         that the snapshot does not reference the layers. Layers bypassed at inference are skipped
+        */
+        std::shared_ptr<const InferenceSnapshot> publishSnapshot() {
+            std::vector<InferenceSnapshot::Layer> layers;
+            for (std::size_t i = 0; i < stream_hooks.size(); i++) {
+                if (!inference_funcs[i]) {
+                    continue;
+                }
+                layers.push_back(snapshotLayer(stream_hooks[i]));
+            }
+            layers.push_back(snapshotLayer(output_stream_hooks));
+
+            auto snap = std::make_shared<const InferenceSnapshot>(std::move(layers), parameterVersion(), foldsInference());
+            published_snapshot.store(snap, std::memory_order_release);
+            return snap;
+        }
+
+        // Last snapshot published by `publishSnapshot` (null if none). Safe to call from any thread
+        std::shared_ptr<const InferenceSnapshot> snapshot() const {
+            return published_snapshot.load(std::memory_order_acquire);
+        }
+
         /*
         * @brief: Tests neural network
         *
@@ -64,18 +303,214 @@ namespace Neural {
         * @return: The loss as defined by the derived class implementation
         */
         auto test(const EigenType_1& curr_inputs, const EigenType_2& curr_one_hot_labels) {
+            auto start = Telemetry::Clock::now();
+
             auto tup = fwdPass(curr_inputs, curr_one_hot_labels, false);
+
+            Telemetry::storeLoss(telemetry.test_loss, telemetry.test_misclas, std::get<3>(tup));
+            telemetry.test_rows.fetch_add(curr_inputs.rows(), std::memory_order_relaxed);
+            telemetry.test_ns.fetch_add(Telemetry::elapsedNs(start), std::memory_order_relaxed);
+            telemetry.test_calls.fetch_add(1, std::memory_order_relaxed);
             
             return std::get<3>(tup);
         }
 
+        /*
+        * @brief: Lock-free counters (throughput, loss, per-layer timings) updated by `train` and
+        *         `test`. Layer `i` is the `i`-th pushed hidden layer; the output layer comes last.
+        *         Pass to `Telemetry::Server` to expose them while training runs
+        */
+        const Telemetry::Counters& counters() const {
+            return telemetry;
+        }
+
+        /*
+        * @brief: Incremented by every change of the weights made through the network: training steps,
+        *         `setParameters` (hence `trainLBFGS`), `swapAveragedWeights` and `invalidateInference`
+        *         (to be called after writing through `layerParameters`). Versions snapshots and deltas
+        */
+        std::uint64_t parameterVersion() const {
+            return parameter_version.load(std::memory_order_relaxed);
+        }
+
+        /*
+        * @brief: Trains the network with full-batch L-BFGS on @curr_inputs, evaluating loss and
+        *         gradient with `fwdPass` and `bwdPass`. Only parameters of layers implementing
+        *         `parameters()` are optimized (see `ParamView`); their updates must be plain
+        *         gradient descent unless they implement `parameterGradients`. The loss minimized is
+        *         the first entry of the derived class' loss (e.g. the cross-entropy). The whole solve
+        *         is one deterministic evaluation (see `lossAndGradient`), so the line search sees a
+        *         fixed objective. Layers with weights but without `parameters()` are refused, as
+        *         they would silently stay frozen
+        */
+        LBFGSReport trainLBFGS(const EigenType_1& curr_inputs, const EigenType_2& curr_one_hot_labels,
+                               const LBFGSOptions& options = {}) {
+            for (std::size_t i = 0; i <= param_hooks.size(); i++) {
+                if ((i < param_hooks.size() ? param_hooks[i] : output_param_hooks).untracked_weights) {
+                    throw std::logic_error("L-BFGS requires every layer with weights to implement `parameters()`");
+                }
+            }
+
+            DeterministicScope scope(*this);
+            MatColX<float> params = getParameters();
+            auto objective = [&](const MatColX<float>& x, MatColX<float>& gradient) {
+                setParameters(x);
+                return lossAndGradient(curr_inputs, curr_one_hot_labels, gradient);
+            };
+            LBFGSReport report = LBFGS(options).minimize(objective, params);
+            setParameters(params);
+
+            return report;
+        }
+
+        // Overloaded version, uses members `inputs` and `one_hot_labels` as default
+        LBFGSReport trainLBFGS(const LBFGSOptions& options = {}) {
+            return trainLBFGS(inputs, one_hot_labels, options);
+        }
+
+        /*
+        * @brief: Parameters of all layers implementing `parameters()`, flattened: hidden layers in
+        *         the order they were pushed, output layer last
+        */
+        MatColX<float> getParameters() {
+            MatColX<float> flat(numParameters());
+            Eigen::Index offset = 0;
+            forEachParamHooks([&](ParamHooks& hooks) {
+                for (auto& view : hooks.parameters()) {
+                    flat.segment(offset, view.size()) = view;
+                    offset += view.size();
+                }
+            });
+            return flat;
+        }
+
+        // Inverse of `getParameters`
+        void setParameters(const MatColX<float>& flat) {
+            if (flat.size() != numParameters()) {
+                throw std::invalid_argument("size of @flat does not match number of parameters");
+            }
+            Eigen::Index offset = 0;
+            forEachParamHooks([&](ParamHooks& hooks) {
+                for (auto& view : hooks.parameters()) {
+                    view = flat.segment(offset, view.size());
+                    offset += view.size();
+                }
+                if (hooks.invalidate) {
+                    hooks.invalidate();
+                }
+            });
+            parameter_version.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        Eigen::Index numParameters() {
+            Eigen::Index count = 0;
+            forEachParamHooks([&](ParamHooks& hooks) {
+                for (auto& view : hooks.parameters()) {
+                    count += view.size();
+                }
+            });
+            return count;
+        }
+
+        /*
+        * @brief: Views of the parameters of all layers implementing `parameters()`, one list per
+        *         layer, in the order of `getParameters`. Call `invalidateInference` after writing through them
+        */
+        std::vector<std::vector<ParamView>> layerParameters() {
+            std::vector<std::vector<ParamView>> layers;
+            forEachParamHooks([&](ParamHooks& hooks) {
+                layers.push_back(hooks.parameters());
+            });
+            return layers;
+        }
+
+        /*
+        * @brief: Whether some layer computes its inference weights from its parameters through a fold
+        *         (see `LinearLayer::setInferenceFold`), so that `layerParameters` differ from the
+        *         weights of `publishSnapshot`
+        */
+        bool foldsInference() {
+            bool folded = false;
+            forEachParamHooks([&](ParamHooks& hooks) {
+                folded = folded || (hooks.folded && hooks.folded());
+            });
+            return folded;
+        }
+
+        // Marks the inference weights of every layer (e.g. folds, see `LinearLayer::setInferenceFold`) stale
+        void invalidateInference() {
+            forEachParamHooks([&](ParamHooks& hooks) {
+                if (hooks.invalidate) {
+                    hooks.invalidate();
+                }
+            });
+            parameter_version.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /*
+        * @brief: Swaps in the averaged weights of every layer tracking them (see
+        *         `LinearLayer::setAveraging`), without copying; other layers are left as they are.
+        *         Call again to swap the trained weights back before training resumes
+        */
+        void swapAveragedWeights() {
+            for (auto& hooks : param_hooks) {
+                if (hooks.swap_averaged) {
+                    hooks.swap_averaged();
+                }
+            }
+            if (output_param_hooks.swap_averaged) {
+                output_param_hooks.swap_averaged();
+            }
+            parameter_version.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /*
+        * @brief: Evaluates the loss on @curr_inputs and writes its gradient wrt `getParameters()` to
+        *         @gradient. Weights are left unchanged. The evaluation is deterministic: layers
+        *         implementing `setDeterministic(bool)` keep their random state (dropout reuses its
+        *         masks) and running statistics (batch normalization) while it lasts, and the weights of
+        *         `weightNextBatch` apply throughout and are consumed when it ends
+        *
+        * @return: The first entry of the derived class' loss
+        */
+        float lossAndGradient(const EigenType_1& curr_inputs, const EigenType_2& curr_one_hot_labels,
+                              MatColX<float>& gradient) {
+            DeterministicScope scope(*this);
+            auto tup = fwdPass(curr_inputs, curr_one_hot_labels, true);
+            auto gradient_vec = bwdPass(std::get<0>(tup), std::get<1>(tup), std::get<2>(tup));
+
+            auto inputs_vec = layerInputs(curr_inputs, std::get<0>(tup));
+
+            gradient.resize(numParameters());
+            Eigen::Index offset = 0;
+            for (std::size_t i = 0; i < inputs_vec.size(); i++) {
+                ParamHooks& hooks = i < param_hooks.size() ? param_hooks[i] : output_param_hooks;
+                const EigenType_1& layer_gradient = gradient_vec[gradient_vec.size() - 1 - i];
+                if (!hooks.parameters) {
+                    continue;
+                }
+
+                for (auto& part : layerGradients(hooks, inputs_vec[i], layer_gradient)) {
+                    gradient.segment(offset, part.size()) = part;
+                    offset += part.size();
+                }
+            }
+
+            return scalarLoss(std::get<3>(tup));
+        }
+
         /*
         * @brief: Adds a hidden layer to network. 
         *
         * @tparam LayerType_other: Class of hidden layer to be added. Expected to implement functions
         *                          `std::pair<EigenType_1, EigenType_1> feedForward(EigenType_1)`, 
         *                          `std::pair<EigenType_1, EigenType_1> backPropagate(EigenType_1, EigenType_1)` and
-        *                          `void updateWeights(EigenType_1, EigenType_1, float)`
+        *                          `void updateWeights(EigenType_1, EigenType_1, float)`. The forward pass of
+        *                          `test` uses `feedForwardInference(EigenType_1)` instead, if implemented,
+        *                          and bypasses the layer if `bool inferenceIdentity()` returns true (e.g.
+        *                          dropout, or batch normalization folded into the preceding layer).
+        *                          Layers without `parameters()` declare `constexpr static bool has_weights`
+        *                          false if they have none (checked by `trainLBFGS`)
         * 
         * @param layer: Obj to be added as hidden layer. Must be modifiable
         */
@@ -91,12 +526,27 @@ namespace Neural {
             feedforward_funcs.push_back(feedforward_lambda);
             backprop_funcs.push_back(backprop_lambda);
             update_funcs.push_back(update_lambda);
+
+            inference_funcs.push_back(inferenceFunc(layer));
+            select_funcs.push_back(selectFunc(layer));
+            deterministic_funcs.push_back(deterministicFunc(layer));
+            param_hooks.push_back(paramHooks(layer));
+            stream_hooks.push_back(streamHooks(layer));
+
+            telemetry.num_layers.store(feedforward_funcs.size() + 1);
         }
 
         void popLayer() {
             feedforward_funcs.pop_back();
             backprop_funcs.pop_back();
             update_funcs.pop_back();
+            inference_funcs.pop_back();
+            select_funcs.pop_back();
+            deterministic_funcs.pop_back();
+            param_hooks.pop_back();
+            stream_hooks.pop_back();
+
+            telemetry.num_layers.store(feedforward_funcs.size() + 1);
         }
         
     protected:
@@ -117,6 +567,11 @@ namespace Neural {
                                     { return output_layer.seedBackProp(signals, gradient); }),
                   output_update([&output_layer](const EigenType_1& outputs, const EigenType_1& gradient, float lr)
                              { return output_layer.updateWeights(outputs, gradient, lr); }),
+                  output_inference(inferenceFunc(output_layer)),
+                  output_select(selectFunc(output_layer)),
+                  output_deterministic(deterministicFunc(output_layer)),
+                  output_param_hooks(paramHooks(output_layer)),
+                  output_stream_hooks(streamHooks(output_layer)),
                  
                   crtp_handle(static_cast<Impl<EigenType_1, EigenType_2, LayerType>*>(this))
         {
@@ -124,9 +579,283 @@ namespace Neural {
                                && std::is_same_v<MatrixX_RowMajor<bool>, MatrixX_RowMajor<bool>>) || 
                               (std::is_same_v<MatrixX_RowMajor<float>, ArrayX_RowMajor<float>>
                                && std::is_same_v<MatrixX_RowMajor<bool>, ArrayX_RowMajor<bool>>));
+
+                telemetry.num_layers.store(1);
+        }
+
+        // Returns the forward function used by `test` for @layer; empty if @layer is bypassed at inference
+        template<typename LayerType_other>
+        static std::function<std::pair<EigenType_1, EigenType_1>(const EigenType_1&)> inferenceFunc(LayerType_other& layer) {
+            if constexpr (requires { layer.inferenceIdentity(); }) {
+                if (layer.inferenceIdentity()) {
+                    return {};
+                }
+            }
+            if constexpr (requires (const EigenType_1& x) { layer.feedForwardInference(x); }) {
+                return [&layer](const EigenType_1& layer_inputs) { return layer.feedForwardInference(layer_inputs); };
+            }
+            else {
+                return [&layer](const EigenType_1& layer_inputs) { return layer.feedForward(layer_inputs); };
+            }
+        }
+
+        // Single-row passes and weight access of a layer, used by `partialFit` and `publishSnapshot`;
+        // members are empty if not implemented
+        struct StreamHooks {
+            std::function<void(const Eigen::Ref<const MatRowX<float>>&, Eigen::Ref<MatRowX<float>>,
+                               Eigen::Ref<MatRowX<float>>)> forward;
+            std::function<void(const Eigen::Ref<const MatRowX<float>>&, const Eigen::Ref<const MatRowX<float>>&,
+                               Eigen::Ref<MatRowX<float>>, Eigen::Ref<MatRowX<float>>)> backward;
+            std::function<void(const Eigen::Ref<const MatRowX<float>>&, const Eigen::Ref<const MatRowX<float>>&, float)> update;
+            std::function<Eigen::Index()> output_dim;
+            std::function<InferenceSnapshot::Layer()> snapshot;
+        };
+
+        // Per-layer scratch rows of `partialFit`
+        struct StreamScratch {
+            MatRowX<float> signals;
+            MatRowX<float> outputs;
+            MatRowX<float> gradient;
+            MatRowX<float> tgradient; // Gradient wrt the layer's outputs
+        };
+
+        template<typename LayerType_other>
+        static StreamHooks streamHooks(LayerType_other& layer) {
+            using RowRef = Eigen::Ref<MatRowX<float>>;
+            using ConstRowRef = Eigen::Ref<const MatRowX<float>>;
+            StreamHooks hooks;
+            if constexpr (requires (const ConstRowRef& x, RowRef y) { layer.forwardRow(x, y, y); layer.backwardRow(x, x, y, y);
+                                                                     layer.updateRow(x, x, 1.0f); layer.outputDim(); }) {
+                hooks.forward = [&layer](const ConstRowRef& input, RowRef signals, RowRef outputs)
+                                { layer.forwardRow(input, signals, outputs); };
+                hooks.backward = [&layer](const ConstRowRef& signals, const ConstRowRef& tgradient, RowRef gradient, RowRef new_tgradient)
+                                 { layer.backwardRow(signals, tgradient, gradient, new_tgradient); };
+                hooks.update = [&layer](const ConstRowRef& input, const ConstRowRef& gradient, float lr)
+                               { layer.updateRow(input, gradient, lr); };
+                hooks.output_dim = [&layer]() { return layer.outputDim(); };
+            }
+            if constexpr (requires { layer.augmentedWeights(); }) {
+                hooks.snapshot = [&layer]() {
+                    InferenceSnapshot::Layer snap;
+                    if constexpr (requires { layer.inferenceWeights(); }) {
+                        snap.weights = layer.inferenceWeights();
+                    }
+                    else {
+                        snap.weights = layer.augmentedWeights();
+                    }
+                    constexpr bool identity = requires { requires !LayerType_other::has_activation; };
+                    if constexpr (requires { LayerType_other::activate(0.0f); }) {
+                        if constexpr (!identity) {
+                            snap.activate = [](MatrixX_RowMajor<float>& signals)
+                                            { signals = signals.unaryExpr([](float f) { return LayerType_other::activate(f); }); };
+                        }
+                    }
+                    else if constexpr (requires { layer.activate(0.0f); }) {
+                        throw std::logic_error("activations must be static member functions for snapshots");
+                    }
+                    return snap;
+                };
+            }
+            return hooks;
+        }
+
+        static InferenceSnapshot::Layer snapshotLayer(StreamHooks& hooks) {
+            if (!hooks.snapshot) {
+                throw std::logic_error("every layer used at inference must implement `augmentedWeights` for snapshots");
+            }
+            return hooks.snapshot();
+        }
+
+        // Checks that all layers support streaming and (re)sizes the scratch rows of `partialFit` if needed
+        void prepareStreaming(Eigen::Index in_dim) {
+            Eigen::Index num_layers = stream_hooks.size() + 1;
+            bool resized = (Eigen::Index)stream_scratch.size() != num_layers || stream_input_tgradient.size() != in_dim;
+            stream_scratch.resize(num_layers);
+            for (Eigen::Index i = 0; i < num_layers; i++) {
+                StreamHooks& hooks = i + 1 < num_layers ? stream_hooks[i] : output_stream_hooks;
+                if (!hooks.forward) {
+                    throw std::logic_error("every layer must implement `forwardRow`, `backwardRow` and `updateRow` for streaming");
+                }
+                Eigen::Index out_dim = hooks.output_dim();
+                if (resized || stream_scratch[i].signals.size() != out_dim) {
+                    stream_scratch[i].signals.resize(out_dim);
+                    stream_scratch[i].outputs.resize(out_dim);
+                    stream_scratch[i].gradient.resize(out_dim);
+                    stream_scratch[i].tgradient.resize(out_dim);
+                }
+            }
+            stream_input_tgradient.resize(in_dim);
+        }
+
+        // Returns the function compacting the forward state of @layer to given rows; empty if not implemented
+        template<typename LayerType_other>
+        static std::function<void(const MatColX<int>&)> selectFunc(LayerType_other& layer) {
+            if constexpr (requires (const MatColX<int>& rows) { layer.selectRows(rows); }) {
+                return [&layer](const MatColX<int>& rows) { layer.selectRows(rows); };
+            }
+            else {
+                return {};
+            }
+        }
+
+        // Returns the function switching the training pass of @layer to deterministic evaluation and
+        // back; empty if not implemented
+        template<typename LayerType_other>
+        static std::function<void(bool)> deterministicFunc(LayerType_other& layer) {
+            if constexpr (requires { layer.setDeterministic(true); }) {
+                return [&layer](bool deterministic) { layer.setDeterministic(deterministic); };
+            }
+            else {
+                return {};
+            }
+        }
+
+        /*
+        * @brief: Enters (@deterministic set) or leaves a deterministic evaluation (see
+        *         `lossAndGradient`). Calls nest: layers are switched when the outermost evaluation
+        *         starts and ends, and the weights of `weightNextBatch` are consumed when it ends
+        */
+        void setDeterministic(bool deterministic) {
+            if (deterministic ? deterministic_depth++ > 0 : --deterministic_depth > 0) {
+                return;
+            }
+            for (auto& func : deterministic_funcs) {
+                if (func) {
+                    func(deterministic);
+                }
+            }
+            if (output_deterministic) {
+                output_deterministic(deterministic);
+            }
+            if (!deterministic) {
+                row_weights.resize(0);
+            }
+        }
+
+        // Deterministic evaluation for the lifetime of the obj
+        struct DeterministicScope {
+            explicit DeterministicScope(FeedFwdNN& nn) : nn(nn) {
+                nn.setDeterministic(true);
+            }
+            ~DeterministicScope() {
+                nn.setDeterministic(false);
+            }
+            FeedFwdNN& nn;
+        };
+
+        /*
+        * @brief: Rows of the batch kept by `trainSelective`: the @keep_fraction with the largest
+        *         per-sample losses (pre-gradient row norms if the derived class does not track
+        *         them), in increasing order
+        */
+        MatColX<int> hardRows(const EigenType_1& pre_gradient, float keep_fraction) {
+            Eigen::Index num_rows = pre_gradient.rows();
+            ArrColX<float> scores;
+            if constexpr (requires { crtp_handle->tracksSampleLosses(); crtp_handle->sampleLosses(); }) {
+                if (crtp_handle->tracksSampleLosses()) {
+                    scores = crtp_handle->sampleLosses();
+                }
+            }
+            if (scores.size() != num_rows) {
+                scores = pre_gradient.matrix().rowwise().norm().array();
+            }
+
+            Eigen::Index num_kept = std::clamp<Eigen::Index>((Eigen::Index)std::ceil(keep_fraction * num_rows), 1, num_rows);
+            std::vector<int> order(num_rows);
+            std::iota(order.begin(), order.end(), 0);
+            std::nth_element(order.begin(), order.begin() + (num_kept - 1), order.end(),
+                             [&scores](int a, int b) { return scores(a) > scores(b); });
+            std::sort(order.begin(), order.begin() + num_kept);
+
+            return Eigen::Map<MatColX<int>>(order.data(), num_kept);
+        }
+
+        // Access to the trainable parameters of a layer; members are empty if not implemented
+        struct ParamHooks {
+            std::function<std::vector<ParamView>()> parameters;
+            std::function<std::vector<MatColX<float>>(const EigenType_1&, const EigenType_1&)> gradients;
+            std::function<void()> invalidate;
+            std::function<void()> swap_averaged;
+            std::function<bool()> folded;
+            bool untracked_weights = false; // Layer has weights but does not implement `parameters()`
+        };
+
+        template<typename LayerType_other>
+        static ParamHooks paramHooks(LayerType_other& layer) {
+            ParamHooks hooks;
+            if constexpr (requires { layer.parameters(); }) {
+                hooks.parameters = [&layer]() { return layer.parameters(); };
+            }
+            else if constexpr (requires { LayerType_other::has_weights; }) {
+                hooks.untracked_weights = LayerType_other::has_weights;
+            }
+            else {
+                hooks.untracked_weights = true;
+            }
+            if constexpr (requires (const EigenType_1& x) { layer.parameterGradients(x, x); }) {
+                hooks.gradients = [&layer](const EigenType_1& layer_inputs, const EigenType_1& gradient)
+                                  { return layer.parameterGradients(layer_inputs, gradient); };
+            }
+            if constexpr (requires { layer.invalidateInference(); }) {
+                hooks.invalidate = [&layer]() { layer.invalidateInference(); };
+            }
+            if constexpr (requires { layer.inferenceFolded(); }) {
+                hooks.folded = [&layer]() { return layer.inferenceFolded(); };
+            }
+            if constexpr (requires { layer.swapAveragedWeights(); layer.averagingMode(); }) {
+                hooks.swap_averaged = [&layer]() {
+                    if (layer.averagingMode() != Averaging::None) {
+                        layer.swapAveragedWeights();
+                    }
+                };
+            }
+            return hooks;
         }
 
-        // Will call `feedForward` function on every constituent layer to perform forward pass
+        template<typename HooksFunction>
+        void forEachParamHooks(const HooksFunction& func) {
+            for (auto& hooks : param_hooks) {
+                if (hooks.parameters) {
+                    func(hooks);
+                }
+            }
+            if (output_param_hooks.parameters) {
+                func(output_param_hooks);
+            }
+        }
+
+        // Gradients wrt the parameters of a layer, which must implement `parameterGradients`
+        static std::vector<MatColX<float>> layerGradients(ParamHooks& hooks, const EigenType_1& layer_inputs,
+                                                          const EigenType_1& gradient) {
+            if (!hooks.gradients) {
+                throw std::logic_error("layers exposing `parameters` must implement `parameterGradients`");
+            }
+            return hooks.gradients(layer_inputs, gradient);
+        }
+
+        // Inputs of every layer in a forward pass, aligned with `param_hooks` followed by `output_param_hooks`
+        static std::vector<EigenType_1> layerInputs(const EigenType_1& curr_inputs,
+                                                    const std::vector<std::pair<EigenType_1, EigenType_1>>& signals_outputs_vec) {
+            std::vector<EigenType_1> inputs_vec = { curr_inputs };
+            for (auto& pair : signals_outputs_vec) {
+                inputs_vec.push_back(pair.second);
+            }
+            return inputs_vec;
+        }
+
+        // First entry of a loss given as pair (e.g. cross-entropy, misclassification), or the loss itself
+        template<typename LossType>
+        static float scalarLoss(const LossType& loss) {
+            if constexpr (requires { loss.first; }) {
+                return loss.first;
+            }
+            else {
+                return loss;
+            }
+        }
+
+        // Will call `feedForward` function on every constituent layer to perform forward pass. Unless
+        // @update_loss is set (i.e. when training), the inference functions of the layers are used
         auto fwdPass(const EigenType_1& curr_inputs,
                      const EigenType_2& curr_one_hot_labels,
                      bool update_loss = false) {
@@ -134,17 +863,28 @@ namespace Neural {
             std::vector<std::pair<EigenType_1, EigenType_1>> signals_outputs_vec; 
             
             auto next_inputs = curr_inputs;
-            for (auto& func : feedforward_funcs) {
-                signals_outputs = func(next_inputs);
-                next_inputs = signals_outputs.first;
+            const auto& forward_funcs = update_loss ? feedforward_funcs : inference_funcs;
+            for (std::size_t i = 0; i < forward_funcs.size(); i++) {
+                if (!forward_funcs[i]) {
+                    continue;
+                }
+
+                auto start = Telemetry::Clock::now();
+                signals_outputs = forward_funcs[i](next_inputs);
+                Telemetry::addLayerTime(&Telemetry::LayerCounters::fwd_ns, telemetry, i, start);
+
+                // Next layer consumes the outputs (post-activation), not the signals
+                next_inputs = signals_outputs.second;
                 signals_outputs_vec.push_back(signals_outputs);
             }
             
-            auto final_signals_outputs = output_feedforward(next_inputs);
+            auto start = Telemetry::Clock::now();
+            auto final_signals_outputs = update_loss ? output_feedforward(next_inputs) : output_inference(next_inputs);
+            Telemetry::addLayerTime(&Telemetry::LayerCounters::fwd_ns, telemetry, feedforward_funcs.size(), start);
             auto final_signals = final_signals_outputs.first;
             auto final_outputs = final_signals_outputs.second;
             
-            auto entropy_gradient = crtp_handle->evaluate(final_outputs, curr_one_hot_labels);
+            auto entropy_gradient = evaluateLoss(final_outputs, curr_one_hot_labels, update_loss);
             if (update_loss) {
                 crtp_handle->loss = entropy_gradient.first;
             }
@@ -153,6 +893,36 @@ namespace Neural {
             return std::make_tuple(signals_outputs_vec, final_signals, pre_gradient, entropy_gradient.first);
         }
 
+        // Outputs of an inference pass over @curr_inputs, without telemetry (e.g. for bookkeeping passes)
+        EigenType_1 inferenceOutputs(const EigenType_1& curr_inputs) {
+            EigenType_1 next_inputs = curr_inputs;
+            for (const auto& inference_func : inference_funcs) {
+                if (inference_func) {
+                    next_inputs = inference_func(next_inputs).second;
+                }
+            }
+            return output_inference(next_inputs).second;
+        }
+
+        // Evaluates the loss through the derived class, passing the weights set by `weightNextBatch` to a
+        // training pass (which consumes them, unless within a deterministic evaluation)
+        auto evaluateLoss(const EigenType_1& final_outputs, const EigenType_2& curr_one_hot_labels, bool update_loss) {
+            const ArrColX<float>* weights = (update_loss && row_weights.size() > 0) ? &row_weights : nullptr;
+            if constexpr (requires { crtp_handle->evaluate(final_outputs, curr_one_hot_labels, weights); }) {
+                auto entropy_gradient = crtp_handle->evaluate(final_outputs, curr_one_hot_labels, weights);
+                if (weights && deterministic_depth == 0) {
+                    row_weights.resize(0);
+                }
+                return entropy_gradient;
+            }
+            else {
+                if (weights) {
+                    throw std::logic_error("loss of derived class does not support row weights");
+                }
+                return crtp_handle->evaluate(final_outputs, curr_one_hot_labels);
+            }
+        }
+
         // Will call `seedBackProp` function of output layer and `backPropagate` function of every 
         // hidden layer to perform backpropagation step.
         auto bwdPass(const std::vector<std::pair<EigenType_1, EigenType_1>>& signals_outputs_vec, 
@@ -161,7 +931,9 @@ namespace Neural {
         {   
             auto signals = final_signals;
 
+            auto start = Telemetry::Clock::now();
             auto gradient_tgradient = output_seedbackprop(signals, pre_gradient);
+            Telemetry::addLayerTime(&Telemetry::LayerCounters::bwd_ns, telemetry, signals_outputs_vec.size(), start);
             auto gradient = gradient_tgradient.first;
             auto tgradient = gradient_tgradient.second;
         
@@ -169,7 +941,10 @@ namespace Neural {
             for (int i = signals_outputs_vec.size(); i > 0; i--) {
                 signals = signals_outputs_vec[i-1].first;
 
+                start = Telemetry::Clock::now();
                 gradient_tgradient = (backprop_funcs[i-1])(signals, tgradient);
+                Telemetry::addLayerTime(&Telemetry::LayerCounters::bwd_ns, telemetry, i - 1, start);
+
                 gradient = gradient_tgradient.first;
                 tgradient = gradient_tgradient.second;
 
@@ -180,16 +955,22 @@ namespace Neural {
         }
 
         // Will call `updateWeights` function of every constituent layer to update the weights of the network.
-        void updateNetwork(const std::vector<EigenType_1>& outputs_vec, const std::vector<EigenType_1>& gradient_vec, float lr) {
+        // @curr_inputs are the inputs of the first layer, as passed to `fwdPass`
+        void updateNetwork(const EigenType_1& curr_inputs, const std::vector<EigenType_1>& outputs_vec,
+                           const std::vector<EigenType_1>& gradient_vec, float lr) {
             if (lr < 0) {
                 throw std::invalid_argument("received negative value for learning rate @lr");
             }
 
             update_funcs.push_back(output_update);
 
-            update_funcs[0](inputs, gradient_vec[gradient_vec.size() - 1], lr);
+            auto start = Telemetry::Clock::now();
+            update_funcs[0](curr_inputs, gradient_vec[gradient_vec.size() - 1], lr);
+            Telemetry::addLayerTime(&Telemetry::LayerCounters::update_ns, telemetry, 0, start);
             for(int i = 0 ; i < outputs_vec.size() ; i++) {
+                start = Telemetry::Clock::now();
                 update_funcs[i + 1](outputs_vec[i], gradient_vec[gradient_vec.size() - 2 - i], lr);
+                Telemetry::addLayerTime(&Telemetry::LayerCounters::update_ns, telemetry, i + 1, start);
             }
 
             update_funcs.pop_back();
@@ -203,12 +984,37 @@ namespace Neural {
         const std::function<std::pair<EigenType_1,
                                 EigenType_1>(const EigenType_1&, const EigenType_1&)> output_seedbackprop;
         const std::function<void(const EigenType_1&, const EigenType_1&, float)> output_update;
+        const std::function<std::pair<EigenType_1,
+                                EigenType_1>(const EigenType_1&)> output_inference;
+        const std::function<void(const MatColX<int>&)> output_select;
+        const std::function<void(bool)> output_deterministic;
+        ParamHooks output_param_hooks;
 
         std::vector<std::function<std::pair<EigenType_1,
                                             EigenType_1>(const EigenType_1&)>> feedforward_funcs;
         std::vector<std::function<std::pair<EigenType_1,
                                             EigenType_1>(const EigenType_1&, const EigenType_1&)>> backprop_funcs;
         std::vector<std::function<void(const EigenType_1&, const EigenType_1&, float)>> update_funcs;
+        std::vector<std::function<std::pair<EigenType_1,
+                                            EigenType_1>(const EigenType_1&)>> inference_funcs;
+        std::vector<std::function<void(const MatColX<int>&)>> select_funcs;
+        std::vector<std::function<void(bool)>> deterministic_funcs;
+
+        std::vector<ParamHooks> param_hooks;
+
+        std::vector<StreamHooks> stream_hooks;
+        StreamHooks output_stream_hooks;
+        std::vector<StreamScratch> stream_scratch;
+        MatRowX<float> stream_input_tgradient;
+        std::atomic<std::shared_ptr<const InferenceSnapshot>> published_snapshot;
+
+        // Set by `weightNextBatch`; empty when rows are weighted uniformly
+        ArrColX<float> row_weights;
+        // Nesting depth of deterministic evaluations, see `setDeterministic`
+        int deterministic_depth = 0;
+
+        Telemetry::Counters telemetry;
+        std::atomic<std::uint64_t> parameter_version{ 0 };
 
     private:
         Impl<EigenType_1, EigenType_2, LayerType>* crtp_handle;
@@ -231,11 +1037,58 @@ namespace Neural {
         MultiClassNN(const EigenType_1& inputs, const EigenType_2& one_hot_labels, LayerType& output_layer) :
             FeedFwdNN<EigenType_1, EigenType_2, LayerType, MultiClassNNImpl>(inputs, one_hot_labels, output_layer) {}
     
-        auto evaluate(const EigenType_1& outputs, const EigenType_2& one_hot_labels) {
-            auto entropy_gradient = Neural::softMaxLoss(outputs, one_hot_labels);
+        auto evaluate(const EigenType_1& outputs, const EigenType_2& one_hot_labels,
+                      const ArrColX<float>* row_weights = nullptr) {
+            auto entropy_gradient = Neural::softMaxLoss(outputs, one_hot_labels, row_weights,
+                                                        track_sample_losses ? &sample_losses : nullptr);
             return entropy_gradient;
         }
+
+        /*
+        * @brief: Single-row counterpart of `evaluate`, used by `partialFit`: writes the gradient of the
+        *         cross-entropy wrt @outputs to @gradient and returns the cross-entropy. Allocates nothing
+        */
+        float evaluateRow(const Eigen::Ref<const MatRowX<float>>& outputs, Eigen::Index label, Eigen::Ref<MatRowX<float>> gradient) {
+            if (label < 0 || label >= outputs.size()) {
+                throw std::invalid_argument("received @label outside of the classes");
+            }
+            float max = outputs.maxCoeff();
+            gradient = (outputs.array() - max).exp().matrix();
+            float sum = gradient.sum();
+            float loss = std::log(sum) - (outputs(label) - max);
+            gradient /= sum;
+            gradient(label) -= 1.0f;
+            return loss;
+        }
+
+        // When set, `train` and `test` record the cross-entropy of every row (see `sampleLosses`)
+        void trackSampleLosses(bool track) {
+            track_sample_losses = track;
+        }
+
+        bool tracksSampleLosses() const {
+            return track_sample_losses;
+        }
+
+        // Cross-entropy of every row of the last `train` or `test` call, before any weight update
+        const ArrColX<float>& sampleLosses() const {
+            return sample_losses;
+        }
+
+        /*
+        * @brief: Cross-entropy of every row of @inputs under an inference pass, as `test` would
+        *         compute it, but recording neither telemetry nor `sampleLosses`
+        */
+        ArrColX<float> rowLosses(const EigenType_1& inputs, const EigenType_2& one_hot_labels) {
+            ArrColX<float> row_losses;
+            Neural::softMaxLoss(this->inferenceOutputs(inputs), one_hot_labels, nullptr, &row_losses);
+            return row_losses;
+        }
         
         std::pair<float, float> loss;
+
+    private:
+        bool track_sample_losses = false;
+        ArrColX<float> sample_losses;
     };
 }
@@ -0,0 +1,701 @@
+// npy.h: Contains facilities for reading and writing NumPy .npy and (uncompressed) .npz files
+
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+
+namespace Npy {
+    static_assert(std::endian::native == std::endian::little, "Npy assumes a little-endian host");
+    static_assert(sizeof(bool) == 1, "NumPy bools are single bytes");
+
+    /*
+    * @brief: Whole file mapped copy-on-write: pages are read from the file on first access, and
+    *         writes through the mapping stay private to the process. Unmapped on destruction
+    */
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string& path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("cannot open " + path);
+            }
+            struct stat status;
+            if (::fstat(fd, &status) != 0) {
+                ::close(fd);
+                throw std::runtime_error("cannot stat " + path);
+            }
+            file_size = (std::size_t)status.st_size;
+            if (file_size > 0) {
+                void* address = ::mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+                if (address == MAP_FAILED) {
+                    ::close(fd);
+                    throw std::runtime_error("cannot map " + path);
+                }
+                bytes = static_cast<std::uint8_t*>(address);
+            }
+            ::close(fd);
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile() {
+            if (bytes) {
+                ::munmap(bytes, file_size);
+            }
+        }
+
+        std::uint8_t* data() const {
+            return bytes;
+        }
+
+        std::size_t size() const {
+            return file_size;
+        }
+
+    private:
+        std::uint8_t* bytes = nullptr;
+        std::size_t file_size = 0;
+    };
+
+    /*
+    * @brief: Array read from a .npy file (or .npz member), viewed as a row-major 2-D
+    *         `Eigen::Array`: 1-D arrays as one column, higher dimensions flattened into columns
+    *
+    * Arrays stored little-endian, in C order, with exactly the requested element type are not
+    * copied: `map()` points into the mapped file, which stays mapped while the `Array` lives.
+    * Others (other widths or byte order, Fortran order, misaligned data) are converted into an
+    * owned buffer
+    */
+    template<typename Scalar>
+    class Array {
+    public:
+        Eigen::Map<ArrayX_RowMajor<Scalar>> map() {
+            return Eigen::Map<ArrayX_RowMajor<Scalar>>(values, num_rows, num_cols);
+        }
+
+        Eigen::Map<const ArrayX_RowMajor<Scalar>> map() const {
+            return Eigen::Map<const ArrayX_RowMajor<Scalar>>(values, num_rows, num_cols);
+        }
+
+        Eigen::Index rows() const {
+            return num_rows;
+        }
+
+        Eigen::Index cols() const {
+            return num_cols;
+        }
+
+        // Shape as stored, before flattening to 2-D
+        const std::vector<Eigen::Index>& shape() const {
+            return array_shape;
+        }
+
+        // Whether `map()` points into the file rather than into a converted copy
+        bool zeroCopy() const {
+            return file != nullptr;
+        }
+
+    private:
+        template<typename T>
+        friend Array<T> fromBytes(std::shared_ptr<MappedFile> file, const std::uint8_t* bytes, std::size_t size);
+
+        std::shared_ptr<MappedFile> file;
+        std::unique_ptr<Scalar[]> owned;
+        Scalar* values = nullptr;
+        Eigen::Index num_rows = 0;
+        Eigen::Index num_cols = 0;
+        std::vector<Eigen::Index> array_shape;
+    };
+
+    namespace Detail {
+        template<typename T>
+        T readLittle(const std::uint8_t* bytes) {
+            T value;
+            std::memcpy(&value, bytes, sizeof(T));
+            return value;
+        }
+
+        template<typename Scalar>
+        constexpr const char* descr() {
+            if constexpr (std::is_same_v<Scalar, float>) return "<f4";
+            else if constexpr (std::is_same_v<Scalar, double>) return "<f8";
+            else if constexpr (std::is_same_v<Scalar, std::int32_t>) return "<i4";
+            else if constexpr (std::is_same_v<Scalar, std::int64_t>) return "<i8";
+            else if constexpr (std::is_same_v<Scalar, bool>) return "|b1";
+            else static_assert(!sizeof(Scalar), "unsupported element type: use float, double, int32, int64 or bool");
+        }
+
+        struct Header {
+            char byte_order;       // '<', '>', '|' (single byte) or '=' (native)
+            char kind;             // 'f', 'i', 'u' or 'b'
+            std::size_t item_size;
+            bool fortran_order;
+            std::vector<Eigen::Index> shape;
+            std::size_t data_offset;
+        };
+
+        // Value of @key in the Python dict literal @dict, from the first non-space character on
+        inline std::string_view dictValue(std::string_view dict, std::string_view key) {
+            for (char quote : { '\'', '"' }) {
+                std::string quoted = std::string(1, quote) + std::string(key) + quote;
+                std::size_t pos = dict.find(quoted);
+                if (pos != std::string_view::npos) {
+                    pos = dict.find(':', pos + quoted.size());
+                    if (pos != std::string_view::npos) {
+                        pos = dict.find_first_not_of(' ', pos + 1);
+                        return pos != std::string_view::npos ? dict.substr(pos) : std::string_view{};
+                    }
+                }
+            }
+            throw std::invalid_argument("received .npy header without '" + std::string(key) + "'");
+        }
+
+        inline Header parseHeader(const std::uint8_t* bytes, std::size_t size) {
+            if (size < 10 || std::memcmp(bytes, "\x93NUMPY", 6) != 0) {
+                throw std::invalid_argument("received data that is not in .npy format");
+            }
+            int major = bytes[6];
+            std::size_t dict_offset = major == 1 ? 10 : 12;
+            if (major < 1 || major > 3 || size < dict_offset) {
+                throw std::invalid_argument("received .npy data of unknown version");
+            }
+            std::size_t dict_size = major == 1 ? readLittle<std::uint16_t>(bytes + 8) : readLittle<std::uint32_t>(bytes + 8);
+            if (dict_size > size - dict_offset) {
+                throw std::invalid_argument("received truncated .npy header");
+            }
+            std::string_view dict(reinterpret_cast<const char*>(bytes + dict_offset), dict_size);
+
+            Header header;
+            header.data_offset = dict_offset + dict_size;
+            std::string_view descr = dictValue(dict, "descr");
+            if (descr.size() < 5 || (descr[0] != '\'' && descr[0] != '"') || descr[4] != descr[0]) {
+                throw std::invalid_argument("received unsupported .npy dtype (structured or of several digits)");
+            }
+            header.byte_order = descr[1];
+            header.kind = descr[2];
+            header.item_size = (std::size_t)(descr[3] - '0');
+            // Checked before any item is read: `convertItem` copies `item_size` bytes to a fixed buffer
+            bool known_size = header.item_size == 1 || header.item_size == 2 || header.item_size == 4 || header.item_size == 8;
+            bool known_kind = header.kind == 'f' ? header.item_size >= 4
+                            : header.kind == 'b' ? header.item_size == 1
+                            : header.kind == 'i' || header.kind == 'u';
+            if (!known_size || !known_kind) {
+                throw std::invalid_argument("received unsupported .npy dtype '" + std::string(descr.substr(1, 3)) + "'");
+            }
+            header.fortran_order = dictValue(dict, "fortran_order").starts_with("True");
+
+            std::string_view shape = dictValue(dict, "shape");
+            if (shape.empty() || shape[0] != '(') {
+                throw std::invalid_argument("received .npy header with malformed shape");
+            }
+            for (std::size_t pos = 1; pos < shape.size() && shape[pos] != ')'; ) {
+                if (shape[pos] >= '0' && shape[pos] <= '9') {
+                    Eigen::Index dim = 0;
+                    for (; pos < shape.size() && shape[pos] >= '0' && shape[pos] <= '9'; pos++) {
+                        dim = 10 * dim + (shape[pos] - '0');
+                    }
+                    header.shape.push_back(dim);
+                }
+                else {
+                    pos++;
+                }
+            }
+            return header;
+        }
+
+        // Element @index of raw data of @header's type, converted to @Scalar
+        template<typename Scalar>
+        Scalar convertItem(const Header& header, const std::uint8_t* data, std::size_t index) {
+            std::uint8_t raw[8];
+            std::memcpy(raw, data + index * header.item_size, header.item_size);
+            if (header.byte_order == '>') {
+                std::reverse(raw, raw + header.item_size);
+            }
+            switch (header.kind * 16 + (char)header.item_size) {
+                case 'f' * 16 + 4: return (Scalar)readLittle<float>(raw);
+                case 'f' * 16 + 8: return (Scalar)readLittle<double>(raw);
+                case 'i' * 16 + 1: return (Scalar)readLittle<std::int8_t>(raw);
+                case 'i' * 16 + 2: return (Scalar)readLittle<std::int16_t>(raw);
+                case 'i' * 16 + 4: return (Scalar)readLittle<std::int32_t>(raw);
+                case 'i' * 16 + 8: return (Scalar)readLittle<std::int64_t>(raw);
+                case 'u' * 16 + 1: return (Scalar)readLittle<std::uint8_t>(raw);
+                case 'u' * 16 + 2: return (Scalar)readLittle<std::uint16_t>(raw);
+                case 'u' * 16 + 4: return (Scalar)readLittle<std::uint32_t>(raw);
+                case 'u' * 16 + 8: return (Scalar)readLittle<std::uint64_t>(raw);
+                case 'b' * 16 + 1: return (Scalar)(raw[0] != 0);
+            }
+            throw std::invalid_argument("received unsupported .npy dtype");
+        }
+    }
+
+    // Array stored in @bytes (a .npy image within @file, which the array keeps alive if it maps it)
+    template<typename Scalar>
+    Array<Scalar> fromBytes(std::shared_ptr<MappedFile> file, const std::uint8_t* bytes, std::size_t size) {
+        Detail::Header header = Detail::parseHeader(bytes, size);
+        Array<Scalar> array;
+        array.array_shape = header.shape;
+        std::size_t count = 1;
+        for (Eigen::Index dim : header.shape) {
+            count *= (std::size_t)dim;
+        }
+        array.num_rows = header.shape.empty() ? 1 : header.shape[0];
+        array.num_cols = array.num_rows > 0 ? (Eigen::Index)(count / (std::size_t)array.num_rows) : 0;
+        if (array.num_rows == 0 && header.shape.size() > 1) {
+            array.num_cols = 1;
+            for (std::size_t d = 1; d < header.shape.size(); d++) {
+                array.num_cols *= header.shape[d];
+            }
+        }
+        if (count * header.item_size > size - header.data_offset) {
+            throw std::invalid_argument("received .npy data shorter than its shape");
+        }
+
+        const std::uint8_t* data = bytes + header.data_offset;
+        std::string_view descr = Detail::descr<Scalar>();
+        bool same_type = header.kind == descr[1] && header.item_size == sizeof(Scalar)
+                         && (header.byte_order == '<' || header.byte_order == '|' || header.byte_order == '=');
+        bool contiguous = !header.fortran_order || header.shape.size() < 2;
+        if (same_type && contiguous && (std::uintptr_t)data % alignof(Scalar) == 0) {
+            array.file = std::move(file);
+            array.values = reinterpret_cast<Scalar*>(const_cast<std::uint8_t*>(data));
+            return array;
+        }
+
+        array.owned = std::make_unique<Scalar[]>(count);
+        array.values = array.owned.get();
+        if (contiguous) {
+            for (std::size_t i = 0; i < count; i++) {
+                array.values[i] = Detail::convertItem<Scalar>(header, data, i);
+            }
+            return array;
+        }
+        // Fortran order: C-order position `i` has multi-index `index`, stored at offset `source`
+        std::vector<Eigen::Index> index(header.shape.size(), 0);
+        for (std::size_t i = 0; i < count; i++) {
+            std::size_t source = 0;
+            for (std::size_t d = header.shape.size(); d-- > 0; ) {
+                source = source * (std::size_t)header.shape[d] + (std::size_t)index[d];
+            }
+            array.values[i] = Detail::convertItem<Scalar>(header, data, source);
+            for (std::size_t d = header.shape.size(); d-- > 0 && ++index[d] == header.shape[d]; ) {
+                index[d] = 0;
+            }
+        }
+        return array;
+    }
+
+    // Reads the .npy file @path, mapping it without a copy when possible (see `Array`)
+    template<typename Scalar>
+    Array<Scalar> load(const std::string& path) {
+        auto file = std::make_shared<MappedFile>(path);
+        return fromBytes<Scalar>(file, file->data(), file->size());
+    }
+
+    /*
+    * @brief: .npz archive (as written by `np.savez`), mapped once; its arrays are read like .npy
+    *         files, without a copy when possible. Members compressed by `np.savez_compressed` are
+    *         listed but cannot be read. CRC-32s are not verified, as that would read every page
+    */
+    class Archive {
+    public:
+        explicit Archive(const std::string& path) : file(std::make_shared<MappedFile>(path)) {
+            const std::uint8_t* bytes = file->data();
+            std::size_t size = file->size();
+            auto check = [&](std::size_t offset, std::size_t length) {
+                if (offset > size || length > size - offset) {
+                    throw std::invalid_argument("received truncated or malformed .npz archive " + path);
+                }
+            };
+
+            // End of central directory record: last signature within the final 64 KiB
+            std::size_t eocd = size;
+            for (std::size_t pos = size >= 22 ? size - 22 : 0; size >= 22; pos--) {
+                if (Detail::readLittle<std::uint32_t>(bytes + pos) == 0x06054b50) {
+                    eocd = pos;
+                    break;
+                }
+                if (pos == 0 || size - pos > 22 + 0xffff) {
+                    break;
+                }
+            }
+            check(eocd, 22);
+            std::uint64_t num_entries = Detail::readLittle<std::uint16_t>(bytes + eocd + 10);
+            std::uint64_t directory = Detail::readLittle<std::uint32_t>(bytes + eocd + 16);
+            if (num_entries == 0xffff || directory == 0xffffffff) {
+                // Zip64 locator right before, pointing to the zip64 end of central directory record
+                check(eocd - std::min<std::size_t>(eocd, 20), 20);
+                std::size_t locator = eocd - 20;
+                if (Detail::readLittle<std::uint32_t>(bytes + locator) != 0x07064b50) {
+                    throw std::invalid_argument("received .npz archive without zip64 locator " + path);
+                }
+                std::uint64_t eocd64 = Detail::readLittle<std::uint64_t>(bytes + locator + 8);
+                check(eocd64, 56);
+                num_entries = Detail::readLittle<std::uint64_t>(bytes + eocd64 + 32);
+                directory = Detail::readLittle<std::uint64_t>(bytes + eocd64 + 48);
+            }
+
+            std::size_t pos = directory;
+            for (std::uint64_t e = 0; e < num_entries; e++) {
+                check(pos, 46);
+                if (Detail::readLittle<std::uint32_t>(bytes + pos) != 0x02014b50) {
+                    throw std::invalid_argument("received .npz archive with malformed central directory " + path);
+                }
+                Member member;
+                member.method = Detail::readLittle<std::uint16_t>(bytes + pos + 10);
+                member.encrypted = Detail::readLittle<std::uint16_t>(bytes + pos + 8) & 1;
+                std::uint64_t size_field = Detail::readLittle<std::uint32_t>(bytes + pos + 24);
+                std::uint64_t compressed = Detail::readLittle<std::uint32_t>(bytes + pos + 20);
+                std::uint64_t local = Detail::readLittle<std::uint32_t>(bytes + pos + 42);
+                std::size_t name_size = Detail::readLittle<std::uint16_t>(bytes + pos + 28);
+                std::size_t extra_size = Detail::readLittle<std::uint16_t>(bytes + pos + 30);
+                std::size_t comment_size = Detail::readLittle<std::uint16_t>(bytes + pos + 32);
+                check(pos + 46, name_size + extra_size + comment_size);
+                std::string name(reinterpret_cast<const char*>(bytes + pos + 46), name_size);
+
+                // Zip64 extra field: 64-bit values of the fields saturated above, in this order
+                for (std::size_t x = pos + 46 + name_size; x + 4 <= pos + 46 + name_size + extra_size; ) {
+                    std::uint16_t id = Detail::readLittle<std::uint16_t>(bytes + x);
+                    std::uint16_t length = Detail::readLittle<std::uint16_t>(bytes + x + 2);
+                    if (id == 0x0001) {
+                        std::size_t field = x + 4;
+                        for (std::uint64_t* value : { &size_field, &compressed, &local }) {
+                            if (*value == 0xffffffff && field + 8 <= x + 4 + length) {
+                                *value = Detail::readLittle<std::uint64_t>(bytes + field);
+                                field += 8;
+                            }
+                        }
+                    }
+                    x += 4 + length;
+                }
+                pos += 46 + name_size + extra_size + comment_size;
+
+                check(local, 30);
+                if (Detail::readLittle<std::uint32_t>(bytes + local) != 0x04034b50) {
+                    throw std::invalid_argument("received .npz archive with malformed member " + name);
+                }
+                member.offset = local + 30 + Detail::readLittle<std::uint16_t>(bytes + local + 26)
+                                + Detail::readLittle<std::uint16_t>(bytes + local + 28);
+                member.size = compressed;
+                check(member.offset, member.size);
+                if (name.ends_with(".npy")) {
+                    name.resize(name.size() - 4);
+                }
+                members[name] = member;
+            }
+        }
+
+        // Names of the arrays (keys of `np.savez`), in lexicographic order
+        std::vector<std::string> names() const {
+            std::vector<std::string> keys;
+            for (const auto& [name, member] : members) {
+                keys.push_back(name);
+            }
+            return keys;
+        }
+
+        bool contains(const std::string& name) const {
+            return members.count(name) > 0;
+        }
+
+        template<typename Scalar>
+        Array<Scalar> get(const std::string& name) const {
+            auto it = members.find(name);
+            if (it == members.end()) {
+                throw std::out_of_range("no array " + name + " in .npz archive");
+            }
+            if (it->second.method != 0 || it->second.encrypted) {
+                throw std::invalid_argument("array " + name + " is compressed or encrypted: save with `np.savez`");
+            }
+            return fromBytes<Scalar>(file, file->data() + it->second.offset, it->second.size);
+        }
+
+    private:
+        struct Member {
+            std::size_t offset = 0; // Of the .npy image within the file
+            std::size_t size = 0;
+            std::uint16_t method = 0;
+            bool encrypted = false;
+        };
+
+        std::shared_ptr<MappedFile> file;
+        std::map<std::string, Member> members;
+    };
+
+    namespace Detail {
+        inline std::uint32_t crc32(std::uint32_t crc, const std::uint8_t* data, std::size_t size) {
+            static const auto table = []() {
+                std::array<std::uint32_t, 256> entries;
+                for (std::uint32_t n = 0; n < 256; n++) {
+                    std::uint32_t c = n;
+                    for (int k = 0; k < 8; k++) {
+                        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    }
+                    entries[n] = c;
+                }
+                return entries;
+            }();
+            crc = ~crc;
+            for (std::size_t i = 0; i < size; i++) {
+                crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+            }
+            return ~crc;
+        }
+
+        template<typename T>
+        void putLittle(std::string& bytes, T value) {
+            char raw[sizeof(T)];
+            std::memcpy(raw, &value, sizeof(T));
+            bytes.append(raw, sizeof(T));
+        }
+
+        /*
+        * @brief: Row-major contiguous elements of @array, without a copy if already laid out so.
+        *         Column vectors (e.g. `MatColX`) are saved 1-D, everything else 2-D
+        */
+        template<typename Derived>
+        class Contiguous {
+        public:
+            using Scalar = typename Derived::Scalar;
+
+            explicit Contiguous(const Eigen::DenseBase<Derived>& array) : num_rows(array.rows()), num_cols(array.cols()) {
+                if constexpr (std::is_base_of_v<Eigen::PlainObjectBase<Derived>, Derived>
+                              && (Derived::IsRowMajor || Derived::IsVectorAtCompileTime)) {
+                    values = array.derived().data();
+                }
+                else {
+                    storage = array;
+                    values = storage.data();
+                }
+            }
+
+            std::string shape() const {
+                if constexpr (Derived::ColsAtCompileTime == 1) {
+                    return "(" + std::to_string(num_rows) + ",)";
+                }
+                else {
+                    return "(" + std::to_string(num_rows) + ", " + std::to_string(num_cols) + ")";
+                }
+            }
+
+            const std::uint8_t* data() const {
+                return reinterpret_cast<const std::uint8_t*>(values);
+            }
+
+            std::size_t size() const {
+                return (std::size_t)(num_rows * num_cols) * sizeof(Scalar);
+            }
+
+        private:
+            Eigen::Index num_rows;
+            Eigen::Index num_cols;
+            ArrayX_RowMajor<Scalar> storage;
+            const Scalar* values = nullptr;
+        };
+
+        // .npy magic, version and header, padded so that the data starts 64-byte aligned
+        template<typename Scalar>
+        std::string npyHeader(const std::string& shape) {
+            std::string dict = std::string("{'descr': '") + descr<Scalar>() + "', 'fortran_order': False, 'shape': " + shape + ", }";
+            bool wide = dict.size() + 11 > 0xffff;
+            std::size_t prefix = wide ? 12 : 10;
+            dict.append(63 - (prefix + dict.size()) % 64, ' ');
+            dict.push_back('\n');
+
+            std::string header("\x93NUMPY", 6);
+            header.push_back(wide ? 2 : 1);
+            header.push_back(0);
+            if (wide) {
+                putLittle(header, (std::uint32_t)dict.size());
+            }
+            else {
+                putLittle(header, (std::uint16_t)dict.size());
+            }
+            return header + dict;
+        }
+
+        inline void writeBytes(std::ofstream& file, const void* data, std::size_t size) {
+            file.write(static_cast<const char*>(data), (std::streamsize)size);
+        }
+    }
+
+    // Writes @array to the .npy file @path, in C order, with no conversion of its elements
+    template<typename Derived>
+    void save(const std::string& path, const Eigen::DenseBase<Derived>& array) {
+        Detail::Contiguous<Derived> contiguous(array);
+        std::string header = Detail::npyHeader<typename Derived::Scalar>(contiguous.shape());
+        std::ofstream file(path, std::ios::binary);
+        Detail::writeBytes(file, header.data(), header.size());
+        Detail::writeBytes(file, contiguous.data(), contiguous.size());
+        if (!file) {
+            throw std::runtime_error("failed to write " + path);
+        }
+    }
+
+    /*
+    * @brief: Writes arrays to an uncompressed .npz archive, read by `np.load` or `Archive`. Each
+    *         array is written as it is added; the directory is written by `close`, which the
+    *         destructor calls (call it explicitly to be told of errors). Zip64 records are always
+    *         written, as `np.savez` does, so archives may exceed 4 GiB. Array data is 64-byte
+    *         aligned within the file, so that `Archive` maps it without a copy
+    */
+    class NpzWriter {
+    public:
+        explicit NpzWriter(const std::string& path) : path(path), file(path, std::ios::binary) {
+            if (!file) {
+                throw std::runtime_error("cannot open " + path);
+            }
+        }
+
+        NpzWriter(const NpzWriter&) = delete;
+        NpzWriter& operator=(const NpzWriter&) = delete;
+
+        ~NpzWriter() {
+            try {
+                close();
+            }
+            catch (...) {}
+        }
+
+        template<typename Derived>
+        void add(const std::string& name, const Eigen::DenseBase<Derived>& array) {
+            if (closed) {
+                throw std::logic_error("cannot add to a closed .npz archive");
+            }
+            Detail::Contiguous<Derived> contiguous(array);
+            std::string header = Detail::npyHeader<typename Derived::Scalar>(contiguous.shape());
+            Entry entry{ name + ".npy", 0, header.size() + contiguous.size(), offset };
+            entry.crc = Detail::crc32(0, reinterpret_cast<const std::uint8_t*>(header.data()), header.size());
+            entry.crc = Detail::crc32(entry.crc, contiguous.data(), contiguous.size());
+
+            // Extra fields: zip64 sizes, then padding (an unassigned id) aligning the .npy image
+            std::size_t unpadded = offset + 30 + entry.name.size() + 20 + 4;
+            std::size_t padding = (64 - unpadded % 64) % 64;
+            std::string local;
+            Detail::putLittle(local, (std::uint32_t)0x04034b50);
+            putCommon(local, entry);
+            Detail::putLittle(local, (std::uint32_t)0xffffffff);
+            Detail::putLittle(local, (std::uint32_t)0xffffffff);
+            Detail::putLittle(local, (std::uint16_t)entry.name.size());
+            Detail::putLittle(local, (std::uint16_t)(20 + 4 + padding));
+            local += entry.name;
+            Detail::putLittle(local, (std::uint16_t)0x0001);
+            Detail::putLittle(local, (std::uint16_t)16);
+            Detail::putLittle(local, (std::uint64_t)entry.size);
+            Detail::putLittle(local, (std::uint64_t)entry.size);
+            Detail::putLittle(local, (std::uint16_t)0x4e50);
+            Detail::putLittle(local, (std::uint16_t)padding);
+            local.append(padding, '\0');
+
+            Detail::writeBytes(file, local.data(), local.size());
+            Detail::writeBytes(file, header.data(), header.size());
+            Detail::writeBytes(file, contiguous.data(), contiguous.size());
+            if (!file) {
+                throw std::runtime_error("failed to write " + path);
+            }
+            offset += local.size() + entry.size;
+            entries.push_back(std::move(entry));
+        }
+
+        // Writes the central directory and closes the file. Further calls do nothing
+        void close() {
+            if (closed) {
+                return;
+            }
+            closed = true;
+            std::string directory;
+            for (const auto& entry : entries) {
+                Detail::putLittle(directory, (std::uint32_t)0x02014b50);
+                Detail::putLittle(directory, (std::uint16_t)45); // Version made by
+                putCommon(directory, entry);
+                Detail::putLittle(directory, (std::uint32_t)0xffffffff);
+                Detail::putLittle(directory, (std::uint32_t)0xffffffff);
+                Detail::putLittle(directory, (std::uint16_t)entry.name.size());
+                Detail::putLittle(directory, (std::uint16_t)28);
+                Detail::putLittle(directory, (std::uint16_t)0); // Comment
+                Detail::putLittle(directory, (std::uint16_t)0); // Disk
+                Detail::putLittle(directory, (std::uint16_t)0); // Internal attributes
+                Detail::putLittle(directory, (std::uint32_t)(0100644u << 16)); // Regular file, rw-r--r--
+                Detail::putLittle(directory, (std::uint32_t)0xffffffff);
+                directory += entry.name;
+                Detail::putLittle(directory, (std::uint16_t)0x0001);
+                Detail::putLittle(directory, (std::uint16_t)24);
+                Detail::putLittle(directory, (std::uint64_t)entry.size);
+                Detail::putLittle(directory, (std::uint64_t)entry.size);
+                Detail::putLittle(directory, (std::uint64_t)entry.offset);
+            }
+
+            std::uint64_t end = offset + directory.size();
+            Detail::putLittle(directory, (std::uint32_t)0x06064b50); // Zip64 end of central directory
+            Detail::putLittle(directory, (std::uint64_t)44);
+            Detail::putLittle(directory, (std::uint16_t)45);
+            Detail::putLittle(directory, (std::uint16_t)45);
+            Detail::putLittle(directory, (std::uint32_t)0);
+            Detail::putLittle(directory, (std::uint32_t)0);
+            Detail::putLittle(directory, (std::uint64_t)entries.size());
+            Detail::putLittle(directory, (std::uint64_t)entries.size());
+            Detail::putLittle(directory, (std::uint64_t)(end - offset));
+            Detail::putLittle(directory, (std::uint64_t)offset);
+            Detail::putLittle(directory, (std::uint32_t)0x07064b50); // Zip64 locator
+            Detail::putLittle(directory, (std::uint32_t)0);
+            Detail::putLittle(directory, end);
+            Detail::putLittle(directory, (std::uint32_t)1);
+            Detail::putLittle(directory, (std::uint32_t)0x06054b50); // End of central directory
+            Detail::putLittle(directory, (std::uint16_t)0);
+            Detail::putLittle(directory, (std::uint16_t)0);
+            Detail::putLittle(directory, (std::uint16_t)0xffff);
+            Detail::putLittle(directory, (std::uint16_t)0xffff);
+            Detail::putLittle(directory, (std::uint32_t)0xffffffff);
+            Detail::putLittle(directory, (std::uint32_t)0xffffffff);
+            Detail::putLittle(directory, (std::uint16_t)0);
+
+            Detail::writeBytes(file, directory.data(), directory.size());
+            file.close();
+            if (!file) {
+                throw std::runtime_error("failed to write " + path);
+            }
+        }
+
+    private:
+        struct Entry {
+            std::string name;
+            std::uint32_t crc;
+            std::uint64_t size;
+            std::uint64_t offset;
+        };
+
+        // Fields shared by local and central headers, from the version needed to the CRC-32
+        static void putCommon(std::string& bytes, const Entry& entry) {
+            Detail::putLittle(bytes, (std::uint16_t)45); // Version needed: zip64
+            Detail::putLittle(bytes, (std::uint16_t)0);  // Flags
+            Detail::putLittle(bytes, (std::uint16_t)0);  // Stored, no compression
+            Detail::putLittle(bytes, (std::uint16_t)0);  // Time
+            Detail::putLittle(bytes, (std::uint16_t)0x21); // Date: 1980-01-01
+            Detail::putLittle(bytes, entry.crc);
+        }
+
+        std::string path;
+        std::ofstream file;
+        std::vector<Entry> entries;
+        std::uint64_t offset = 0;
+        bool closed = false;
+    };
+}
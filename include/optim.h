@@ -0,0 +1,236 @@
+// optim.h: Contains facilities implementing layer-wise adaptive optimizers (LARS, LAMB)
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/paral.h"
+#include "layers.h"
+
+namespace Neural {
+    /*
+    * @brief: Trust-ratio rules of `LayerwiseOptimizer`. `LARS` scales momentum SGD, `LAMB` scales
+    *         Adam; both rescale each layer's step by the ratio of its weight norm to its update norm
+    */
+    enum class TrustRatio {LARS, LAMB};
+
+    /*
+    * @brief: Settings of `LayerwiseOptimizer`
+    *
+    * `lr`: base learning rate, reached linearly over the first `warmup_steps` steps
+    * `momentum`: momentum of `LARS`
+    * `trust_coef`: trust coefficient of `LARS` (`eta`); the local rate of a layer is
+    *               `trust_coef * |w| / (|g| + weight_decay * |w|)`
+    * `beta1`, `beta2`, `epsilon`: moment decay rates and denominator offset of `LAMB`
+    * `weight_decay`: decoupled weight decay, included in the update whose norm is taken
+    */
+    struct LayerwiseOptions {
+        float lr = 0.01f;
+        int warmup_steps = 0;
+        float momentum = 0.9f;
+        float trust_coef = 0.001f;
+        float beta1 = 0.9f;
+        float beta2 = 0.999f;
+        float epsilon = 1e-6f;
+        float weight_decay = 0.0f;
+    };
+
+    /*
+    * @brief: Layer-wise adaptive optimizer for large-batch training (You et al., 2017 and 2019),
+    *         driven by `FeedFwdNN::train(LayerwiseOptimizer&, ...)`
+    *
+    * A step takes, per layer, its `parameters()` (see `ParamView`) and their gradients. Parameters
+    * are split into chunks processed in parallel across and within layers: a first sweep computes
+    * partial weight and update norms (for `LAMB`, while updating the moments), which are reduced
+    * per layer, and a second applies the scaled update. Optimizer state (momentum or moments) is
+    * allocated on the first step and tied to the layer order.
+    */
+    class LayerwiseOptimizer {
+    public:
+        explicit LayerwiseOptimizer(TrustRatio rule, LayerwiseOptions options = {}) : rule(rule), options(options) {
+            if (options.lr < 0 || options.warmup_steps < 0 || options.weight_decay < 0) {
+                throw std::invalid_argument("received invalid optimizer settings");
+            }
+        }
+
+        // Learning rate of the next step, after warmup
+        float learningRate() const {
+            if (num_steps >= options.warmup_steps) {
+                return options.lr;
+            }
+            return options.lr * (float)(num_steps + 1) / (float)options.warmup_steps;
+        }
+
+        // Changes the base learning rate (e.g. for decay), warmup included
+        void setLearningRate(float lr) {
+            if (lr < 0) {
+                throw std::invalid_argument("received negative value for learning rate @lr");
+            }
+            options.lr = lr;
+        }
+
+        int steps() const {
+            return num_steps;
+        }
+
+        // Factor applied to the learning rate of each layer by the last step (trust coefficient included)
+        const std::vector<float>& trustRatios() const {
+            return trust_ratios;
+        }
+
+        /*
+        * @brief: Updates @layers, each given as the views of its parameters, from @gradients laid out
+        *         alike (as returned by `parameterGradients`)
+        */
+        void step(std::vector<std::vector<ParamView>>& layers, const std::vector<std::vector<MatColX<float>>>& gradients) {
+            if (layers.size() != gradients.size()) {
+                throw std::invalid_argument("number of layers of @layers and @gradients differ");
+            }
+            if (state.empty()) {
+                allocateState(layers);
+            }
+            checkShapes(layers, gradients);
+
+            float lr = learningRate();
+            num_steps++;
+            float correction1 = 1.0f - std::pow(options.beta1, (float)num_steps);
+            float correction2 = 1.0f - std::pow(options.beta2, (float)num_steps);
+            // Adam direction of `LAMB` plus decoupled weight decay, from the moments and weights of a chunk
+            auto lamb_update = [&](const auto& m, const auto& v, const auto& w) {
+                return (m / correction1) / ((v / correction2).sqrt() + options.epsilon) + options.weight_decay * w;
+            };
+
+            // Sweep 1 over all chunks of all layers: squared norms of weights and gradients (`LARS`)
+            // or updates (`LAMB`, which also updates the moments)
+            std::vector<double> weight_sq(chunks.size()), other_sq(chunks.size());
+            rangeParExec(
+                chunks.size(),
+                [&](int& c) {
+                    const Chunk& chunk = chunks[c];
+                    auto w = layers[chunk.layer][chunk.block].segment(chunk.first, chunk.size).array();
+                    auto g = gradients[chunk.layer][chunk.block].segment(chunk.first, chunk.size).array();
+                    BlockState& block = state[chunk.layer][chunk.block];
+                    weight_sq[c] = w.matrix().squaredNorm();
+                    if (rule == TrustRatio::LARS) {
+                        other_sq[c] = g.matrix().squaredNorm();
+                        return;
+                    }
+                    auto m = block.first.segment(chunk.first, chunk.size);
+                    auto v = block.second.segment(chunk.first, chunk.size);
+                    m = options.beta1 * m + (1.0f - options.beta1) * g;
+                    v = options.beta2 * v + (1.0f - options.beta2) * g.square();
+                    other_sq[c] = lamb_update(m, v, w).matrix().squaredNorm();
+                }
+            );
+
+            // Per-layer norms, summed in chunk order so that results do not depend on scheduling
+            std::vector<double> layer_weight_sq(layers.size(), 0.0), layer_other_sq(layers.size(), 0.0);
+            for (std::size_t c = 0; c < chunks.size(); c++) {
+                layer_weight_sq[chunks[c].layer] += weight_sq[c];
+                layer_other_sq[chunks[c].layer] += other_sq[c];
+            }
+            trust_ratios.resize(layers.size());
+            for (std::size_t l = 0; l < layers.size(); l++) {
+                trust_ratios[l] = rule == TrustRatio::LARS ? larsTrust(layer_weight_sq[l], layer_other_sq[l])
+                                                           : ratio(layer_weight_sq[l], layer_other_sq[l]);
+            }
+
+            // Sweep 2: scaled updates. For `LAMB`, the update is recomputed from the moments rather
+            // than stored by the first sweep
+            rangeParExec(
+                chunks.size(),
+                [&](int& c) {
+                    const Chunk& chunk = chunks[c];
+                    float local_lr = lr * trust_ratios[chunk.layer];
+                    auto w = layers[chunk.layer][chunk.block].segment(chunk.first, chunk.size).array();
+                    BlockState& block = state[chunk.layer][chunk.block];
+                    if (rule == TrustRatio::LARS) {
+                        auto g = gradients[chunk.layer][chunk.block].segment(chunk.first, chunk.size).array();
+                        auto velocity = block.first.segment(chunk.first, chunk.size);
+                        velocity = options.momentum * velocity + local_lr * (g + options.weight_decay * w);
+                        w -= velocity;
+                        return;
+                    }
+                    w -= local_lr * lamb_update(block.first.segment(chunk.first, chunk.size),
+                                                block.second.segment(chunk.first, chunk.size), w);
+                }
+            );
+        }
+
+    private:
+        // Length of the chunks swept at once by both passes, small enough to stay in cache; chunks
+        // are also the unit of parallel work
+        constexpr static Eigen::Index chunk_size = 1024;
+
+        // First and second moments (`LAMB`) or momentum (`LARS`, `first` only) of one parameter block
+        struct BlockState {
+            ArrColX<float> first;
+            ArrColX<float> second;
+        };
+
+        // Range of `chunk_size` (or fewer) parameters of block @block of layer @layer
+        struct Chunk {
+            std::size_t layer;
+            std::size_t block;
+            Eigen::Index first;
+            Eigen::Index size;
+        };
+
+        void allocateState(const std::vector<std::vector<ParamView>>& layers) {
+            state.resize(layers.size());
+            for (std::size_t l = 0; l < layers.size(); l++) {
+                for (std::size_t b = 0; b < layers[l].size(); b++) {
+                    Eigen::Index size = layers[l][b].size();
+                    BlockState block;
+                    block.first = ArrColX<float>::Zero(size);
+                    if (rule == TrustRatio::LAMB) {
+                        block.second = ArrColX<float>::Zero(size);
+                    }
+                    state[l].push_back(std::move(block));
+                    for (Eigen::Index i = 0; i < size; i += chunk_size) {
+                        chunks.push_back({ l, b, i, std::min(chunk_size, size - i) });
+                    }
+                }
+            }
+        }
+
+        void checkShapes(const std::vector<std::vector<ParamView>>& layers,
+                         const std::vector<std::vector<MatColX<float>>>& gradients) const {
+            if (layers.size() != state.size()) {
+                throw std::invalid_argument("number of layers changed since first step");
+            }
+            for (std::size_t l = 0; l < layers.size(); l++) {
+                if (layers[l].size() != state[l].size() || gradients[l].size() != state[l].size()) {
+                    throw std::invalid_argument("parameter blocks of a layer changed since first step");
+                }
+                for (std::size_t b = 0; b < layers[l].size(); b++) {
+                    if (layers[l][b].size() != state[l][b].first.size() || gradients[l][b].size() != layers[l][b].size()) {
+                        throw std::invalid_argument("shape of a parameter block changed since first step");
+                    }
+                }
+            }
+        }
+
+        // `|w| / |u|`, or 1 if either norm vanishes (e.g. zero-initialized layer, or no gradient)
+        static float ratio(double weight_sq, double update_sq) {
+            return (weight_sq > 0 && update_sq > 0) ? (float)std::sqrt(weight_sq / update_sq) : 1.0f;
+        }
+
+        // Trust ratio of `LARS` (trust coefficient included), from squared weight and gradient norms
+        float larsTrust(double weight_sq, double gradient_sq) const {
+            double decay = options.weight_decay;
+            double update_sq = gradient_sq > 0 ? std::pow(std::sqrt(gradient_sq) + decay * std::sqrt(weight_sq), 2) : 0.0;
+            return (weight_sq > 0 && update_sq > 0) ? options.trust_coef * ratio(weight_sq, update_sq) : 1.0f;
+        }
+
+        TrustRatio rule;
+        LayerwiseOptions options;
+        int num_steps = 0;
+        std::vector<std::vector<BlockState>> state;
+        std::vector<Chunk> chunks;
+        std::vector<float> trust_ratios;
+    };
+}
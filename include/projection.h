@@ -0,0 +1,190 @@
+// projection.h: Contains facilities for fixed random-projection layers
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/traits_concepts.h"
+#include "../utilities/paral.h"
+#include "../utilities/random.h"
+
+namespace Neural {
+    /*
+    * @brief: In-place, unnormalized Walsh-Hadamard transform of @data, of power-of-two @size
+    *
+    * The first three stages are fused into one radix-8 pass over contiguous blocks of 8; the
+    * remaining stages operate on contiguous segments of at least 8 floats, which Eigen vectorizes
+    */
+    inline void walshHadamard(float* data, Eigen::Index size) {
+        Eigen::Index h = 1;
+        if (size >= 8) {
+            for (Eigen::Index i = 0; i < size; i += 8) {
+                float* x = data + i;
+                float a0 = x[0] + x[1], a1 = x[0] - x[1], a2 = x[2] + x[3], a3 = x[2] - x[3];
+                float a4 = x[4] + x[5], a5 = x[4] - x[5], a6 = x[6] + x[7], a7 = x[6] - x[7];
+                float b0 = a0 + a2, b1 = a1 + a3, b2 = a0 - a2, b3 = a1 - a3;
+                float b4 = a4 + a6, b5 = a5 + a7, b6 = a4 - a6, b7 = a5 - a7;
+                x[0] = b0 + b4; x[1] = b1 + b5; x[2] = b2 + b6; x[3] = b3 + b7;
+                x[4] = b0 - b4; x[5] = b1 - b5; x[6] = b2 - b6; x[7] = b3 - b7;
+            }
+            h = 8;
+        }
+        for (; h < size; h *= 2) {
+            for (Eigen::Index i = 0; i < size; i += 2 * h) {
+                Eigen::Map<Eigen::ArrayXf> low(data + i, h), high(data + i + h, h);
+                for (Eigen::Index j = 0; j < h; j += 1024) {
+                    // Segments of up to 1024 floats keep the temporary on the stack
+                    Eigen::Index len = std::min<Eigen::Index>(1024, h - j);
+                    Eigen::Array<float, Eigen::Dynamic, 1, 0, 1024, 1> sum = low.segment(j, len) + high.segment(j, len);
+                    high.segment(j, len) = low.segment(j, len) - high.segment(j, len);
+                    low.segment(j, len) = sum;
+                }
+            }
+        }
+    }
+
+    /*
+    * @brief: Encapsulates a fixed (non-trainable) random projection, computed as a subsampled
+    *         randomized Hadamard transform (fast Johnson-Lindenstrauss transform)
+    *
+    * Every row is zero-padded to `d`, the smallest power of two fitting @in_dim, multiplied by
+    * random signs, transformed by `walshHadamard`, and @out_dim coordinates sampled without
+    * replacement are kept, scaled by `1 / sqrt(out_dim)` so that squared norms are preserved in
+    * expectation. Costs `O(d log d)` per row and `O(d)` memory, against `O(in_dim * out_dim)`
+    * for both with a dense layer.
+    *
+    * Meant as first layer of `FeedFwdNN`, ahead of the trainable ones: unless
+    * @propagate_gradient is set, `backPropagate` returns an empty gradient wrt the inputs.
+    *
+    * @tparam EigenType: Must be `Eigen::T<float, Eigen::Dynamic, Eigen::Dynamic>`
+    * where `T` is `Array` or `Matrix`
+    */
+    template <typename EigenType>
+    class RandomProjectionLayer {
+    public:
+        RandomProjectionLayer(Eigen::Index in_dim, Eigen::Index out_dim, std::uint64_t stream, int seed = 42,
+                              bool propagate_gradient = false) :
+            in_dim(in_dim), out_dim(out_dim), propagate_gradient(propagate_gradient)
+        {
+            if (in_dim <= 0 || out_dim <= 0) {
+                throw std::invalid_argument("received non-positive dimensions");
+            }
+            padded_dim = 1;
+            while (padded_dim < in_dim) {
+                padded_dim *= 2;
+            }
+            if (out_dim > padded_dim) {
+                throw std::invalid_argument("@out_dim exceeds the padded input dimension");
+            }
+
+            std::vector<std::uint32_t> words(4 * ((in_dim + 3) / 4));
+            Philox(seed, Philox::substream(stream, 0)).words(0, words.size() / 4, words.data());
+            signs.resize(in_dim);
+            for (Eigen::Index j = 0; j < in_dim; j++) {
+                signs(j) = (words[j] & 1u) ? 1.0f : -1.0f;
+            }
+
+            // Sorted, so that gathers from the transformed row move forward in memory
+            MatColX<int> permutation = Philox(seed, Philox::substream(stream, 1)).permutation(padded_dim);
+            samples.assign(permutation.data(), permutation.data() + out_dim);
+            std::sort(samples.begin(), samples.end());
+
+            scale = 1.0f / std::sqrt((float)out_dim);
+        }
+
+        constexpr static bool has_weights = false;
+
+        auto feedForward(const MatrixX_RowMajor_Ref<float>& inputs) {
+            if (inputs.cols() != in_dim) {
+                throw std::invalid_argument("number of columns of @inputs does not match layer");
+            }
+            MatrixX_RowMajor<float> outputs(inputs.rows(), out_dim);
+
+            forEachRow(inputs.rows(), [&](Eigen::Index r, float* work) {
+                Eigen::Map<ArrRowX<float>> row(work, padded_dim);
+                row.head(in_dim) = inputs.row(r).array() * signs;
+                row.tail(padded_dim - in_dim).setZero();
+                walshHadamard(work, padded_dim);
+                for (Eigen::Index i = 0; i < out_dim; i++) {
+                    outputs(r, i) = scale * work[samples[i]];
+                }
+            });
+
+            auto outputs_eval = MatOrArray<EigenType>::eval(outputs);
+            return std::make_pair(outputs_eval, outputs_eval);
+        }
+
+        // Returns @tgradient and, if `propagate_gradient` is set, the gradient wrt the inputs
+        // (transpose of the projection: scatter, transform, sign flips). Empty otherwise
+        auto backPropagate(const ArrayX_RowMajor_Ref<float>& signals,
+                           const ArrayX_RowMajor_Ref<float>& tgradient) {
+            if (tgradient.cols() != out_dim) {
+                throw std::invalid_argument("number of columns of @tgradient does not match layer");
+            }
+            MatrixX_RowMajor<float> new_tgradient;
+
+            if (propagate_gradient) {
+                new_tgradient.resize(tgradient.rows(), in_dim);
+                forEachRow(tgradient.rows(), [&](Eigen::Index r, float* work) {
+                    Eigen::Map<ArrRowX<float>> row(work, padded_dim);
+                    row.setZero();
+                    for (Eigen::Index i = 0; i < out_dim; i++) {
+                        work[samples[i]] = scale * tgradient(r, i);
+                    }
+                    walshHadamard(work, padded_dim);
+                    new_tgradient.row(r).array() = row.head(in_dim) * signs;
+                });
+            }
+
+            return std::make_pair(MatOrArray<EigenType>::eval(tgradient.matrix()),
+                                  MatOrArray<EigenType>::eval(new_tgradient));
+        }
+
+        // Non-trainable: no-op
+        void updateWeights(const MatrixX_RowMajor_Ref<float>&, const MatrixX_RowMajor_Ref<float>&, float) {
+            return;
+        }
+
+        Eigen::Index inputDim() const {
+            return in_dim;
+        }
+
+        Eigen::Index outputDim() const {
+            return out_dim;
+        }
+
+    private:
+        // Calls @func(row, work) for every row in parallel. Rows are dealt to one task per hardware
+        // thread, each owning a row of `workspace` of `padded_dim` floats
+        template <typename RowFunction>
+        void forEachRow(Eigen::Index num_rows, const RowFunction& func) {
+            Eigen::Index num_tasks = std::min<Eigen::Index>(num_rows, std::max(1u, std::thread::hardware_concurrency()));
+            workspace.resize(num_tasks, padded_dim);
+            rangeParExec(
+                num_tasks,
+                [&](int& task) {
+                    for (Eigen::Index r = task; r < num_rows; r += num_tasks) {
+                        func(r, workspace.row(task).data());
+                    }
+                }
+            );
+        }
+
+        Eigen::Index in_dim;
+        Eigen::Index out_dim;
+        Eigen::Index padded_dim;
+        bool propagate_gradient;
+
+        ArrRowX<float> signs;
+        std::vector<int> samples;
+        float scale;
+
+        MatrixX_RowMajor<float> workspace;
+    };
+}
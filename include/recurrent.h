@@ -0,0 +1,289 @@
+// recurrent.h: Contains facilities for constructing recurrent (LSTM, GRU) layers
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/traits_concepts.h"
+#include "../utilities/random.h"
+
+namespace Neural {
+    enum class Cell {LSTM, GRU};
+
+    /*
+    * @brief: Encapsulates an LSTM or GRU layer over fixed-length sequences
+    *
+    * Every row of the layer's inputs holds one sequence of @seq_len steps of @in_dim features,
+    * flattened time-major (`t * in_dim + d`). Outputs are either the final hidden state
+    * (`hidden_dim` columns) or, with @return_sequences, all hidden states flattened the same way.
+    *
+    * - The input projection of all timesteps is one `(rows * seq_len) x in_dim` GEMM, done
+    *   before the recurrence.
+    * - Gate weights are concatenated (LSTM: [i, f, g, o], GRU: [r, z, n]) so every step does a
+    *   single recurrent GEMM, followed by one vectorized pass applying all gate nonlinearities.
+    * - Backpropagation through time runs over the last @bptt_steps steps only (all steps if
+    *   zero); step caches are kept for those steps only, bounding memory.
+    *
+    * Weight gradients are computed by `backPropagate` and applied by `updateWeights`.
+    *
+    * @tparam EigenType: Must be `Eigen::T<float, Eigen::Dynamic, Eigen::Dynamic>`
+    * where `T` is `Array` or `Matrix`
+    */
+    template <typename EigenType>
+    class RecurrentLayer {
+    public:
+        RecurrentLayer(Cell cell, Eigen::Index in_dim, Eigen::Index hidden_dim, Eigen::Index seq_len,
+                       std::uint64_t stream, bool return_sequences = false, Eigen::Index bptt_steps = 0,
+                       int seed = 42) :
+            cell(cell), in_dim(in_dim), hidden_dim(hidden_dim), seq_len(seq_len),
+            return_sequences(return_sequences),
+            num_cached(bptt_steps > 0 ? std::min(bptt_steps, seq_len) : seq_len)
+        {
+            if (in_dim <= 0 || hidden_dim <= 0 || seq_len <= 0 || bptt_steps < 0) {
+                throw std::invalid_argument("received non-positive dimensions");
+            }
+            num_gates = cell == Cell::LSTM ? 4 : 3;
+            Eigen::Index gates_dim = num_gates * hidden_dim;
+
+            // Xavier uniform, per gate
+            Philox rng(seed, Philox::substream(stream, 0));
+            float bound_x = std::sqrt(6.0f / (float)(in_dim + hidden_dim));
+            float bound_h = std::sqrt(3.0f / (float)hidden_dim);
+            input_weights.resize(in_dim + 1, gates_dim);
+            recurrent_weights.resize(hidden_dim, gates_dim);
+            rng.fillUniform(input_weights, -bound_x, bound_x);
+            rng = Philox(seed, Philox::substream(stream, 1));
+            rng.fillUniform(recurrent_weights, -bound_h, bound_h);
+
+            input_weights.row(in_dim).setZero();
+            if (cell == Cell::LSTM) {
+                // Forget gate bias of one: remember by default
+                input_weights.row(in_dim).segment(hidden_dim, hidden_dim).setOnes();
+            }
+            candidate_bias = MatRowX<float>::Zero(hidden_dim);
+        }
+
+        auto feedForward(const MatrixX_RowMajor_Ref<float>& inputs) {
+            if (inputs.cols() != seq_len * in_dim) {
+                throw std::invalid_argument("number of columns of @inputs does not match `seq_len * in_dim`");
+            }
+            const Eigen::Index num_rows = inputs.rows(), H = hidden_dim, G = num_gates * hidden_dim;
+
+            // Time-batched input projection: rows of @inputs reinterpreted as `(rows * seq_len) x in_dim`
+            Eigen::Map<const MatrixX_RowMajor<float>> steps(inputs.data(), num_rows * seq_len, in_dim);
+            MatrixX_RowMajor<float> projected = steps * input_weights.topRows(in_dim);
+            projected.rowwise() += input_weights.row(in_dim);
+
+            gates.resize(num_cached);
+            cells.resize(num_cached + 1);
+            candidate_hidden.resize(num_cached);
+            hiddens.resize(num_cached + 1);
+
+            MatrixX_RowMajor<float> outputs(num_rows, return_sequences ? seq_len * H : H);
+            MatrixX_RowMajor<float> h = MatrixX_RowMajor<float>::Zero(num_rows, H);
+            MatrixX_RowMajor<float> c = MatrixX_RowMajor<float>::Zero(num_rows, H);
+            MatrixX_RowMajor<float> a(num_rows, G), h_proj(num_rows, G);
+
+            for (Eigen::Index t = 0; t < seq_len; t++) {
+                Eigen::Index slot = t - (seq_len - num_cached);
+                if (slot == 0) {
+                    hiddens[0] = h;
+                    cells[0] = c;
+                }
+
+                h_proj.noalias() = h * recurrent_weights;
+                a = stepRows(projected, t);
+
+                if (cell == Cell::LSTM) {
+                    a += h_proj;
+                    a.leftCols(2 * H) = sigmoid(a.leftCols(2 * H));
+                    a.middleCols(2 * H, H) = a.middleCols(2 * H, H).array().tanh().matrix();
+                    a.rightCols(H) = sigmoid(a.rightCols(H));
+
+                    c = (a.middleCols(H, H).array() * c.array()
+                         + a.leftCols(H).array() * a.middleCols(2 * H, H).array()).matrix();
+                    h = (a.rightCols(H).array() * c.array().tanh()).matrix();
+
+                    if (slot >= 0) {
+                        cells[slot + 1] = c;
+                    }
+                }
+                else {
+                    a.leftCols(2 * H) = sigmoid(a.leftCols(2 * H) + h_proj.leftCols(2 * H));
+                    MatrixX_RowMajor<float> hn = h_proj.rightCols(H);
+                    hn.rowwise() += candidate_bias;
+                    a.rightCols(H) = (a.rightCols(H).array() + a.leftCols(H).array() * hn.array()).tanh().matrix();
+
+                    auto z = a.middleCols(H, H).array();
+                    h = ((1 - z) * a.rightCols(H).array() + z * h.array()).matrix();
+
+                    if (slot >= 0) {
+                        candidate_hidden[slot] = std::move(hn);
+                    }
+                }
+
+                if (slot >= 0) {
+                    gates[slot] = a;
+                    hiddens[slot + 1] = h;
+                }
+                if (return_sequences) {
+                    outputs.middleCols(t * H, H) = h;
+                }
+            }
+            if (!return_sequences) {
+                outputs = h;
+            }
+            last_rows = num_rows;
+
+            auto outputs_eval = MatOrArray<EigenType>::eval(outputs);
+            return std::make_pair(outputs_eval, outputs_eval);
+        }
+
+        /*
+        * @brief: Backpropagation through (the last `bptt_steps`) time steps. Returns @tgradient
+        *         (gradient wrt the layer's outputs) and the gradient wrt the layer's inputs
+        */
+        auto backPropagate(const ArrayX_RowMajor_Ref<float>& signals,
+                           const ArrayX_RowMajor_Ref<float>& tgradient) {
+            const Eigen::Index num_rows = tgradient.rows(), H = hidden_dim, G = num_gates * hidden_dim;
+            if (num_rows != last_rows || tgradient.cols() != (return_sequences ? seq_len * H : H)) {
+                throw std::invalid_argument("shape of @tgradient does not match last forward pass");
+            }
+
+            // Gradients wrt pre-activation input projections, one row per (sequence, step)
+            MatrixX_RowMajor<float> d_projected = MatrixX_RowMajor<float>::Zero(num_rows * seq_len, G);
+            grad_recurrent = MatrixX_RowMajor<float>::Zero(H, G);
+            grad_candidate_bias = MatRowX<float>::Zero(H);
+
+            MatrixX_RowMajor<float> dh = MatrixX_RowMajor<float>::Zero(num_rows, H);
+            MatrixX_RowMajor<float> dc = MatrixX_RowMajor<float>::Zero(num_rows, H);
+            MatrixX_RowMajor<float> da(num_rows, G);
+
+            for (Eigen::Index t = seq_len - 1; t >= seq_len - num_cached; t--) {
+                Eigen::Index slot = t - (seq_len - num_cached);
+                const MatrixX_RowMajor<float>& a = gates[slot];
+                const MatrixX_RowMajor<float>& h_prev = hiddens[slot];
+
+                if (return_sequences) {
+                    dh += tgradient.middleCols(t * H, H).matrix();
+                }
+                else if (t == seq_len - 1) {
+                    dh += tgradient.matrix();
+                }
+
+                if (cell == Cell::LSTM) {
+                    auto i = a.leftCols(H).array(), f = a.middleCols(H, H).array();
+                    auto g = a.middleCols(2 * H, H).array(), o = a.rightCols(H).array();
+                    ArrayX_RowMajor<float> tanh_c = cells[slot + 1].array().tanh();
+                    auto c_prev = cells[slot].array();
+
+                    dc.array() += dh.array() * o * (1 - tanh_c.square());
+                    da.leftCols(H).array() = dc.array() * g * i * (1 - i);
+                    da.middleCols(H, H).array() = dc.array() * c_prev * f * (1 - f);
+                    da.middleCols(2 * H, H).array() = dc.array() * i * (1 - g.square());
+                    da.rightCols(H).array() = dh.array() * tanh_c * o * (1 - o);
+
+                    dc.array() *= f;
+                    stepRows(d_projected, t) = da;
+                    grad_recurrent.noalias() += h_prev.transpose() * da;
+                    dh.noalias() = da * recurrent_weights.transpose();
+                }
+                else {
+                    auto r = a.leftCols(H).array(), z = a.middleCols(H, H).array(), n = a.rightCols(H).array();
+                    const MatrixX_RowMajor<float>& hn = candidate_hidden[slot];
+
+                    da.rightCols(H).array() = dh.array() * (1 - z) * (1 - n.square());
+                    da.middleCols(H, H).array() = dh.array() * (h_prev.array() - n) * z * (1 - z);
+                    da.leftCols(H).array() = da.rightCols(H).array() * hn.array() * r * (1 - r);
+                    stepRows(d_projected, t) = da;
+
+                    // Recurrent path of candidate is gated by `r`
+                    da.rightCols(H).array() *= r;
+                    grad_candidate_bias += da.rightCols(H).colwise().sum();
+                    grad_recurrent.noalias() += h_prev.transpose() * da;
+
+                    MatrixX_RowMajor<float> dh_prev = (dh.array() * z).matrix();
+                    dh_prev.noalias() += da * recurrent_weights.transpose();
+                    dh = std::move(dh_prev);
+                }
+            }
+
+            // Time-batched input gradients, mirroring the forward projection
+            grad_input = MatrixX_RowMajor<float>::Zero(in_dim + 1, G);
+            grad_input.row(in_dim) = d_projected.colwise().sum();
+            d_projected_cache = std::move(d_projected);
+
+            MatrixX_RowMajor<float> new_tgradient(num_rows, seq_len * in_dim);
+            Eigen::Map<MatrixX_RowMajor<float>> d_steps(new_tgradient.data(), num_rows * seq_len, in_dim);
+            d_steps.noalias() = d_projected_cache * input_weights.topRows(in_dim).transpose();
+
+            return std::make_pair(MatOrArray<EigenType>::eval(tgradient.matrix()),
+                                  MatOrArray<EigenType>::eval(new_tgradient));
+        }
+
+        // Applies the gradients of the last `backPropagate` using gradient descent. @inputs must be
+        // the inputs of the last forward pass; @gradient is unused
+        void updateWeights(const MatrixX_RowMajor_Ref<float>& inputs, const MatrixX_RowMajor_Ref<float>&, float lr) {
+            Eigen::Map<const MatrixX_RowMajor<float>> steps(inputs.data(), inputs.rows() * seq_len, in_dim);
+            grad_input.topRows(in_dim).noalias() = steps.transpose() * d_projected_cache;
+
+            input_weights -= lr * grad_input;
+            recurrent_weights -= lr * grad_recurrent;
+            if (cell == Cell::GRU) {
+                candidate_bias -= lr * grad_candidate_bias;
+            }
+
+            return;
+        }
+
+        Eigen::Index outputDim() const {
+            return return_sequences ? seq_len * hidden_dim : hidden_dim;
+        }
+
+    private:
+        template<typename Derived>
+        static MatrixX_RowMajor<float> sigmoid(const Eigen::MatrixBase<Derived>& x) {
+            return (1 + (-x.array()).exp()).inverse().matrix();
+        }
+
+        // Rows of step @t of every sequence in a `(rows * seq_len) x cols` matrix
+        auto stepRows(MatrixX_RowMajor<float>& per_step, Eigen::Index t) const {
+            Eigen::Index cols = per_step.cols();
+            return Eigen::Map<MatrixX_RowMajor<float>, 0, Eigen::OuterStride<>>(
+                per_step.data() + t * cols, per_step.rows() / seq_len, cols, Eigen::OuterStride<>(seq_len * cols));
+        }
+
+        Cell cell;
+        Eigen::Index in_dim;
+        Eigen::Index hidden_dim;
+        Eigen::Index seq_len;
+        bool return_sequences;
+        Eigen::Index num_cached;
+        Eigen::Index num_gates;
+
+        // `(in_dim + 1) x (num_gates * hidden_dim)`, bias row last
+        MatrixX_RowMajor<float> input_weights;
+        // `hidden_dim x (num_gates * hidden_dim)`
+        MatrixX_RowMajor<float> recurrent_weights;
+        // GRU only: bias of recurrent candidate projection, inside the reset gate
+        MatRowX<float> candidate_bias;
+
+        // Step caches of last forward pass (last `num_cached` steps). `hiddens` and `cells` also
+        // hold the states entering the first cached step
+        Eigen::Index last_rows = 0;
+        std::vector<MatrixX_RowMajor<float>> gates;
+        std::vector<MatrixX_RowMajor<float>> cells;
+        std::vector<MatrixX_RowMajor<float>> candidate_hidden;
+        std::vector<MatrixX_RowMajor<float>> hiddens;
+
+        // Gradients of last backward pass
+        MatrixX_RowMajor<float> d_projected_cache;
+        MatrixX_RowMajor<float> grad_input;
+        MatrixX_RowMajor<float> grad_recurrent;
+        MatRowX<float> grad_candidate_bias;
+    };
+}
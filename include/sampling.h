@@ -0,0 +1,243 @@
+// sampling.h: Contains facilities for loss-based importance sampling of training rows
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/random.h"
+
+namespace Neural {
+    /*
+    * @brief: Persistent cache of per-row losses of a training set, indexed by dataset row, with the
+    *         step at which each was observed
+    *
+    * Row priorities (cached loss, floored) are kept in a Fenwick tree, so recording a batch of
+    * losses and drawing a row by priority both cost `O(log num_rows)`. Rows never observed get
+    * the largest cached loss as priority (1 while none is), which makes them likely to be drawn
+    * early instead of requiring a full pass up front. That maximum is raised by every update and
+    * lowered only by `recomputeMaxLoss` (called by `refreshStale`).
+    */
+    class LossCache {
+    public:
+        explicit LossCache(Eigen::Index num_rows, float min_priority = 1e-3f) :
+            min_priority(min_priority), losses(ArrColX<float>::Zero(num_rows)),
+            stamps(ArrColX<int>::Constant(num_rows, -1)), tree(num_rows + 1, 0.0),
+            unseen(num_rows), unseen_pos(num_rows)
+        {
+            if (num_rows <= 0 || min_priority <= 0) {
+                throw std::invalid_argument("received non-positive number of rows or minimal priority");
+            }
+            for (Eigen::Index i = 0; i < num_rows; i++) {
+                unseen[i] = i;
+                unseen_pos[i] = i;
+            }
+        }
+
+        // Records @sample_losses (e.g. `MultiClassNN::sampleLosses()`) of dataset rows @rows at the current step
+        void update(const MatColX<int>& rows, const ArrColX<float>& sample_losses) {
+            if (rows.size() != sample_losses.size()) {
+                throw std::invalid_argument("sizes of @rows and @sample_losses differ");
+            }
+            for (Eigen::Index k = 0; k < rows.size(); k++) {
+                Eigen::Index row = rows(k);
+                if (row < 0 || row >= size()) {
+                    throw std::out_of_range("received row outside of cache");
+                }
+                float loss = std::isfinite(sample_losses(k)) ? std::max(sample_losses(k), 0.0f) : max_loss;
+                if (stamps(row) < 0) {
+                    markSeen(row);
+                    add(row, (double)std::max(loss, min_priority));
+                }
+                else {
+                    add(row, (double)std::max(loss, min_priority) - (double)std::max(losses(row), min_priority));
+                }
+                losses(row) = loss;
+                stamps(row) = step;
+                max_loss = std::max(max_loss, loss);
+            }
+        }
+
+        /*
+        * @brief: Recomputes the largest cached loss, which `update` only ever raises, so that the
+        *         priority of unseen rows follows losses down as training lowers them. `O(num_rows)`
+        */
+        void recomputeMaxLoss() {
+            max_loss = losses.maxCoeff();
+        }
+
+        // Starts a new step; ages of cached losses are counted in steps
+        void advance() {
+            step++;
+        }
+
+        Eigen::Index size() const {
+            return losses.size();
+        }
+
+        bool seen(Eigen::Index row) const {
+            return stamps(row) >= 0;
+        }
+
+        // Cached loss of @row (zero if never observed)
+        float loss(Eigen::Index row) const {
+            return losses(row);
+        }
+
+        // Steps since the loss of @row was observed, -1 if never observed
+        int age(Eigen::Index row) const {
+            return stamps(row) < 0 ? -1 : step - stamps(row);
+        }
+
+        float priority(Eigen::Index row) const {
+            return seen(row) ? std::max(losses(row), min_priority) : unseenPriority();
+        }
+
+        double totalPriority() const {
+            return total_seen + (double)unseen.size() * unseenPriority();
+        }
+
+        // Row whose cumulated priority interval contains @mass, in `[0, totalPriority())`
+        Eigen::Index find(double mass, double uniform) const {
+            if (mass >= total_seen && !unseen.empty()) {
+                return unseen[std::min<std::size_t>((std::size_t)(uniform * unseen.size()), unseen.size() - 1)];
+            }
+            // Fenwick descent: largest prefix whose sum stays below @mass
+            Eigen::Index pos = 0, num_rows = size();
+            Eigen::Index step_size = 1;
+            while (2 * step_size <= num_rows) {
+                step_size *= 2;
+            }
+            for (; step_size > 0; step_size /= 2) {
+                if (pos + step_size <= num_rows && tree[pos + step_size] <= mass) {
+                    pos += step_size;
+                    mass -= tree[pos];
+                }
+            }
+            // Guards against rounding past the last seen row
+            while (pos > 0 && !seen(std::min(pos, num_rows - 1))) {
+                pos--;
+            }
+            return std::min(pos, num_rows - 1);
+        }
+
+        /*
+        * @brief: Up to @max_rows observed rows whose loss is older than @max_age steps, found by a
+        *         cursor sweeping the cache round-robin (each call resumes where the last stopped)
+        */
+        MatColX<int> staleRows(Eigen::Index max_rows, int max_age) {
+            std::vector<int> stale;
+            for (Eigen::Index visited = 0; visited < size() && (Eigen::Index)stale.size() < max_rows; visited++) {
+                if (seen(cursor) && step - stamps(cursor) > max_age) {
+                    stale.push_back((int)cursor);
+                }
+                cursor = (cursor + 1) % size();
+            }
+            return Eigen::Map<MatColX<int>>(stale.data(), (Eigen::Index)stale.size());
+        }
+
+    private:
+        float unseenPriority() const {
+            return max_loss > 0 ? std::max(max_loss, min_priority) : 1.0f;
+        }
+
+        void add(Eigen::Index row, double delta) {
+            total_seen += delta;
+            for (Eigen::Index i = row + 1; i < (Eigen::Index)tree.size(); i += i & -i) {
+                tree[i] += delta;
+            }
+        }
+
+        // Removes @row from `unseen` by swapping it with the last entry
+        void markSeen(Eigen::Index row) {
+            Eigen::Index pos = unseen_pos[row], last = unseen.back();
+            unseen[pos] = last;
+            unseen_pos[last] = pos;
+            unseen.pop_back();
+        }
+
+        float min_priority;
+        ArrColX<float> losses;
+        ArrColX<int> stamps;
+        std::vector<double> tree;
+        double total_seen = 0;
+        float max_loss = 0;
+        std::vector<Eigen::Index> unseen;
+        std::vector<Eigen::Index> unseen_pos;
+        int step = 0;
+        Eigen::Index cursor = 0;
+    };
+
+    /*
+    * @brief: Draws mini-batches of dataset rows with probability proportional to their cached loss
+    *         (hard-example mining), mixed with uniform sampling
+    *
+    * Row `i` is drawn with probability `p_i = mix / N + (1 - mix) * priority_i / total` (with
+    * replacement). Each drawn row comes with the importance weight `1 / (N * p_i)`, which keeps the
+    * weighted batch loss an unbiased estimate of the mean loss over the dataset; pass them to
+    * `FeedFwdNN::weightNextBatch`. The uniform share @uniform_mix bounds the weights by
+    * `1 / uniform_mix` and keeps every row reachable.
+    */
+    class ImportanceSampler {
+    public:
+        ImportanceSampler(LossCache& cache, std::uint64_t stream, float uniform_mix = 0.1f, int seed = 42) :
+            cache(cache), uniform_mix(uniform_mix), rng(seed, stream)
+        {
+            if (uniform_mix < 0 || uniform_mix > 1) {
+                throw std::invalid_argument("received @uniform_mix outside of [0, 1]");
+            }
+        }
+
+        // Draws @batch_size rows and their importance weights, and advances the cache by a step
+        std::pair<MatColX<int>, ArrColX<float>> draw(Eigen::Index batch_size) {
+            Eigen::Index num_rows = cache.size();
+            std::vector<float> uniforms(3 * batch_size);
+            rng.uniform(counter, uniforms.size(), uniforms.data());
+            counter += uniforms.size();
+
+            double total = cache.totalPriority();
+            MatColX<int> rows(batch_size);
+            ArrColX<float> weights(batch_size);
+            for (Eigen::Index b = 0; b < batch_size; b++) {
+                const float* u = uniforms.data() + 3 * b;
+                Eigen::Index row = u[0] < uniform_mix ? std::min((Eigen::Index)(u[1] * num_rows), num_rows - 1)
+                                                      : cache.find(u[1] * total, u[2]);
+                double probability = uniform_mix / (double)num_rows + (1.0 - uniform_mix) * cache.priority(row) / total;
+                rows(b) = (int)row;
+                weights(b) = (float)(1.0 / ((double)num_rows * probability));
+            }
+            cache.advance();
+
+            return std::make_pair(rows, weights);
+        }
+
+    private:
+        LossCache& cache;
+        float uniform_mix;
+        Philox rng;
+        std::uint64_t counter = 0;
+    };
+
+    /*
+    * @brief: Lazily refreshes up to @max_rows cached losses older than @max_age steps, with an
+    *         inference pass of @nn (a `MultiClassNN`, see `rowLosses`) over those rows only, then
+    *         recomputes the largest cached loss. Leaves the test telemetry and sample losses of @nn
+    *         untouched
+    *
+    * @return: Number of rows refreshed
+    */
+    template <typename NetType, typename EigenType_1, typename EigenType_2>
+    Eigen::Index refreshStale(NetType& nn, LossCache& cache, const EigenType_1& inputs,
+                              const EigenType_2& one_hot_labels, Eigen::Index max_rows, int max_age) {
+        MatColX<int> rows = cache.staleRows(max_rows, max_age);
+        if (rows.size() > 0) {
+            cache.update(rows, nn.rowLosses(inputs(rows, Eigen::all).eval(), one_hot_labels(rows, Eigen::all).eval()));
+            cache.recomputeMaxLoss();
+        }
+        return rows.size();
+    }
+}
@@ -0,0 +1,330 @@
+// scoring.h: Contains facilities for scoring large text files with a pipeline of threads
+
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+#include "../utilities/queue.h"
+#include "../utilities/softmax.h"
+#include "input.h"
+#include "snapshot.h"
+
+namespace Neural {
+    // What `scoreStream` writes per row: the index of the largest output, the outputs, or their softmax
+    enum class ScoreOutput {Class, Scores, Probabilities};
+
+    /*
+    * @brief: Settings of `scoreStream`
+    *
+    * `batch_rows`: rows per batch, the unit passed from stage to stage
+    * `parse_threads`, `infer_threads`: threads of both parallel stages, 0 for half of the hardware threads
+    * `queue_depth`: batches each queue holds per consumer thread, bounding memory and letting
+    *                stages run ahead of the next by that much
+    * `digits`: significant digits of written outputs, 0 for the shortest exact representation
+    */
+    struct ScoringOptions {
+        Eigen::Index batch_rows = 4096;
+        int parse_threads = 0;
+        int infer_threads = 0;
+        std::size_t queue_depth = 2;
+        ScoreOutput output = ScoreOutput::Class;
+        int digits = 0;
+    };
+
+    /*
+    * @brief: Outcome of `scoreStream`. Busy times exclude the time spent waiting on queues and are
+    *         summed over the threads of a stage, so the stage with the largest busy time per thread
+    *         is the one bounding throughput
+    */
+    struct ScoringReport {
+        enum Stage {Read, Parse, Infer, Write};
+        static constexpr std::array<const char*, 4> stage_names = { "read", "parse", "infer", "write" };
+
+        std::uint64_t rows = 0;
+        std::uint64_t batches = 0;
+        double seconds = 0;
+        std::array<double, 4> busy_seconds = {};
+        std::array<int, 4> threads = { 1, 1, 1, 1 };
+
+        Stage bottleneck() const {
+            int slowest = 0;
+            for (int s = 1; s < 4; s++) {
+                if (busy_seconds[s] / threads[s] > busy_seconds[slowest] / threads[slowest]) {
+                    slowest = s;
+                }
+            }
+            return (Stage)slowest;
+        }
+    };
+
+    namespace Detail {
+        struct TextBatch {
+            std::uint64_t seq;
+            std::string text;
+        };
+
+        struct InputBatch {
+            std::uint64_t seq;
+            MatrixX_RowMajor<float> rows;
+        };
+
+        struct ScoredBatch {
+            std::uint64_t seq;
+            MatrixX_RowMajor<float> scores; // One column of class indices for `ScoreOutput::Class`
+        };
+
+        // Adds the time elapsed since its creation to a busy-time counter when destroyed
+        class BusyTimer {
+        public:
+            explicit BusyTimer(std::atomic<std::uint64_t>& counter) : counter(counter), start(std::chrono::steady_clock::now()) {}
+
+            ~BusyTimer() {
+                auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+                counter.fetch_add((std::uint64_t)elapsed.count(), std::memory_order_relaxed);
+            }
+
+        private:
+            std::atomic<std::uint64_t>& counter;
+            std::chrono::steady_clock::time_point start;
+        };
+
+        // Appends the rows of @batch to @text, items separated by spaces, with `std::to_chars`
+        inline void formatBatch(const ScoredBatch& batch, ScoreOutput output, int digits, std::string& text) {
+            char buffer[64];
+            for (Eigen::Index r = 0; r < batch.scores.rows(); r++) {
+                for (Eigen::Index c = 0; c < batch.scores.cols(); c++) {
+                    float value = batch.scores(r, c);
+                    std::to_chars_result result;
+                    if (output == ScoreOutput::Class) {
+                        result = std::to_chars(buffer, buffer + sizeof(buffer), (int)value);
+                    }
+                    else if (digits > 0) {
+                        result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::general, digits);
+                    }
+                    else {
+                        result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+                    }
+                    if (c > 0) {
+                        text.push_back(' ');
+                    }
+                    text.append(buffer, result.ptr);
+                }
+                text.push_back('\n');
+            }
+        }
+    }
+
+    /*
+    * @brief: Scores the rows read from @in with @model and writes one line per row to @out, in the
+    *         order of @in. Rows are lines of numbers as parsed by `Input::parseRows`; columns beyond
+    *         the model's input dimension (e.g. trailing labels) are ignored
+    *
+    * Runs as a pipeline of four stages connected by bounded queues (see `BoundedQueue`): a reader
+    * cutting @in into batches of whole lines, parsing threads, inference threads running the
+    * forward pass of @model on whole batches, and the calling thread, which restores the order
+    * of batches and formats them with `std::to_chars`. Stages overlap, so throughput is that of
+    * the slowest one (see `ScoringReport::bottleneck`). An error in any stage stops all of them
+    * and is rethrown
+    */
+    inline ScoringReport scoreStream(const InferenceSnapshot& model, std::istream& in, std::ostream& out,
+                                     ScoringOptions options = {}) {
+        int half_hardware = std::max(1, (int)std::thread::hardware_concurrency() / 2);
+        int parse_threads = options.parse_threads > 0 ? options.parse_threads : half_hardware;
+        int infer_threads = options.infer_threads > 0 ? options.infer_threads : half_hardware;
+        if (options.batch_rows <= 0 || options.digits < 0) {
+            throw std::invalid_argument("received invalid scoring settings");
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        BoundedQueue<Detail::TextBatch> text_queue(options.queue_depth * parse_threads);
+        BoundedQueue<Detail::InputBatch> input_queue(options.queue_depth * infer_threads);
+        BoundedQueue<Detail::ScoredBatch> scored_queue(options.queue_depth * infer_threads);
+        std::array<std::atomic<std::uint64_t>, 4> busy_ns = {};
+
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto fail = [&]() {
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            text_queue.close();
+            input_queue.close();
+            scored_queue.close();
+        };
+
+        // Reader: cuts @in into batches of `batch_rows` whole lines
+        std::uint64_t num_batches = 0;
+        std::thread reader([&]() {
+            try {
+                constexpr std::size_t block_size = 1 << 20;
+                std::vector<char> block(block_size);
+                std::string pending;
+                std::size_t scanned = 0;
+                Eigen::Index num_lines = 0;
+                bool open = true;
+                while (open) {
+                    Detail::TextBatch batch{ num_batches, {} };
+                    {
+                        Detail::BusyTimer timer(busy_ns[ScoringReport::Read]);
+                        while (num_lines < options.batch_rows) {
+                            std::size_t newline = pending.find('\n', scanned);
+                            if (newline != std::string::npos) {
+                                scanned = newline + 1;
+                                num_lines++;
+                                continue;
+                            }
+                            scanned = pending.size();
+                            in.read(block.data(), block_size);
+                            if (in.gcount() == 0) {
+                                open = false;
+                                break;
+                            }
+                            pending.append(block.data(), in.gcount());
+                        }
+                        if (!open) {
+                            scanned = pending.size();
+                        }
+                        // The remainder moves to the next batch; the batch keeps the buffer
+                        std::string rest = pending.substr(scanned);
+                        pending.resize(scanned);
+                        batch.text.swap(pending);
+                        pending.swap(rest);
+                        scanned = 0;
+                        num_lines = 0;
+                    }
+                    if (in.bad()) {
+                        throw std::runtime_error("failed to read input stream");
+                    }
+                    if (batch.text.empty()) {
+                        break;
+                    }
+                    num_batches++;
+                    if (!text_queue.push(std::move(batch))) {
+                        break;
+                    }
+                }
+                text_queue.close();
+            }
+            catch (...) {
+                fail();
+            }
+        });
+
+        // Starts @count workers applying @work to the items of @from; the last one done closes @to
+        auto startWorkers = [&](int count, auto& from, auto& to, auto work, std::atomic<int>& running,
+                                std::vector<std::thread>& workers) {
+            running = count;
+            for (int t = 0; t < count; t++) {
+                workers.emplace_back([&, work]() {
+                    try {
+                        while (auto item = from.pop()) {
+                            if (!to.push(work(*item))) {
+                                break;
+                            }
+                        }
+                    }
+                    catch (...) {
+                        fail();
+                    }
+                    if (--running == 0) {
+                        to.close();
+                    }
+                });
+            }
+        };
+
+        Eigen::Index in_dim = model.inputDim();
+        std::vector<std::thread> workers;
+        std::atomic<int> parsing, inferring;
+        startWorkers(parse_threads, text_queue, input_queue, [&](Detail::TextBatch& batch) {
+            Detail::BusyTimer timer(busy_ns[ScoringReport::Parse]);
+            ArrayX_RowMajor<float> rows = Input::parseRows(batch.text);
+            if (rows.rows() > 0 && rows.cols() < in_dim) {
+                throw std::invalid_argument("received rows with fewer items than the model's input dimension");
+            }
+            return Detail::InputBatch{ batch.seq, rows.leftCols(std::min(rows.cols(), in_dim)).matrix() };
+        }, parsing, workers);
+        startWorkers(infer_threads, input_queue, scored_queue, [&](Detail::InputBatch& batch) {
+            Detail::BusyTimer timer(busy_ns[ScoringReport::Infer]);
+            Detail::ScoredBatch scored{ batch.seq, {} };
+            if (batch.rows.rows() == 0) {
+                scored.scores.resize(0, 1);
+                return scored;
+            }
+            MatrixX_RowMajor<float> outputs = model.predict(batch.rows);
+            if (options.output == ScoreOutput::Class) {
+                scored.scores.resize(outputs.rows(), 1);
+                for (Eigen::Index r = 0; r < outputs.rows(); r++) {
+                    Eigen::Index index;
+                    outputs.row(r).maxCoeff(&index);
+                    scored.scores(r, 0) = (float)index;
+                }
+            }
+            else if (options.output == ScoreOutput::Probabilities) {
+                scored.scores = softMax(outputs, Ax::One);
+            }
+            else {
+                scored.scores.swap(outputs);
+            }
+            return scored;
+        }, inferring, workers);
+
+        // Writer: batches may complete out of order, they wait in @waiting until their turn
+        ScoringReport report;
+        try {
+            std::map<std::uint64_t, Detail::ScoredBatch> waiting;
+            std::uint64_t next_seq = 0;
+            std::string text;
+            while (auto batch = scored_queue.pop()) {
+                Detail::BusyTimer timer(busy_ns[ScoringReport::Write]);
+                waiting.emplace(batch->seq, std::move(*batch));
+                for (auto it = waiting.begin(); it != waiting.end() && it->first == next_seq; it = waiting.erase(it)) {
+                    text.clear();
+                    Detail::formatBatch(it->second, options.output, options.digits, text);
+                    if (!out.write(text.data(), (std::streamsize)text.size())) {
+                        throw std::runtime_error("failed to write output stream");
+                    }
+                    report.rows += it->second.scores.rows();
+                    next_seq++;
+                }
+            }
+            out.flush();
+        }
+        catch (...) {
+            fail();
+        }
+
+        reader.join();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+
+        report.batches = num_batches;
+        report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        report.threads = { 1, parse_threads, infer_threads, 1 };
+        for (int s = 0; s < 4; s++) {
+            report.busy_seconds[s] = 1e-9 * (double)busy_ns[s].load();
+        }
+        return report;
+    }
+}
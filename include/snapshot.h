@@ -0,0 +1,83 @@
+// snapshot.h: Contains facilities for read-only copies of network weights used for inference
+
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+#include "../utilities/types.h"
+
+namespace Neural {
+    /*
+    * @brief: Immutable copy of the weights of a network, taken by `FeedFwdNN::publishSnapshot`.
+    *         Lets reader threads run inference while the network keeps training (e.g. through
+    *         `partialFit`); readers never observe a partially updated model
+    */
+    class InferenceSnapshot {
+    public:
+        // Affine map (bias row last, like `LinearLayer` weights) followed by an in-place activation
+        struct Layer {
+            MatrixX_RowMajor<float> weights;
+            std::function<void(MatrixX_RowMajor<float>&)> activate; // Empty for identity
+        };
+
+        InferenceSnapshot(std::vector<Layer> layers, std::uint64_t version, bool folded = false) :
+            layers(std::move(layers)), snapshot_version(version), folded_weights(folded)
+        {
+            if (this->layers.empty()) {
+                throw std::invalid_argument("received no layers");
+            }
+        }
+
+        // Outputs of the output layer (before the loss) for @inputs
+        MatrixX_RowMajor<float> predict(const MatrixX_RowMajor_Ref<float>& inputs) const {
+            if (inputs.cols() != inputDim()) {
+                throw std::invalid_argument("number of columns of @inputs does not match snapshot");
+            }
+            MatrixX_RowMajor<float> current = inputs;
+            for (const auto& layer : layers) {
+                Eigen::Index in_dim = layer.weights.rows() - 1;
+                MatrixX_RowMajor<float> next = current * layer.weights.topRows(in_dim);
+                next.rowwise() += layer.weights.row(in_dim);
+                if (layer.activate) {
+                    layer.activate(next);
+                }
+                current.swap(next);
+            }
+            return current;
+        }
+
+        Eigen::Index inputDim() const {
+            return layers.front().weights.rows() - 1;
+        }
+
+        Eigen::Index outputDim() const {
+            return layers.back().weights.cols();
+        }
+
+        // Parameter version of the network when the snapshot was taken (see `FeedFwdNN::parameterVersion`)
+        std::uint64_t version() const {
+            return snapshot_version;
+        }
+
+        // Whether some weights are folds of the network's parameters (see `FeedFwdNN::foldsInference`)
+        bool folded() const {
+            return folded_weights;
+        }
+
+        std::size_t numLayers() const {
+            return layers.size();
+        }
+
+        const Layer& layer(std::size_t i) const {
+            return layers.at(i);
+        }
+
+    private:
+        std::vector<Layer> layers;
+        std::uint64_t snapshot_version;
+        bool folded_weights;
+    };
+}
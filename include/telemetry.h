@@ -0,0 +1,364 @@
+// telemetry.h: Contains facilities for exposing live training counters over a local socket
+
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define NN_TELEMETRY_POSIX 1
+#ifdef MSG_NOSIGNAL
+#define NN_TELEMETRY_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define NN_TELEMETRY_SEND_FLAGS 0
+#endif
+#endif
+
+namespace Telemetry {
+    // Maximum number of layers (hidden + output) for which per-layer timings are kept
+    constexpr std::size_t max_layers = 64;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct LayerCounters {
+        std::atomic<std::uint64_t> fwd_ns{ 0 };
+        std::atomic<std::uint64_t> bwd_ns{ 0 };
+        std::atomic<std::uint64_t> update_ns{ 0 };
+    };
+
+    /*
+    * @brief: Lock-free counters updated by `FeedFwdNN::train` and `FeedFwdNN::test`
+    *
+    * Writers only ever issue relaxed atomic stores and `fetch_add`s, so the training loop
+    * never waits on a reader. Readers may observe a snapshot in which e.g. `train_steps`
+    * and `train_loss` stem from consecutive steps; this is acceptable for monitoring.
+    */
+    struct Counters {
+        std::atomic<std::uint64_t> train_steps{ 0 };
+        std::atomic<std::uint64_t> train_rows{ 0 };
+        std::atomic<std::uint64_t> train_ns{ 0 };
+        std::atomic<float> train_loss{ std::numeric_limits<float>::quiet_NaN() };
+        std::atomic<float> train_misclas{ std::numeric_limits<float>::quiet_NaN() };
+
+        std::atomic<std::uint64_t> test_calls{ 0 };
+        std::atomic<std::uint64_t> test_rows{ 0 };
+        std::atomic<std::uint64_t> test_ns{ 0 };
+        std::atomic<float> test_loss{ std::numeric_limits<float>::quiet_NaN() };
+        std::atomic<float> test_misclas{ std::numeric_limits<float>::quiet_NaN() };
+
+        std::atomic<std::size_t> num_layers{ 0 };
+        std::array<LayerCounters, max_layers> layers;
+
+        const Clock::time_point start = Clock::now();
+    };
+
+    static inline std::uint64_t elapsedNs(Clock::time_point since) {
+        return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count();
+    }
+
+    static inline void addLayerTime(std::atomic<std::uint64_t> LayerCounters::* field, Counters& counters,
+                                    std::size_t layer, Clock::time_point since) {
+        if (layer < max_layers) {
+            (counters.layers[layer].*field).fetch_add(elapsedNs(since), std::memory_order_relaxed);
+        }
+    }
+
+    // Records loss of a network; understands scalar losses and (cross-entropy, misclassification) pairs
+    static inline void storeLoss(std::atomic<float>& first, std::atomic<float>&, float loss) {
+        first.store(loss, std::memory_order_relaxed);
+    }
+
+    template<typename T_1, typename T_2>
+    void storeLoss(std::atomic<float>& first, std::atomic<float>& second, const std::pair<T_1, T_2>& loss) {
+        first.store((float)loss.first, std::memory_order_relaxed);
+        second.store((float)loss.second, std::memory_order_relaxed);
+    }
+
+    // Resident and peak resident memory of the process in bytes (zero if unavailable)
+    static inline std::pair<std::uint64_t, std::uint64_t> memoryUsage() {
+        std::uint64_t rss = 0, peak = 0;
+#ifdef NN_TELEMETRY_POSIX
+        if (std::FILE* statm = std::fopen("/proc/self/statm", "r")) {
+            unsigned long size_pages = 0, rss_pages = 0;
+            if (std::fscanf(statm, "%lu %lu", &size_pages, &rss_pages) == 2) {
+                rss = (std::uint64_t)rss_pages * (std::uint64_t)sysconf(_SC_PAGESIZE);
+            }
+            std::fclose(statm);
+        }
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+            peak = (std::uint64_t)usage.ru_maxrss;
+#else
+            peak = (std::uint64_t)usage.ru_maxrss * 1024;
+#endif
+        }
+#endif
+        return std::make_pair(rss, peak);
+    }
+
+    // Plain-old-data copy of `Counters`, taken by readers
+    struct Snapshot {
+        double uptime_s;
+        std::uint64_t train_steps, train_rows, test_calls, test_rows;
+        double train_s, test_s;
+        double train_rows_per_s, test_rows_per_s;
+        float train_loss, train_misclas, test_loss, test_misclas;
+        std::size_t num_layers;
+        std::array<std::array<double, 3>, max_layers> layer_s;
+        std::uint64_t rss_bytes, peak_rss_bytes;
+    };
+
+    static inline Snapshot snapshot(const Counters& counters) {
+        constexpr auto relaxed = std::memory_order_relaxed;
+        Snapshot snap{};
+
+        snap.uptime_s = 1e-9 * (double)elapsedNs(counters.start);
+        snap.train_steps = counters.train_steps.load(relaxed);
+        snap.train_rows = counters.train_rows.load(relaxed);
+        snap.train_s = 1e-9 * (double)counters.train_ns.load(relaxed);
+        snap.train_loss = counters.train_loss.load(relaxed);
+        snap.train_misclas = counters.train_misclas.load(relaxed);
+        snap.test_calls = counters.test_calls.load(relaxed);
+        snap.test_rows = counters.test_rows.load(relaxed);
+        snap.test_s = 1e-9 * (double)counters.test_ns.load(relaxed);
+        snap.test_loss = counters.test_loss.load(relaxed);
+        snap.test_misclas = counters.test_misclas.load(relaxed);
+
+        snap.train_rows_per_s = snap.train_s > 0 ? (double)snap.train_rows / snap.train_s : 0.0;
+        snap.test_rows_per_s = snap.test_s > 0 ? (double)snap.test_rows / snap.test_s : 0.0;
+
+        snap.num_layers = std::min(counters.num_layers.load(relaxed), max_layers);
+        for (std::size_t i = 0; i < snap.num_layers; i++) {
+            snap.layer_s[i] = { 1e-9 * (double)counters.layers[i].fwd_ns.load(relaxed),
+                                1e-9 * (double)counters.layers[i].bwd_ns.load(relaxed),
+                                1e-9 * (double)counters.layers[i].update_ns.load(relaxed) };
+        }
+
+        auto memory = memoryUsage();
+        snap.rss_bytes = memory.first;
+        snap.peak_rss_bytes = memory.second;
+
+        return snap;
+    }
+
+    // JSON has no literal for NaN (e.g. loss before first step); emit `null` instead
+    static inline std::string jsonNumber(double x) {
+        if (!std::isfinite(x)) {
+            return "null";
+        }
+        std::ostringstream ost;
+        ost.precision(9);
+        ost << x;
+        return ost.str();
+    }
+
+    static inline std::string toJson(const Snapshot& snap) {
+        std::ostringstream ost;
+        ost << "{\"uptime_s\":" << jsonNumber(snap.uptime_s)
+            << ",\"train\":{\"steps\":" << snap.train_steps
+            << ",\"rows\":" << snap.train_rows
+            << ",\"seconds\":" << jsonNumber(snap.train_s)
+            << ",\"rows_per_s\":" << jsonNumber(snap.train_rows_per_s)
+            << ",\"loss\":" << jsonNumber(snap.train_loss)
+            << ",\"misclas\":" << jsonNumber(snap.train_misclas) << "}"
+            << ",\"test\":{\"calls\":" << snap.test_calls
+            << ",\"rows\":" << snap.test_rows
+            << ",\"seconds\":" << jsonNumber(snap.test_s)
+            << ",\"rows_per_s\":" << jsonNumber(snap.test_rows_per_s)
+            << ",\"loss\":" << jsonNumber(snap.test_loss)
+            << ",\"misclas\":" << jsonNumber(snap.test_misclas) << "}"
+            << ",\"layers\":[";
+        for (std::size_t i = 0; i < snap.num_layers; i++) {
+            ost << (i == 0 ? "" : ",")
+                << "{\"fwd_s\":" << jsonNumber(snap.layer_s[i][0])
+                << ",\"bwd_s\":" << jsonNumber(snap.layer_s[i][1])
+                << ",\"update_s\":" << jsonNumber(snap.layer_s[i][2]) << "}";
+        }
+        ost << "],\"memory\":{\"rss_bytes\":" << snap.rss_bytes
+            << ",\"peak_rss_bytes\":" << snap.peak_rss_bytes << "}}\n";
+
+        return ost.str();
+    }
+
+    static inline std::string toPrometheus(const Snapshot& snap) {
+        std::ostringstream ost;
+        ost.precision(9);
+        auto metric = [&ost](const char* name, const char* type, auto value) {
+            ost << "# TYPE nn_" << name << " " << type << "\n" << "nn_" << name << " " << value << "\n";
+        };
+
+        metric("uptime_seconds", "gauge", snap.uptime_s);
+        metric("train_steps_total", "counter", snap.train_steps);
+        metric("train_rows_total", "counter", snap.train_rows);
+        metric("train_seconds_total", "counter", snap.train_s);
+        metric("train_rows_per_second", "gauge", snap.train_rows_per_s);
+        metric("train_loss", "gauge", snap.train_loss);
+        metric("train_misclassification", "gauge", snap.train_misclas);
+        metric("test_calls_total", "counter", snap.test_calls);
+        metric("test_rows_total", "counter", snap.test_rows);
+        metric("test_seconds_total", "counter", snap.test_s);
+        metric("test_rows_per_second", "gauge", snap.test_rows_per_s);
+        metric("test_loss", "gauge", snap.test_loss);
+        metric("test_misclassification", "gauge", snap.test_misclas);
+
+        const char* phases[3] = { "forward", "backward", "update" };
+        ost << "# TYPE nn_layer_seconds_total counter\n";
+        for (std::size_t i = 0; i < snap.num_layers; i++) {
+            for (int j = 0; j < 3; j++) {
+                ost << "nn_layer_seconds_total{layer=\"" << i << "\",phase=\"" << phases[j] << "\"} "
+                    << snap.layer_s[i][j] << "\n";
+            }
+        }
+
+        metric("resident_memory_bytes", "gauge", snap.rss_bytes);
+        metric("peak_resident_memory_bytes", "gauge", snap.peak_rss_bytes);
+
+        return ost.str();
+    }
+
+#ifdef NN_TELEMETRY_POSIX
+    /*
+    * @brief: Background thread serving snapshots of `Counters` over a Unix domain socket or
+    *         a TCP socket bound to localhost
+    *
+    * Every connection receives a single snapshot and is then closed. HTTP requests are
+    * answered with an HTTP response (`GET /metrics` yields Prometheus text, any other path
+    * JSON); raw socket clients receive JSON unless their request contains `prometheus`.
+    * E.g. `curl --unix-socket /tmp/nn.sock localhost/metrics` or `nc -U /tmp/nn.sock`.
+    *
+    * The server only reads `counters`, which must outlive it.
+    */
+    class Server {
+    public:
+        // Serves over Unix domain socket at @socket_path (an existing socket file is replaced)
+        Server(const Counters& counters, const std::string& socket_path) : counters(counters), socket_path(socket_path) {
+            sockaddr_un addr{};
+            if (socket_path.size() >= sizeof(addr.sun_path)) {
+                throw std::invalid_argument("socket path too long");
+            }
+            addr.sun_family = AF_UNIX;
+            std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+            listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            ::unlink(socket_path.c_str());
+            listenOn(reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        }
+
+        // Serves over TCP on 127.0.0.1:@port
+        Server(const Counters& counters, std::uint16_t port) : counters(counters) {
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+            listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            int reuse = 1;
+            ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            listenOn(reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        }
+
+        Server(const Server&) = delete;
+        Server& operator=(const Server&) = delete;
+
+        ~Server() {
+            stop_flag.store(true);
+            if (worker.joinable()) {
+                worker.join();
+            }
+            ::close(listen_fd);
+            if (!socket_path.empty()) {
+                ::unlink(socket_path.c_str());
+            }
+        }
+
+    private:
+        void listenOn(sockaddr* addr, socklen_t addr_len) {
+            if (listen_fd < 0 || ::bind(listen_fd, addr, addr_len) < 0 || ::listen(listen_fd, 8) < 0) {
+                if (listen_fd >= 0) {
+                    ::close(listen_fd);
+                }
+                throw std::runtime_error("could not open telemetry socket");
+            }
+            worker = std::thread([this]() { serve(); });
+        }
+
+        void serve() {
+            pollfd pfd{ listen_fd, POLLIN, 0 };
+            while (!stop_flag.load()) {
+                // Wake up periodically to honor `stop_flag`
+                if (::poll(&pfd, 1, 100) <= 0) {
+                    continue;
+                }
+                int client_fd = ::accept(listen_fd, nullptr, nullptr);
+                if (client_fd < 0) {
+                    continue;
+                }
+                respond(client_fd);
+                ::close(client_fd);
+            }
+        }
+
+        void respond(int client_fd) {
+            char buffer[1024];
+            std::string request;
+            pollfd pfd{ client_fd, POLLIN, 0 };
+            // Clients that send nothing (e.g. `nc -U` with closed stdin) still get JSON
+            if (::poll(&pfd, 1, 50) > 0) {
+                ssize_t num_read = ::recv(client_fd, buffer, sizeof(buffer) - 1, 0);
+                if (num_read > 0) {
+                    request.assign(buffer, (std::size_t)num_read);
+                }
+            }
+
+            bool is_http = request.rfind("GET ", 0) == 0;
+            bool prometheus = is_http ? request.rfind("GET /metrics", 0) == 0
+                                      : request.find("prometheus") != std::string::npos;
+
+            auto snap = snapshot(counters);
+            std::string body = prometheus ? toPrometheus(snap) : toJson(snap);
+            std::string response = body;
+            if (is_http) {
+                response = std::string("HTTP/1.0 200 OK\r\nContent-Type: ")
+                           + (prometheus ? "text/plain; version=0.0.4" : "application/json")
+                           + "\r\nContent-Length: " + std::to_string(body.size())
+                           + "\r\nConnection: close\r\n\r\n" + body;
+            }
+
+            std::size_t sent = 0;
+            while (sent < response.size()) {
+                ssize_t num_sent = ::send(client_fd, response.data() + sent, response.size() - sent,
+                                           NN_TELEMETRY_SEND_FLAGS);
+                if (num_sent <= 0) {
+                    break;
+                }
+                sent += (std::size_t)num_sent;
+            }
+        }
+
+        const Counters& counters;
+        std::string socket_path;
+        int listen_fd = -1;
+        std::atomic<bool> stop_flag{ false };
+        std::thread worker;
+    };
+#endif
+}
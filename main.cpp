@@ -12,6 +12,10 @@
 #include "include/input.h"
 #include "include/net.h"
 #include "include/labels.h"
+#include "include/factorized.h"
+#include "include/batching.h"
+#include "include/delta.h"
+#include "include/npy.h"
 
 using std::string;
 
@@ -52,12 +56,16 @@ int main()
     auto test_inputs = test_pair.first;
     auto test_labels = test_pair.second;
 
-    // Step 3: Build neural net
-    auto hidden_layer = Neural::PlainLinearLayer<decltype(train_inputs.eval())>(4, 4, 1.0);
-    auto output_layer = Neural::PlainLinearLayer<decltype(train_inputs.eval())>(4, 3, 1.0);
+    // Step 3: Build neural net (layers share the default seed, their fourth argument picks distinct Philox streams)
+    auto hidden_layer = Neural::PlainLinearLayer<decltype(train_inputs.eval())>(4, 4, 1.0, 0);
+    auto output_layer = Neural::PlainLinearLayer<decltype(train_inputs.eval())>(4, 3, 1.0, 1);
 
     auto nn = Neural::MultiClassNN(train_inputs.eval(), train_labels.eval(), output_layer);
     nn.pushLayer(hidden_layer);
+
+    // Track an exponential moving average of the weights alongside training
+    hidden_layer.setAveraging(Neural::Averaging::EMA, 0.95);
+    output_layer.setAveraging(Neural::Averaging::EMA, 0.95);
    
     // Step 4: Train neural net
     float lr = 0.1;
@@ -90,5 +98,100 @@ int main()
 
     // Step 5: Test the neural net
     auto test_misclas = nn.test(test_inputs, test_labels).second;
-    std::cout << "Test misclass. loss: " << test_misclas << std::endl;
+    std::cout << "Test misclass. loss: " << test_misclas << " (" << i << " SGD iterations)" << std::endl;
+
+    nn.swapAveragedWeights();
+    std::cout << "Test misclass. loss with EMA weights: " << nn.test(test_inputs, test_labels).second << std::endl;
+    nn.swapAveragedWeights();
+
+    // Step 5b: Train the same architecture with full-batch L-BFGS instead
+    auto lbfgs_hidden_layer = Neural::PlainLinearLayer<decltype(train_inputs.eval())>(4, 4, 1.0, 0);
+    auto lbfgs_output_layer = Neural::PlainLinearLayer<decltype(train_inputs.eval())>(4, 3, 1.0, 1);
+
+    auto lbfgs_nn = Neural::MultiClassNN(train_inputs.eval(), train_labels.eval(), lbfgs_output_layer);
+    lbfgs_nn.pushLayer(lbfgs_hidden_layer);
+
+    Neural::LBFGSOptions options;
+    options.max_iterations = 50;
+    auto lbfgs_report = lbfgs_nn.trainLBFGS(options);
+
+    std::cout << "L-BFGS: train CE loss " << lbfgs_report.initial_loss << " -> " << lbfgs_report.loss << " in "
+              << lbfgs_report.iterations << " iterations (" << lbfgs_report.evaluations << " evaluations)" << std::endl;
+    std::cout << "L-BFGS test misclass. loss: " << lbfgs_nn.test(test_inputs, test_labels).second << std::endl;
+
+    // Step 5c: Train the same architecture with LAMB (layer-wise trust ratios, learning rate warmup)
+    auto lamb_hidden_layer = Neural::PlainLinearLayer<decltype(train_inputs.eval())>(4, 4, 1.0, 0);
+    auto lamb_output_layer = Neural::PlainLinearLayer<decltype(train_inputs.eval())>(4, 3, 1.0, 1);
+
+    auto lamb_nn = Neural::MultiClassNN(train_inputs.eval(), train_labels.eval(), lamb_output_layer);
+    lamb_nn.pushLayer(lamb_hidden_layer);
+
+    Neural::LayerwiseOptions lamb_options;
+    lamb_options.lr = 0.05;
+    lamb_options.warmup_steps = 20;
+    Neural::LayerwiseOptimizer lamb(Neural::TrustRatio::LAMB, lamb_options);
+    for (int step = 0; step < 200; step++) {
+        lamb_nn.train(lamb);
+    }
+    std::cout << "LAMB test misclass. loss: " << lamb_nn.test(test_inputs, test_labels).second
+              << " (" << lamb.steps() << " steps)" << std::endl;
+
+    // Step 5d: Train with a fixed learning rate, growing the mini-batch instead of decaying the rate
+    auto growing_hidden_layer = Neural::PlainLinearLayer<decltype(train_inputs.eval())>(4, 4, 1.0, 0);
+    auto growing_output_layer = Neural::PlainLinearLayer<decltype(train_inputs.eval())>(4, 3, 1.0, 1);
+
+    auto growing_inputs = train_inputs.eval();
+    auto growing_labels = train_labels.eval();
+    auto growing_nn = Neural::MultiClassNN(growing_inputs, growing_labels, growing_output_layer);
+    growing_nn.pushLayer(growing_hidden_layer);
+
+    Neural::BatchGrowthOptions growth_options;
+    growth_options.initial_batch = 8;
+    growth_options.max_batch = 64;
+    growth_options.steps_per_stage = 100;
+    Neural::GrowingBatchTrainer growing_trainer(growing_nn, growing_inputs, growing_labels,
+                                                Neural::BatchGrowth::Schedule, 2, growth_options);
+    while (growing_trainer.steps() < 500) {
+        growing_trainer.step(lr);
+    }
+    std::cout << "Growing batch test misclass. loss: " << growing_nn.test(test_inputs, test_labels).second
+              << " (final batch size " << growing_trainer.batchSize() << ")" << std::endl;
+
+    // Step 6: Compress the output layer via truncated SVD and measure the impact
+    auto compressed_layer = Neural::compressToRank<decltype(train_inputs.eval())>(output_layer, 1);
+    auto report = Neural::compressionReport(output_layer, compressed_layer, hidden_layer.feedForward(test_inputs).first.matrix());
+
+    auto compressed_nn = Neural::MultiClassNN(train_inputs.eval(), train_labels.eval(), compressed_layer);
+    compressed_nn.pushLayer(hidden_layer);
+    auto compressed_misclas = compressed_nn.test(test_inputs, test_labels).second;
+
+    std::cout << "Rank " << report.rank << " (" << report.energy_kept << " of energy kept, "
+              << report.factorized_flops << " vs. " << report.dense_flops << " mult.-adds per row)" << std::endl;
+    std::cout << "Test misclass. loss after compression: " << compressed_misclas << std::endl;
+
+    // Step 7: Save the trained net for the offline scorer, e.g.
+    // `Score --model iris_model.nnwd --input-dim 4 --activation identity --in ../data/iris_data_files/iris_test.dat`
+    auto model_bytes = Neural::DeltaEncoder(nn).full().serialize();
+    std::ofstream model_file("iris_model.nnwd", std::ios::binary);
+    model_file.write(reinterpret_cast<const char*>(model_bytes.data()), model_bytes.size());
+    std::cout << "Saved model (" << model_bytes.size() << " bytes) to iris_model.nnwd" << std::endl;
+
+    // Step 8: Dump test predictions and weights for analysis in NumPy (`np.load("iris_results.npz")`)
+    auto snapshot = nn.publishSnapshot();
+    MatrixX_RowMajor<float> test_outputs = snapshot->predict(test_inputs.matrix());
+    MatColX<std::int32_t> test_classes(test_outputs.rows());
+    for (Eigen::Index r = 0; r < test_outputs.rows(); r++) {
+        Eigen::Index index;
+        test_outputs.row(r).maxCoeff(&index);
+        test_classes(r) = (std::int32_t)index;
+    }
+    Npy::NpzWriter results("iris_results.npz");
+    results.add("outputs", test_outputs);
+    results.add("classes", test_classes);
+    results.add("labels", test_labels.eval());
+    for (std::size_t l = 0; l < snapshot->numLayers(); l++) {
+        results.add("weights_" + std::to_string(l), snapshot->layer(l).weights);
+    }
+    results.close();
+    std::cout << "Saved test predictions and weights to iris_results.npz" << std::endl;
 }
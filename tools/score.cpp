@@ -0,0 +1,118 @@
+// score.cpp : Offline batch scoring of text files with a saved network
+// Usage: Score --model FILE --input-dim N [--delta FILE]... [--activation relu|identity]
+//              [--output class|scores|probs] [--batch-rows N] [--parse-threads N]
+//              [--infer-threads N] [--digits N] [--in FILE] [--out FILE]
+// The model is a full weight delta (see `DeltaEncoder::full`, e.g. `iris_model.nnwd` written by
+// main.cpp), optionally followed by the deltas bringing it up to date. Rows are read from stdin
+// (or --in), one line of numbers each; predictions are written to stdout (or --out), one line per
+// row in input order. Throughput and per-stage busy times are reported on stderr
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+#include "../include/delta.h"
+#include "../include/scoring.h"
+
+using std::string;
+
+Neural::WeightDelta readDelta(const string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("cannot open " + filename);
+    }
+    std::vector<std::uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return Neural::WeightDelta::deserialize(bytes);
+}
+
+int main(int argc, char** argv)
+{
+    string model_path, activation = "relu", output = "class", in_path, out_path;
+    std::vector<string> delta_paths;
+    Eigen::Index input_dim = 0;
+    Neural::ScoringOptions options;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            string flag = argv[i];
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("missing value for " + flag);
+            }
+            string value = argv[++i];
+            if (flag == "--model") model_path = value;
+            else if (flag == "--delta") delta_paths.push_back(value);
+            else if (flag == "--input-dim") input_dim = std::stol(value);
+            else if (flag == "--activation") activation = value;
+            else if (flag == "--output") output = value;
+            else if (flag == "--batch-rows") options.batch_rows = std::stol(value);
+            else if (flag == "--parse-threads") options.parse_threads = std::stoi(value);
+            else if (flag == "--infer-threads") options.infer_threads = std::stoi(value);
+            else if (flag == "--digits") options.digits = std::stoi(value);
+            else if (flag == "--in") in_path = value;
+            else if (flag == "--out") out_path = value;
+            else throw std::invalid_argument("unknown option " + flag);
+        }
+        if (model_path.empty() || input_dim <= 0) {
+            throw std::invalid_argument("--model and --input-dim are required");
+        }
+
+        std::function<void(MatrixX_RowMajor<float>&)> hidden_activation;
+        if (activation == "relu") {
+            hidden_activation = [](MatrixX_RowMajor<float>& signals) { signals = signals.cwiseMax(0.0f); };
+        }
+        else if (activation != "identity") {
+            throw std::invalid_argument("unknown activation " + activation);
+        }
+        if (output == "class") options.output = Neural::ScoreOutput::Class;
+        else if (output == "scores") options.output = Neural::ScoreOutput::Scores;
+        else if (output == "probs") options.output = Neural::ScoreOutput::Probabilities;
+        else throw std::invalid_argument("unknown output " + output);
+
+        // Step 1: Load the model and bring it up to date
+        auto model = Neural::snapshotFromDelta(readDelta(model_path), input_dim, hidden_activation);
+        for (const auto& path : delta_paths) {
+            model = Neural::patchSnapshot(*model, readDelta(path));
+        }
+
+        // Step 2: Score
+        std::ifstream in_file;
+        std::ofstream out_file;
+        if (!in_path.empty()) {
+            in_file.open(in_path, std::ios::binary);
+            if (!in_file) {
+                throw std::runtime_error("cannot open " + in_path);
+            }
+        }
+        if (!out_path.empty()) {
+            out_file.open(out_path, std::ios::binary);
+            if (!out_file) {
+                throw std::runtime_error("cannot open " + out_path);
+            }
+        }
+        std::ios::sync_with_stdio(false);
+        std::istream& in = in_path.empty() ? std::cin : in_file;
+        std::ostream& out = out_path.empty() ? std::cout : out_file;
+        Neural::ScoringReport report = Neural::scoreStream(*model, in, out, options);
+
+        // Step 3: Report
+        std::cerr << report.rows << " rows in " << report.batches << " batches, " << report.seconds << " s ("
+                  << report.rows / std::max(report.seconds, 1e-9) << " rows/s)\n";
+        for (int s = 0; s < 4; s++) {
+            std::cerr << Neural::ScoringReport::stage_names[s] << ": " << report.threads[s] << " thread(s), "
+                      << report.busy_seconds[s] << " s busy\n";
+        }
+        std::cerr << "bottleneck: " << Neural::ScoringReport::stage_names[report.bottleneck()] << "\n";
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Score: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+// fft.h: Contains an in-place radix-2 fast Fourier transform
+
+#pragma once
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <numbers>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+
+/*
+* @brief: Precomputed plan (twiddle factors, bit-reversal permutation) for in-place, iterative
+*         radix-2 FFTs of a fixed power-of-two size. Transforms are `O(n log n)`; a plan is
+*         read-only once built, so it can be shared by threads transforming different buffers
+*/
+class FFTPlan {
+public:
+    explicit FFTPlan(Eigen::Index size) : size(size) {
+        if (size <= 0 || (size & (size - 1)) != 0) {
+            throw std::invalid_argument("FFT size must be a positive power of two");
+        }
+        // Twiddles computed in double: errors would otherwise grow with the stage count
+        twiddles.resize(size / 2);
+        for (Eigen::Index k = 0; k < size / 2; k++) {
+            double angle = -2.0 * std::numbers::pi * (double)k / (double)size;
+            twiddles[k] = std::complex<float>((float)std::cos(angle), (float)std::sin(angle));
+        }
+
+        int bits = 0;
+        while (((Eigen::Index)1 << bits) < size) {
+            bits++;
+        }
+        reversed.resize(size);
+        for (Eigen::Index i = 0; i < size; i++) {
+            std::uint32_t r = 0;
+            for (int b = 0; b < bits; b++) {
+                r |= (((std::uint32_t)i >> b) & 1u) << (bits - 1 - b);
+            }
+            reversed[i] = r;
+        }
+    }
+
+    // Unnormalized forward transform, `X_k = sum_j x_j exp(-2 pi i j k / n)`
+    void forward(std::complex<float>* data) const {
+        transform(data, false);
+    }
+
+    // Inverse transform, normalized by `1 / n`
+    void inverse(std::complex<float>* data) const {
+        transform(data, true);
+        float scale = 1.0f / (float)size;
+        for (Eigen::Index i = 0; i < size; i++) {
+            data[i] *= scale;
+        }
+    }
+
+    Eigen::Index length() const {
+        return size;
+    }
+
+    // Plain complex product; `operator*` handles infinities/NaNs via a slow library call
+    static std::complex<float> multiply(std::complex<float> a, std::complex<float> b) {
+        return std::complex<float>(a.real() * b.real() - a.imag() * b.imag(),
+                                   a.real() * b.imag() + a.imag() * b.real());
+    }
+
+private:
+    void transform(std::complex<float>* data, bool inverse) const {
+        for (Eigen::Index i = 0; i < size; i++) {
+            if (i < (Eigen::Index)reversed[i]) {
+                std::swap(data[i], data[reversed[i]]);
+            }
+        }
+
+        // Butterflies; the stride into `twiddles` halves every stage
+        for (Eigen::Index half = 1; half < size; half *= 2) {
+            Eigen::Index stride = size / (2 * half);
+            for (Eigen::Index start = 0; start < size; start += 2 * half) {
+                for (Eigen::Index k = 0; k < half; k++) {
+                    std::complex<float> w = twiddles[k * stride];
+                    if (inverse) {
+                        w = std::conj(w);
+                    }
+                    std::complex<float> odd = multiply(w, data[start + k + half]);
+                    data[start + k + half] = data[start + k] - odd;
+                    data[start + k] += odd;
+                }
+            }
+        }
+    }
+
+    Eigen::Index size;
+    std::vector<std::complex<float>> twiddles;
+    std::vector<std::uint32_t> reversed;
+};
@@ -8,8 +8,9 @@
 
 template<typename UnaryFunction>
 void rangeParExec(Eigen::Index max, const UnaryFunction& func) {
+    // `high` must be `max - 1`: for a single element `setLinSpaced` yields `high`
     MatColX<int> range(max);
-    range.setLinSpaced(0, (int)max);
+    range.setLinSpaced(0, (int)max - 1);
 
     std::for_each(
         std::execution::par,
@@ -0,0 +1,201 @@
+// random.h: Implements counter-based (Philox4x32-10) random number generation
+
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <execution>
+#include <numbers>
+#include <vector>
+#include <Eigen/Core>
+#include "types.h"
+#include "paral.h"
+
+/*
+* @brief: Philox4x32-10 counter-based generator (Salmon et al., "Parallel random numbers:
+*         as easy as 1, 2, 3")
+*
+* The `i`-th random 32-bit word of a generator is a pure function of (seed, stream, i),
+* so any slice of the sequence can be produced independently of the others. This makes
+* filling large matrices parallelizable while keeping the result bit-identical regardless
+* of thread count, and avoids any global state (unlike `std::srand`).
+*/
+class Philox {
+public:
+    Philox(std::uint64_t seed, std::uint64_t stream = 0) :
+        key{ (std::uint32_t)seed, (std::uint32_t)(seed >> 32) },
+        stream{ (std::uint32_t)stream, (std::uint32_t)(stream >> 32) } {}
+
+    // Stream id of the @index-th of several sequences drawn by one object given stream @stream
+    // (e.g. one per weight matrix), mixed with the SplitMix64 finalizer so that it collides
+    // neither with @stream nor, in practice, with the ids callers pick for other objects
+    static std::uint64_t substream(std::uint64_t stream, std::uint64_t index) {
+        std::uint64_t z = stream + 0x9e3779b97f4a7c15ull * (index + 1);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // Writes the 4 * @num_blocks words of blocks `first_block, first_block + 1, ...` to @out
+    void words(std::uint64_t first_block, std::size_t num_blocks, std::uint32_t* out) const {
+        std::uint32_t c0[batch], c1[batch], c2[batch], c3[batch];
+
+        for (std::size_t done = 0; done < num_blocks; done += batch) {
+            std::size_t count = std::min(batch, num_blocks - done);
+
+            // Structure-of-arrays layout so the rounds below vectorize
+            for (std::size_t j = 0; j < batch; j++) {
+                std::uint64_t counter = first_block + done + j;
+                c0[j] = (std::uint32_t)counter;
+                c1[j] = (std::uint32_t)(counter >> 32);
+                c2[j] = stream[0];
+                c3[j] = stream[1];
+            }
+
+            std::uint32_t k0 = key[0], k1 = key[1];
+            for (int round = 0; round < 10; round++) {
+                for (std::size_t j = 0; j < batch; j++) {
+                    std::uint64_t p0 = (std::uint64_t)m0 * c0[j];
+                    std::uint64_t p1 = (std::uint64_t)m1 * c2[j];
+                    std::uint32_t n0 = (std::uint32_t)(p1 >> 32) ^ c1[j] ^ k0;
+                    std::uint32_t n2 = (std::uint32_t)(p0 >> 32) ^ c3[j] ^ k1;
+                    c1[j] = (std::uint32_t)p1;
+                    c3[j] = (std::uint32_t)p0;
+                    c0[j] = n0;
+                    c2[j] = n2;
+                }
+                k0 += w0;
+                k1 += w1;
+            }
+
+            for (std::size_t j = 0; j < count; j++) {
+                std::uint32_t* block_out = out + 4 * (done + j);
+                block_out[0] = c0[j];
+                block_out[1] = c1[j];
+                block_out[2] = c2[j];
+                block_out[3] = c3[j];
+            }
+        }
+    }
+
+    // Single block, for scalar use
+    std::array<std::uint32_t, 4> operator()(std::uint64_t block) const {
+        std::array<std::uint32_t, 4> out;
+        words(block, 1, out.data());
+        return out;
+    }
+
+    // Writes elements [@first, @first + @count) of the stream of uniforms in [@low, @high)
+    void uniform(std::uint64_t first, std::size_t count, float* out, float low = 0.0, float high = 1.0) const {
+        generate(first, count, out, [low, high](const std::uint32_t* w, float* o, std::size_t n) {
+            float scale = (high - low) * 0x1.0p-24f;
+            for (std::size_t j = 0; j < n; j++) {
+                o[j] = low + scale * (float)(w[j] >> 8);
+            }
+        });
+    }
+
+    // Writes elements [@first, @first + @count) of the stream of normals (Box-Muller transform)
+    void normal(std::uint64_t first, std::size_t count, float* out, float mean = 0.0, float stddev = 1.0) const {
+        generate(first, count, out, [mean, stddev](const std::uint32_t* w, float* o, std::size_t n) {
+            constexpr float two_pi = 2.0f * std::numbers::pi_v<float>;
+            for (std::size_t j = 0; j < n; j += 2) {
+                // `u_1` lies in (0, 1] so the logarithm is finite
+                float u_1 = 0x1.0p-24f * (float)((w[j] >> 8) + 1);
+                float u_2 = 0x1.0p-24f * (float)(w[j + 1] >> 8);
+                float r = stddev * std::sqrt(-2.0f * std::log(u_1));
+                o[j] = mean + r * std::cos(two_pi * u_2);
+                o[j + 1] = mean + r * std::sin(two_pi * u_2);
+            }
+        });
+    }
+
+    /*
+    * @brief: Fills a dense Eigen obj with uniforms in [@low, @high), in parallel. Element at
+    *         storage position `i` always receives stream element `i`
+    */
+    template<typename Derived>
+    void fillUniform(Eigen::PlainObjectBase<Derived>& mat, float low = 0.0, float high = 1.0) const {
+        parallelFill(mat.data(), (std::size_t)mat.size(), [&](std::uint64_t first, std::size_t count, float* out) {
+            uniform(first, count, out, low, high);
+        });
+    }
+
+    // Fills a dense Eigen obj with normals, in parallel. Same layout guarantee as `fillUniform`
+    template<typename Derived>
+    void fillNormal(Eigen::PlainObjectBase<Derived>& mat, float mean = 0.0, float stddev = 1.0) const {
+        parallelFill(mat.data(), (std::size_t)mat.size(), [&](std::uint64_t first, std::size_t count, float* out) {
+            normal(first, count, out, mean, stddev);
+        });
+    }
+
+    // Random permutation of `0, ..., n - 1`, obtained by sorting on per-index random keys
+    MatColX<int> permutation(Eigen::Index n) const {
+        std::vector<std::uint64_t> keys(n);
+        rangeParExec(
+            (n + 3) / 4,
+            [&](int& block) {
+                auto w = (*this)(block);
+                for (int j = 0; j < 4 && 4 * block + j < n; j++) {
+                    // Index in low bits breaks ties and makes keys unique
+                    keys[4 * block + j] = ((std::uint64_t)w[j] << 32) | (std::uint64_t)(4 * block + j);
+                }
+            }
+        );
+        std::sort(std::execution::par, keys.begin(), keys.end());
+
+        MatColX<int> perm(n);
+        for (Eigen::Index i = 0; i < n; i++) {
+            perm[i] = (int)(std::uint32_t)keys[i];
+        }
+        return perm;
+    }
+
+private:
+    // Number of blocks processed together; multiple of the widest SIMD register
+    constexpr static std::size_t batch = 16;
+    // Elements per parallel task; multiple of 4 so that tasks start on block boundaries
+    constexpr static std::size_t chunk = 4096;
+
+    constexpr static std::uint32_t m0 = 0xD2511F53, m1 = 0xCD9E8D57;
+    constexpr static std::uint32_t w0 = 0x9E3779B9, w1 = 0xBB67AE85;
+
+    // Runs @transform over the random words of stream elements [@first, @first + @count).
+    // @transform consumes words in place of elements and must handle even counts
+    template<typename Transform>
+    void generate(std::uint64_t first, std::size_t count, float* out, const Transform& transform) const {
+        constexpr std::size_t num_words = 4 * batch;
+        std::uint32_t w[num_words];
+        float o[num_words];
+
+        std::uint64_t block = first / 4;
+        std::size_t skip = first % 4;
+        std::size_t written = 0;
+        while (written < count) {
+            words(block, batch, w);
+            transform(w, o, num_words);
+
+            std::size_t n = std::min(num_words - skip, count - written);
+            std::copy(o + skip, o + skip + n, out + written);
+
+            written += n;
+            block += batch;
+            skip = 0;
+        }
+    }
+
+    template<typename Filler>
+    static void parallelFill(float* data, std::size_t size, const Filler& filler) {
+        rangeParExec(
+            (Eigen::Index)((size + chunk - 1) / chunk),
+            [&](int& task) {
+                std::size_t first = (std::size_t)task * chunk;
+                filler(first, std::min(chunk, size - first), data + first);
+            }
+        );
+    }
+
+    std::array<std::uint32_t, 2> key;
+    std::array<std::uint32_t, 2> stream;
+};
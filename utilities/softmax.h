@@ -1,9 +1,12 @@
 // softmax.h: Implements softmax function
 
 #pragma once
+#include <algorithm>
 #include <cmath>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <utility>
 #include <Eigen/Core>
 #include "types.h"
 #include "traits_concepts.h"
@@ -15,8 +18,19 @@ static float myExp(float x) {
 
 enum class Ax {Zero, One, None};
 
+// Maxima along @axis are subtracted before exponentiating, so large inputs cannot overflow
 auto softMax(const Eigen::Ref<const MatrixX_RowMajor<float>>& input, Ax axis = Ax::None) {
-    auto raised = input.unaryExpr(std::ref(myExp)).eval();
+    MatrixX_RowMajor<float> shifted;
+    if (axis == Ax::Zero) {
+        shifted = input.rowwise() - input.colwise().maxCoeff();
+    }
+    else if (axis == Ax::One) {
+        shifted = input.colwise() - input.rowwise().maxCoeff();
+    }
+    else {
+        shifted = input.array() - (input.size() > 0 ? input.maxCoeff() : 0.0f);
+    }
+    auto raised = shifted.unaryExpr(std::ref(myExp)).eval();
     
     if (axis == Ax::Zero) {
         MatRowX<float> s = raised.colwise().sum();
@@ -40,5 +54,58 @@ auto softMax(const Eigen::Ref<const MatrixX_RowMajor<float>>& input, Ax axis = A
 
 template<typename Derived>
 auto softMax(const Eigen::ArrayBase<Derived>& input, Ax axis = Ax::None) {
-    return softmax(input.matrix().eval(), axis).array().eval();
+    return softMax(input.matrix().eval(), axis).array().eval();
+}
+
+/*
+* @brief: Running maximum and normalizer of a softmax over scores seen block by block (online
+*         softmax), so that the full score vector never needs to be stored. Quantities weighted
+*         by `exp(score - max)` and accumulated alongside must be multiplied by the factors
+*         returned by `update` and `merge` whenever the maximum grows
+*/
+struct OnlineSoftmax {
+    float max = -std::numeric_limits<float>::infinity();
+    float sum = 0;
+
+    // Folds in the block @scores, overwriting them with `exp(score - max)` for the updated
+    // maximum. Returns the factor rescaling previously accumulated quantities
+    float update(Eigen::Ref<ArrRowX<float>> scores) {
+        if (scores.size() == 0) {
+            return 1.0f;
+        }
+        float new_max = std::max(max, scores.maxCoeff());
+        float rescale = myExp(max - new_max);
+        scores = (scores - new_max).unaryExpr(std::ref(myExp));
+        sum = sum * rescale + scores.sum();
+        max = new_max;
+        return rescale;
+    }
+
+    // Folds in the state @other of a disjoint set of scores. Returns the factors rescaling the
+    // quantities accumulated with this state and with @other, respectively
+    std::pair<float, float> merge(const OnlineSoftmax& other) {
+        if (other.sum == 0) {
+            return std::make_pair(1.0f, 0.0f);
+        }
+        float new_max = std::max(max, other.max);
+        std::pair<float, float> rescale(myExp(max - new_max), myExp(other.max - new_max));
+        sum = sum * rescale.first + other.sum * rescale.second;
+        max = new_max;
+        return rescale;
+    }
+
+    // Log of the normalizer; `exp(score - logSumExp())` is the softmax probability of a score
+    float logSumExp() const {
+        return max + std::log(sum);
+    }
+};
+
+/*
+* @brief: Gradient wrt the scores of a softmax, given its probabilities @probs and the gradient
+*         @grad wrt them: `probs * (grad - dot)`, with `dot` the sum over all scores of
+*         `probs * grad`. Passing @dot separately allows processing the scores in blocks
+*/
+template<typename Derived_1, typename Derived_2>
+auto softMaxBackward(const Eigen::ArrayBase<Derived_1>& probs, const Eigen::ArrayBase<Derived_2>& grad, float dot) {
+    return (probs * (grad - dot)).eval();
 }
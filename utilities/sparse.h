@@ -0,0 +1,132 @@
+// sparse.h: Contains sparse-dense product kernels for activations and gradients with many zeros
+
+#pragma once
+#include <algorithm>
+#include <vector>
+#include <Eigen/Core>
+#include "types.h"
+#include "paral.h"
+
+namespace SparseKernels {
+    /*
+    * @brief: Density (fraction of nonzero entries) below which `LinearLayer` switches its weight
+    *         and input gradient products to the kernels below. Calibrated with `SparseBench`
+    *         (benchmarks/sparse_bench.cpp): crossovers ranged over 0.2 to 0.4 across shapes, the
+    *         lowest is kept so that the switch never slows a product down. May be retuned at runtime
+    */
+    inline float density_threshold = 0.2f;
+
+    /*
+    * @brief: Density below which `LinearLayer` computes its forward product `inputs * weights` with
+    *         the kernels below, e.g. for inputs stored dense but made of indicator features.
+    *         `SparseBench` crossovers (density estimate and compression included) ranged over 0.25
+    *         to 0.3. May be retuned at runtime, zero disables the switch
+    */
+    inline float forward_density_threshold = 0.25f;
+
+    inline float density(const MatrixX_RowMajor_Ref<float>& mat) {
+        return mat.size() > 0 ? (float)(mat.array() != 0.0f).count() / (float)mat.size() : 1.0f;
+    }
+
+    /*
+    * @brief: Whether the density of @mat is below @threshold, estimated on at most @sample_rows
+    *         evenly spaced rows, so that dense batches are rejected at a small fraction of the cost
+    *         of a product. Exact for matrices with fewer rows
+    */
+    inline bool sparseEnough(const MatrixX_RowMajor_Ref<float>& mat, float threshold, Eigen::Index sample_rows = 32) {
+        if (threshold <= 0 || mat.size() == 0) {
+            return false;
+        }
+        if (mat.rows() <= sample_rows) {
+            return density(mat) < threshold;
+        }
+        Eigen::Index nonzeros = 0;
+        for (Eigen::Index k = 0; k < sample_rows; k++) {
+            nonzeros += (mat.row(k * mat.rows() / sample_rows).array() != 0.0f).count();
+        }
+        return (float)nonzeros < threshold * (float)(sample_rows * mat.cols());
+    }
+
+    // Compressed sparse rows (CSR) of a row-major matrix
+    struct CompressedRows {
+        Eigen::Index rows = 0;
+        Eigen::Index cols = 0;
+        std::vector<Eigen::Index> starts; // Nonzeros of row `r` lie in `[starts[r], starts[r + 1])`
+        std::vector<int> indices;
+        std::vector<float> values;
+    };
+
+    // Builds the CSR of @mat in two parallel passes (count, then fill), dropping exact zeros
+    inline CompressedRows compress(const MatrixX_RowMajor_Ref<float>& mat) {
+        CompressedRows csr;
+        csr.rows = mat.rows();
+        csr.cols = mat.cols();
+        csr.starts.assign(mat.rows() + 1, 0);
+        rangeParExec(
+            mat.rows(),
+            [&](int& r) {
+                csr.starts[r + 1] = (mat.row(r).array() != 0.0f).count();
+            }
+        );
+        for (Eigen::Index r = 0; r < mat.rows(); r++) {
+            csr.starts[r + 1] += csr.starts[r];
+        }
+        csr.indices.resize(csr.starts.back());
+        csr.values.resize(csr.starts.back());
+        rangeParExec(
+            mat.rows(),
+            [&](int& r) {
+                Eigen::Index k = csr.starts[r];
+                for (Eigen::Index j = 0; j < mat.cols(); j++) {
+                    float value = mat(r, j);
+                    if (value != 0.0f) {
+                        csr.indices[k] = (int)j;
+                        csr.values[k++] = value;
+                    }
+                }
+            }
+        );
+        return csr;
+    }
+
+    /*
+    * @brief: Writes `sparse^T * dense` to the top rows of @out (`sparse.cols x dense.cols`): each
+    *         nonzero `(r, j)` adds a scaled row of @dense to row `j` of @out. Tasks own disjoint
+    *         column blocks of @out, so no two threads write the same entry
+    */
+    inline void transposedProduct(const CompressedRows& sparse, const MatrixX_RowMajor_Ref<float>& dense,
+                                  Eigen::Ref<MatrixX_RowMajor<float>> out) {
+        constexpr Eigen::Index block = 256;
+        Eigen::Index num_cols = dense.cols();
+        out.topRows(sparse.cols).setZero();
+        rangeParExec(
+            (num_cols + block - 1) / block,
+            [&](int& b) {
+                Eigen::Index first = b * block, width = std::min(block, num_cols - first);
+                for (Eigen::Index r = 0; r < sparse.rows; r++) {
+                    auto dense_row = dense.row(r).segment(first, width);
+                    for (Eigen::Index k = sparse.starts[r]; k < sparse.starts[r + 1]; k++) {
+                        out.row(sparse.indices[k]).segment(first, width) += sparse.values[k] * dense_row;
+                    }
+                }
+            }
+        );
+    }
+
+    /*
+    * @brief: Writes `sparse * dense` to @out (`sparse.rows x dense.cols`): row `r` of @out sums the
+    *         rows of @dense selected by the nonzeros of row `r`. Parallel over rows
+    */
+    inline void product(const CompressedRows& sparse, const MatrixX_RowMajor_Ref<float>& dense,
+                        Eigen::Ref<MatrixX_RowMajor<float>> out) {
+        rangeParExec(
+            sparse.rows,
+            [&](int& r) {
+                out.row(r).setZero();
+                for (Eigen::Index k = sparse.starts[r]; k < sparse.starts[r + 1]; k++) {
+                    out.row(r) += sparse.values[k] * dense.row(sparse.indices[k]);
+                }
+            }
+        );
+    }
+}